@@ -0,0 +1,158 @@
+//
+//  slic_bench.cpp
+//  Compares the speed of the C API (slic_encode/slic_decode, linked from
+//  slic.cpp) with the SLICEncoder/SLICDecoder templates of slic_codec.h on the
+//  same pixels. Each image is coded in one call, a row per call and a pixel
+//  per call, so that the cost of each call shows as well as the pixel loops.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "../../src/slic_codec.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define REPEAT 5 // best of
+
+static double now_ms()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+} /* now_ms() */
+//
+// Flat areas, gradients, small steps and noise
+//
+static void make_image(uint8_t *pRGBA, int iWidth, int iHeight)
+{
+    int x, y, band;
+    uint8_t *p = pRGBA;
+
+    srand(1);
+    for (y=0; y<iHeight; y++) {
+        for (x=0; x<iWidth; x++) {
+            band = (x / 64 + y / 48) & 3;
+            p[0] = (band == 0) ? 200 : (band == 1) ? (x + y) : (band == 2) ? (x * 3) : rand();
+            p[1] = (band == 0) ? 40 : (band == 1) ? (x - y) : (band == 2) ? (y * 2) : (rand() & 0x3f);
+            p[2] = (band == 0) ? 90 : (p[0] + p[1]);
+            p[3] = 0xff;
+            p += 4;
+        }
+    }
+} /* make_image() */
+//
+// Convert the RGBA image into the pixels of a format
+//
+static void convert_image(uint8_t *pOut, const uint8_t *pRGBA, int iCount, int iBpp)
+{
+    int i;
+    const uint8_t *s = pRGBA;
+
+    for (i=0; i<iCount; i++) {
+        switch (iBpp) {
+            case 8:
+                *pOut++ = (uint8_t)((s[0] + s[1] * 2 + s[2]) >> 2);
+                break;
+            case 16: {
+                uint16_t u16 = ((s[0] >> 3) << 11) | ((s[1] >> 2) << 5) | (s[2] >> 3);
+                memcpy(pOut, &u16, 2);
+                pOut += 2;
+                break;
+            }
+            default:
+                memcpy(pOut, s, iBpp >> 3);
+                pOut += iBpp >> 3;
+                break;
+        }
+        s += 4;
+    }
+} /* convert_image() */
+//
+// Time a coder over the image with iStep pixels per call; returns ms
+//
+template <class F>
+static double time_calls(F fn, int iStep, int iBpp)
+{
+    double t, tBest = 1e9;
+    int i, j, iCount = WIDTH * HEIGHT;
+
+    for (j=0; j<REPEAT; j++) {
+        t = now_ms();
+        for (i=0; i<iCount; i+=iStep)
+            fn(i * (iBpp >> 3), iStep);
+        t = now_ms() - t;
+        if (t < tBest)
+            tBest = t;
+    }
+    return tBest;
+} /* time_calls() */
+
+template <class Format>
+static void bench_format(const char *szName, const uint8_t *pRGBA)
+{
+    const int iBpp = Format::bpp, iCount = WIDTH * HEIGHT;
+    const int iSteps[3] = {iCount, WIDTH, 1};
+    const char *szSteps[3] = {"image", "row", "pixel"};
+    uint8_t *pPixels, *pOut, *pData;
+    int i, iDataSize, iOutSize;
+    SLICSTATE state;
+
+    iOutSize = iCount * (iBpp >> 3) * 2 + 4096;
+    pPixels = (uint8_t *)malloc(iCount * (iBpp >> 3));
+    pOut = (uint8_t *)malloc(iCount * (iBpp >> 3) + 8);
+    pData = (uint8_t *)malloc(iOutSize);
+    convert_image(pPixels, pRGBA, iCount, iBpp);
+    slic_init_encode(NULL, &state, WIDTH, HEIGHT, iBpp, NULL, NULL, NULL, pData, iOutSize);
+    slic_encode(&state, pPixels, iCount);
+    iDataSize = (int)state.iOffset;
+    printf("%s: %d -> %d bytes\n", szName, iCount * (iBpp >> 3), iDataSize);
+    for (i=0; i<3; i++) {
+        SLICEncoder<Format, SLICMemoryIO> enc;
+        SLICDecoder<Format, SLICMemoryIO> dec;
+        double tEncC, tEncT, tDecC, tDecT;
+
+        tEncC = time_calls([&](int iOffset, int n) {
+            if (iOffset == 0)
+                slic_init_encode(NULL, &state, WIDTH, HEIGHT, iBpp, NULL, NULL, NULL, pData, iOutSize);
+            slic_encode(&state, &pPixels[iOffset], n);
+        }, iSteps[i], iBpp);
+        tEncT = time_calls([&](int iOffset, int n) {
+            if (iOffset == 0)
+                enc.init(WIDTH, HEIGHT, SLICMemoryIO(pData, iOutSize));
+            enc.encode(&pPixels[iOffset], n);
+        }, iSteps[i], iBpp);
+        tDecC = time_calls([&](int iOffset, int n) {
+            if (iOffset == 0)
+                slic_init_decode(NULL, &state, pData, iDataSize, NULL, NULL, NULL);
+            slic_decode(&state, &pOut[iOffset], n);
+        }, iSteps[i], iBpp);
+        tDecT = time_calls([&](int iOffset, int n) {
+            if (iOffset == 0)
+                dec.init(SLICMemoryIO(pData, iDataSize));
+            dec.decode(&pOut[iOffset], n);
+        }, iSteps[i], iBpp);
+        if (memcmp(pOut, pPixels, iCount * (iBpp >> 3)) != 0)
+            printf("  decoded pixels don't match!\n");
+        printf("  per %-5s  encode C %7.2f ms, template %7.2f ms (%.2fx)   decode C %7.2f ms, template %7.2f ms (%.2fx)\n",
+               szSteps[i], tEncC, tEncT, tEncC / tEncT, tDecC, tDecT, tDecC / tDecT);
+    }
+    free(pPixels);
+    free(pOut);
+    free(pData);
+} /* bench_format() */
+
+int main(int argc, const char * argv[])
+{
+    uint8_t *pRGBA;
+
+    (void)argc; (void)argv;
+    pRGBA = (uint8_t *)malloc(WIDTH * HEIGHT * 4);
+    make_image(pRGBA, WIDTH, HEIGHT);
+    printf("SLIC C API vs. templates, %dx%d, best of %d\n", WIDTH, HEIGHT, REPEAT);
+    bench_format<SLICGray8>("8-bpp gray", pRGBA);
+    bench_format<SLICRGB565>("RGB565", pRGBA);
+    bench_format<SLICRGB24>("24-bpp RGB", pRGBA);
+    bench_format<SLICRGBA32>("32-bpp RGBA", pRGBA);
+    free(pRGBA);
+    return 0;
+} /* main() */
@@ -0,0 +1,239 @@
+//
+//  slic_decode_bench.c
+//  Measures the encoder's and decoder's speed in cycles per pixel (x86, from
+//  the time stamp counter) and nanoseconds per pixel on a photo-like and a
+//  UI-like image in each of the 8-bpp, RGB565, 24-bpp and 32-bpp formats,
+//  with each set of kernels (slic_set_isa()) the CPU can run. The encoded
+//  data of each set is checked against the plain C one. Binary PPM/PGM files
+//  given on the command line are measured as well, so that real image sets
+//  can be compared before and after a change.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../src/slic.h"
+#include "../../src/slic.inl"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC
+#endif
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define REPEAT 15 // best of
+
+static double now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1e9 + t.tv_nsec;
+} /* now_ns() */
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+} /* now_cycles() */
+//
+// Smooth shading, soft edges and a little sensor noise
+//
+static void make_photo(uint8_t *pRGBA, int iWidth, int iHeight)
+{
+    int x, y, c, v;
+    uint8_t *p = pRGBA;
+
+    srand(1);
+    for (y=0; y<iHeight; y++) {
+        for (x=0; x<iWidth; x++) {
+            for (c=0; c<3; c++) {
+                v = 128 + (int)(60 * ((x * (c + 1) + y * 2) % 512 - 256) / 256) + (((x / 97) ^ (y / 61)) & 3) * 12;
+                v += (rand() % 5) - 2;
+                p[c] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+            }
+            p[3] = 0xff;
+            p += 4;
+        }
+    }
+} /* make_photo() */
+//
+// Flat panels, buttons with gradients and lines of small text-like glyphs
+//
+static void make_ui(uint8_t *pRGBA, int iWidth, int iHeight)
+{
+    static const uint8_t ucColors[4][3] = {{240,240,240}, {32,96,200}, {255,255,255}, {60,60,60}};
+    int x, y, c, iPanel;
+    uint8_t *p = pRGBA;
+
+    srand(2);
+    for (y=0; y<iHeight; y++) {
+        for (x=0; x<iWidth; x++) {
+            iPanel = ((x / 480) + (y / 270)) & 3;
+            for (c=0; c<3; c++)
+                p[c] = ucColors[iPanel][c];
+            if ((y % 90) >= 20 && (y % 90) < 50 && (x % 240) >= 20 && (x % 240) < 200) { // button
+                for (c=0; c<3; c++)
+                    p[c] = (uint8_t)(ucColors[(iPanel + 1) & 3][c] - (y % 90) + 20);
+            } else if ((y % 30) >= 8 && (y % 30) < 20 && ((x * 7 + y * 3) % 11) < 3 && (x / 6) % 9 != 0) { // text
+                for (c=0; c<3; c++)
+                    p[c] = (uint8_t)(ucColors[(iPanel + 3) & 3][c] + ((rand() & 1) ? 40 : 0)); // anti-aliased edges
+            }
+            p[3] = 0xff;
+            p += 4;
+        }
+    }
+} /* make_ui() */
+//
+// Convert RGBA pixels into the pixels of a format
+//
+static void convert_image(uint8_t *pOut, const uint8_t *pRGBA, int iCount, int iBpp)
+{
+    int i;
+    uint16_t u16;
+
+    for (i=0; i<iCount; i++, pRGBA += 4) {
+        if (iBpp == 8) {
+            *pOut++ = (uint8_t)((pRGBA[0] + pRGBA[1] * 2 + pRGBA[2]) >> 2);
+        } else if (iBpp == 16) {
+            u16 = ((pRGBA[0] >> 3) << 11) | ((pRGBA[1] >> 2) << 5) | (pRGBA[2] >> 3);
+            memcpy(pOut, &u16, 2);
+            pOut += 2;
+        } else {
+            memcpy(pOut, pRGBA, iBpp >> 3);
+            pOut += iBpp >> 3;
+        }
+    }
+} /* convert_image() */
+
+static void bench_image(const char *szName, const uint8_t *pRGBA, int iWidth, int iHeight)
+{
+    static const int iBpps[4] = {8, 16, 24, 32};
+    static const char *szISAs[] = {"auto", "scalar", "sse4", "avx2", "neon"};
+    const int iCount = iWidth * iHeight;
+    uint8_t *pPixels, *pOut, *pData, *pRef;
+    int i, j, y, iISA, iPitch, iDataSize, iRefSize, iOutSize, bOK;
+    double t, tEnc, tDec;
+    uint64_t c, cEnc, cDec;
+    SLICSTATE state;
+
+    for (i=0; i<4; i++) {
+        iPitch = iWidth * (iBpps[i] >> 3);
+        iOutSize = iCount * 5 + 4096;
+        pPixels = (uint8_t *)malloc(iPitch * iHeight + 8);
+        pOut = (uint8_t *)malloc(iPitch * iHeight + 8);
+        pData = (uint8_t *)malloc(iOutSize);
+        pRef = (uint8_t *)malloc(iOutSize);
+        convert_image(pPixels, pRGBA, iCount, iBpps[i]);
+        slic_set_isa(SLIC_ISA_SCALAR); // the output of the other kernels has to match it
+        slic_init_encode(NULL, &state, iWidth, iHeight, iBpps[i], NULL, NULL, NULL, pRef, iOutSize);
+        slic_encode(&state, pPixels, iCount);
+        iRefSize = (int)state.iOffset;
+        for (iISA=SLIC_ISA_SCALAR; iISA<=SLIC_ISA_NEON; iISA++) {
+            if (slic_set_isa(iISA) != SLIC_SUCCESS)
+                continue; // not on this CPU
+            tEnc = tDec = 1e30;
+            cEnc = cDec = ~0ULL;
+            for (j=0; j<REPEAT; j++) {
+                t = now_ns();
+                c = now_cycles();
+                slic_init_encode(NULL, &state, iWidth, iHeight, iBpps[i], NULL, NULL, NULL, pData, iOutSize);
+                for (y=0; y<iHeight; y++)
+                    slic_encode(&state, &pPixels[y * iPitch], iWidth);
+                c = now_cycles() - c;
+                t = now_ns() - t;
+                if (t < tEnc)
+                    tEnc = t;
+                if (c < cEnc)
+                    cEnc = c;
+            }
+            iDataSize = (int)state.iOffset;
+            for (j=0; j<REPEAT; j++) {
+                t = now_ns();
+                c = now_cycles();
+                slic_init_decode(NULL, &state, pData, iDataSize, NULL, NULL, NULL);
+                for (y=0; y<iHeight; y++)
+                    slic_decode(&state, &pOut[y * iPitch], iWidth);
+                c = now_cycles() - c;
+                t = now_ns() - t;
+                if (t < tDec)
+                    tDec = t;
+                if (c < cDec)
+                    cDec = c;
+            }
+            bOK = (iDataSize == iRefSize && memcmp(pData, pRef, iDataSize) == 0);
+            printf("%-12s %2d-bpp %-6s %9d bytes  encode %6.2f cycles/pixel %6.2f ns/pixel  decode %6.2f cycles/pixel %6.2f ns/pixel%s%s\n",
+                   szName, iBpps[i], szISAs[iISA], iDataSize, (double)cEnc / iCount, tEnc / iCount, (double)cDec / iCount, tDec / iCount,
+                   bOK ? "" : "  (encoded data differs from scalar!)",
+                   (memcmp(pOut, pPixels, iPitch * iHeight) == 0) ? "" : "  (decoded pixels don't match!)");
+        }
+        free(pPixels);
+        free(pOut);
+        free(pData);
+        free(pRef);
+    }
+} /* bench_image() */
+//
+// Read a binary PPM (P6) or PGM (P5) file as RGBA pixels
+//
+static uint8_t * read_pnm(const char *szName, int *piWidth, int *piHeight)
+{
+    FILE *f;
+    char szType[3] = {0};
+    int i, iMax, iChannels, iWidth, iHeight;
+    uint8_t *pRGBA = NULL, *pFile;
+
+    f = fopen(szName, "rb");
+    if (f == NULL)
+        return NULL;
+    if (fscanf(f, "%2s %d %d %d", szType, &iWidth, &iHeight, &iMax) == 4 && iMax == 255 && iWidth > 0 && iHeight > 0 &&
+        (strcmp(szType, "P6") == 0 || strcmp(szType, "P5") == 0)) {
+        fgetc(f); // single whitespace after the header
+        iChannels = (szType[1] == '6') ? 3 : 1;
+        pFile = (uint8_t *)malloc((size_t)iWidth * iHeight * iChannels);
+        pRGBA = (uint8_t *)malloc((size_t)iWidth * iHeight * 4);
+        if (fread(pFile, iChannels, (size_t)iWidth * iHeight, f) == (size_t)iWidth * iHeight) {
+            for (i=0; i<iWidth * iHeight; i++) {
+                pRGBA[i*4+0] = pFile[i*iChannels];
+                pRGBA[i*4+1] = pFile[i*iChannels + (iChannels - 1) / 2];
+                pRGBA[i*4+2] = pFile[i*iChannels + iChannels - 1];
+                pRGBA[i*4+3] = 0xff;
+            }
+            *piWidth = iWidth;
+            *piHeight = iHeight;
+        } else {
+            free(pRGBA);
+            pRGBA = NULL;
+        }
+        free(pFile);
+    }
+    fclose(f);
+    return pRGBA;
+} /* read_pnm() */
+
+int main(int argc, const char * argv[])
+{
+    uint8_t *pRGBA;
+    int i, iWidth, iHeight;
+
+    printf("SLIC encode/decode speed, best of %d, a row per call\n", REPEAT);
+    pRGBA = (uint8_t *)malloc(WIDTH * HEIGHT * 4);
+    make_photo(pRGBA, WIDTH, HEIGHT);
+    bench_image("photo", pRGBA, WIDTH, HEIGHT);
+    make_ui(pRGBA, WIDTH, HEIGHT);
+    bench_image("ui", pRGBA, WIDTH, HEIGHT);
+    free(pRGBA);
+    for (i=1; i<argc; i++) {
+        pRGBA = read_pnm(argv[i], &iWidth, &iHeight);
+        if (pRGBA == NULL) {
+            printf("Error reading %s (binary PPM/PGM files only)\n", argv[i]);
+            continue;
+        }
+        bench_image(argv[i], pRGBA, iWidth, iHeight);
+        free(pRGBA);
+    }
+    return 0;
+} /* main() */
@@ -0,0 +1,46 @@
+//
+//  slic_size.cpp
+//  The same RGB565 encode + decode built with the C API and with the
+//  templates of slic_codec.h; compare their sizes with "make size"
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef SLIC_SIZE_TEMPLATE
+#include "../../src/slic_codec.h"
+#else
+#include "../../src/slic.h"
+#endif
+
+#define WIDTH 64
+#define HEIGHT 64
+
+static uint16_t usPixels[WIDTH * HEIGHT], usOut[WIDTH * HEIGHT];
+static uint8_t ucData[WIDTH * HEIGHT * 4];
+
+int main(int argc, const char * argv[])
+{
+    int i, rc, iDataSize;
+
+    (void)argv;
+    for (i=0; i<WIDTH * HEIGHT; i++)
+        usPixels[i] = (uint16_t)((i / 3) * argc);
+#ifdef SLIC_SIZE_TEMPLATE
+    SLICEncoder<SLICRGB565, SLICMemoryIO> enc;
+    SLICDecoder<SLICRGB565, SLICMemoryIO> dec;
+    enc.init(WIDTH, HEIGHT, SLICMemoryIO(ucData, sizeof(ucData)));
+    enc.encode((uint8_t *)usPixels, WIDTH * HEIGHT);
+    iDataSize = (int)enc.get_output_size();
+    dec.init(SLICMemoryIO(ucData, iDataSize));
+    rc = dec.decode((uint8_t *)usOut, WIDTH * HEIGHT);
+#else
+    SLICSTATE state;
+    slic_init_encode(NULL, &state, WIDTH, HEIGHT, 16, NULL, NULL, NULL, ucData, sizeof(ucData));
+    slic_encode(&state, (uint8_t *)usPixels, WIDTH * HEIGHT);
+    iDataSize = (int)state.iOffset;
+    slic_init_decode(NULL, &state, ucData, iDataSize, NULL, NULL, NULL);
+    rc = slic_decode(&state, (uint8_t *)usOut, WIDTH * HEIGHT);
+#endif
+    printf("%d bytes, %s\n", iDataSize, (rc == SLIC_DONE && memcmp(usOut, usPixels, sizeof(usOut)) == 0) ? "ok" : "failed");
+    return 0;
+} /* main() */
@@ -2,6 +2,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#define SLIC_STATS // for --stats
 #include "../../src/slic.h"
 #include "../../src/slic.inl"
 
@@ -52,7 +54,7 @@ int iHeaderSize;
     }
     
     oHandle = fopen(fname, "w+b");
-    bsize = (cx * bpp) >> 3;
+    bsize = (cx * bpp + 7) >> 3;
     lsize = (bsize + 3) & 0xfffc; /* Width of each line */
     pHdr[26] = 1; // number of planes
     pHdr[28] = (uint8_t)bpp;
@@ -168,7 +170,7 @@ uint8_t * ReadBMP(const char *fname, int *width, int *height, int *bpp, unsigned
         }
     }
     offset = *(int32_t *)&pTemp[10]; // offset to bits
-    bytewidth = (w * bits) >> 3;
+    bytewidth = (w * bits + 7) >> 3;
     pitch = (bytewidth + 3) & 0xfffc; // DWORD aligned
 // move up the pixels
     d = pBitmap;
@@ -202,6 +204,147 @@ uint8_t * ReadBMP(const char *fname, int *width, int *height, int *bpp, unsigned
 
 } /* ReadBMP() */
 
+//
+// Minimal code to save 16-bit per channel images as PGM/PPM/PAM files
+// and 8-bit gray+alpha images as PAM files
+//
+void WritePNM(char *fname, uint8_t *pBitmap, int cx, int cy, int iChannels)
+{
+FILE * oHandle;
+int i, iCount;
+uint16_t *s = (uint16_t *)pBitmap;
+uint8_t *pTemp, *d;
+
+    oHandle = fopen(fname, "w+b");
+    if (oHandle == NULL)
+        return;
+    if (iChannels == 2) { // 8-bit gray+alpha
+        fprintf(oHandle, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 2\nMAXVAL 255\nTUPLTYPE GRAYSCALE_ALPHA\nENDHDR\n", cx, cy);
+        fwrite(pBitmap, 1, cx * cy * 2, oHandle);
+        fclose(oHandle);
+        return;
+    }
+    if (iChannels == 4)
+        fprintf(oHandle, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 65535\nTUPLTYPE RGB_ALPHA\nENDHDR\n", cx, cy);
+    else
+        fprintf(oHandle, "P%c\n%d %d\n65535\n", (iChannels == 1) ? '5' : '6', cx, cy);
+    iCount = cx * cy * iChannels;
+    pTemp = d = (uint8_t *)malloc(iCount * 2);
+    for (i=0; i<iCount; i++) { // samples are stored big-endian
+        *d++ = (uint8_t)(s[i] >> 8);
+        *d++ = (uint8_t)s[i];
+    }
+    fwrite(pTemp, 1, iCount * 2, oHandle);
+    free(pTemp);
+    fclose(oHandle);
+} /* WritePNM() */
+//
+// Read the next number from a PNM header (skipping whitespace + comments)
+//
+static int PNMNumber(uint8_t **ps)
+{
+uint8_t *s = *ps;
+int i = 0;
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n' || *s == '#') {
+        if (*s == '#')
+            while (*s && *s != '\n') s++;
+        else
+            s++;
+    }
+    while (*s >= '0' && *s <= '9')
+        i = (i * 10) + (*s++ - '0');
+    *ps = s;
+    return i;
+} /* PNMNumber() */
+//
+// Read a binary PGM (P5), PPM (P6) or PAM (P7) file into memory
+// 16-bit samples become 16-bit gray, 48 or 64-bpp native endian pixels
+// 8-bit gray+alpha PAM files become 16-bpp gray+alpha pixels
+//
+uint8_t * ReadPNM(const char *fname, int *width, int *height, int *bpp, int *colorspace)
+{
+    uint8_t *s, *d, *pTemp, *pBitmap;
+    int i, iSize, iChannels, iMax, iCount;
+    FILE *infile;
+
+    infile = fopen(fname, "rb");
+    if (infile == NULL) {
+        printf("Error opening input file %s\n", fname);
+        return NULL;
+    }
+    fseek(infile, 0, SEEK_END);
+    iSize = (int)ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+    pTemp = (uint8_t *)malloc(iSize + 1);
+    fread(pTemp, 1, iSize, infile);
+    fclose(infile);
+    pTemp[iSize] = 0;
+    s = &pTemp[2];
+    if (pTemp[0] == 'P' && (pTemp[1] == '5' || pTemp[1] == '6')) {
+        iChannels = (pTemp[1] == '5') ? 1 : 3;
+        *width = PNMNumber(&s);
+        *height = PNMNumber(&s);
+        iMax = PNMNumber(&s);
+    } else if (pTemp[0] == 'P' && pTemp[1] == '7') {
+        uint8_t *p;
+        p = (uint8_t *)strstr((char *)s, "WIDTH"); *width = p ? (s = p + 5, PNMNumber(&s)) : 0;
+        p = (uint8_t *)strstr((char *)pTemp, "HEIGHT"); *height = p ? (s = p + 6, PNMNumber(&s)) : 0;
+        p = (uint8_t *)strstr((char *)pTemp, "DEPTH"); iChannels = p ? (s = p + 5, PNMNumber(&s)) : 0;
+        p = (uint8_t *)strstr((char *)pTemp, "MAXVAL"); iMax = p ? (s = p + 6, PNMNumber(&s)) : 0;
+        p = (uint8_t *)strstr((char *)pTemp, "ENDHDR");
+        s = p ? p + 6 : s;
+    } else {
+        free(pTemp);
+        printf("Not a binary PGM/PPM/PAM file!\n");
+        return NULL;
+    }
+    s++; // single whitespace char after the header
+    if (iChannels == 2 && iMax <= 255) { // gray+alpha
+        iCount = *width * *height * 2;
+        if (iCount > (int)(iSize - (s - pTemp))) {
+            free(pTemp);
+            printf("PNM file is truncated\n");
+            return NULL;
+        }
+        pBitmap = (uint8_t *)malloc(iCount);
+        memcpy(pBitmap, s, iCount);
+        *bpp = 16;
+        *colorspace = SLIC_GRAYALPHA;
+        free(pTemp);
+        return pBitmap;
+    }
+    if (iMax <= 255 || (iChannels != 1 && iChannels != 3 && iChannels != 4)) {
+        free(pTemp);
+        printf("Only 8-bit gray+alpha or 16-bit gray, RGB or RGBA PNM files are supported\n");
+        return NULL;
+    }
+    iCount = *width * *height * iChannels;
+    if (iCount * 2 > (int)(iSize - (s - pTemp))) {
+        free(pTemp);
+        printf("PNM file is truncated\n");
+        return NULL;
+    }
+    pBitmap = d = (uint8_t *)malloc(iCount * 2);
+    for (i=0; i<iCount; i++) { // big-endian -> native
+        *(uint16_t *)d = (uint16_t)((s[0] << 8) | s[1]);
+        s += 2; d += 2;
+    }
+    *bpp = iChannels * 16;
+    *colorspace = (iChannels == 1) ? SLIC_GRAY16 : SLIC_SRGB;
+    free(pTemp);
+    return pBitmap;
+} /* ReadPNM() */
+//
+// Check if a filename ends with a PGM/PPM/PAM extension
+//
+static int IsPNM(const char *fname)
+{
+int i = (int)strlen(fname);
+    if (i < 4)
+        return 0;
+    return (memcmp(&fname[i-4], ".pgm", 4) == 0 || memcmp(&fname[i-4], ".ppm", 4) == 0 || memcmp(&fname[i-4], ".pam", 4) == 0);
+} /* IsPNM() */
+
 //
 // ReadFile
 //
@@ -240,24 +383,275 @@ int slic_read_fake(SLICFILE *pFile, uint8_t *pBuf, int iLen)
     return iLen;
 } /* slic_read_fake() */
 
+//
+// Pick how to store the alpha channel of a 32-bpp image
+// constant alpha doesn't need to be stored at all and alpha which changes
+// often (e.g. soft shadows) compresses much better as its own plane
+//
+int ChooseAlphaMode(uint8_t *pBitmap, int iWidth, int iHeight)
+{
+    int i, iChanges = 0, iCount = iWidth * iHeight;
+
+    for (i=1; i<iCount; i++) {
+        if (pBitmap[i*4+3] != pBitmap[i*4-1])
+            iChanges++;
+    }
+    if (iChanges == 0)
+        return SLIC_ALPHA_CONSTANT;
+    if (iChanges > iCount / 64)
+        return SLIC_ALPHA_PLANE;
+    return SLIC_ALPHA_INLINE;
+} /* ChooseAlphaMode() */
+
+//
+// Train a dictionary on a set of images of the same format and write it to
+// a file (as the SLICDICT struct, in this machine's byte order). Its ID is a
+// CRC of its contents, so that a dictionary trained on other images won't
+// be mistaken for it.
+//
+int TrainDictionary(const char *szDict, int iCount, const char *argv[])
+{
+    SLICTRAINER *pTrainer;
+    SLICDICT dict;
+    uint8_t ucPalette[1024], ucFirst[768];
+    uint8_t *pBitmap;
+    int i, iWidth, iHeight, iBpp, iColorspace, iFormat = 0, iImages = 0;
+    FILE *ohandle;
+
+    pTrainer = (SLICTRAINER *)malloc(sizeof(SLICTRAINER));
+    for (i=0; i<iCount; i++) {
+        memset(ucPalette, 0, sizeof(ucPalette));
+        if (IsPNM(argv[i]))
+            pBitmap = ReadPNM(argv[i], &iWidth, &iHeight, &iBpp, &iColorspace);
+        else
+            pBitmap = ReadBMP(argv[i], &iWidth, &iHeight, &iBpp, ucPalette);
+        if (pBitmap == NULL) {
+            printf("Unable to open file: %s\n", argv[i]);
+            continue;
+        }
+        if (iImages == 0) { // the first image sets the format (and palette)
+            if (slic_init_trainer(pTrainer, 0, iBpp, (iBpp <= 8 && !IsPNM(argv[i])) ? ucPalette : NULL) != SLIC_SUCCESS) {
+                printf("%s: %d-bpp images can't have a dictionary\n", argv[i], iBpp);
+                free(pBitmap);
+                continue;
+            }
+            iFormat = iBpp;
+            memcpy(ucFirst, ucPalette, 768);
+        } else if (iBpp != iFormat || (iBpp <= 8 && memcmp(ucPalette, ucFirst, 768) != 0)) {
+            printf("%s: skipped; it isn't %d-bpp%s\n", argv[i], iFormat, (iFormat <= 8) ? " with the same palette" : "");
+            free(pBitmap);
+            continue;
+        }
+        slic_train_dictionary(pTrainer, pBitmap, iWidth, iHeight, (iWidth * iBpp + 7) >> 3);
+        iImages++;
+        free(pBitmap);
+    }
+    if (iImages == 0) {
+        free(pTrainer);
+        return -1;
+    }
+    slic_get_dictionary(pTrainer, &dict);
+    free(pTrainer);
+    dict.id = slic_crc32c(0, (uint8_t *)&dict, sizeof(dict));
+    ohandle = fopen(szDict, "wb");
+    if (ohandle == NULL) {
+        printf("Error creating %s\n", szDict);
+        return -1;
+    }
+    fwrite(&dict, 1, sizeof(dict), ohandle);
+    fclose(ohandle);
+    printf("Trained a %d-bpp dictionary (ID %08x) on %d images%s\n", iFormat, dict.id, iImages, dict.palette_count ? ", with their palette" : "");
+    return 0;
+} /* TrainDictionary() */
+
+//
+// Nanosecond clock for the callback timing of --stats
+//
+uint64_t ClockNs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+} /* ClockNs() */
+
+//
+// Print the callback calls and how the time was split between them and the
+// codec
+//
+void PrintIOStats(SLICSTATS *pStats)
+{
+    int i, iFirst, iLast;
+    uint64_t u64Total = pStats->io_ticks + pStats->compute_ticks;
+
+    printf("callbacks: %u calls, %u buffers, %lld bytes (%.1f per call)\n", pStats->io_calls, pStats->io_refills,
+           (long long)pStats->io_bytes, (double)pStats->io_bytes / pStats->io_calls);
+    printf("time: %.3f ms in the callbacks, %.3f ms coding (%.1f%% I/O)\n", pStats->io_ticks / 1e6, pStats->compute_ticks / 1e6,
+           u64Total ? 100.0 * pStats->io_ticks / u64Total : 0.0);
+    for (iLast = SLIC_IO_BUCKETS-1; iLast > 0 && pStats->io_times[iLast] == 0 && pStats->compute_times[iLast] == 0; iLast--) {};
+    for (iFirst = 0; iFirst < iLast && pStats->io_times[iFirst] == 0 && pStats->compute_times[iFirst] == 0; iFirst++) {};
+    printf("ns                 calls  coding before\n");
+    for (i=iFirst; i<=iLast; i++) {
+        char szLen[32];
+        if (i == 0)
+            strcpy(szLen, "0-1");
+        else if (i == SLIC_IO_BUCKETS-1)
+            sprintf(szLen, "%u+", 1U << i);
+        else
+            sprintf(szLen, "%u-%u", 1U << i, (2U << i) - 1);
+        printf("%-17s %7u %9u\n", szLen, pStats->io_times[i], pStats->compute_times[i]);
+    }
+    printf("bytes per call:");
+    for (i=0; i<SLIC_STAT_BUCKETS; i++) {
+        if (pStats->io_sizes[i] == 0)
+            continue;
+        if (i == 0)
+            printf(" 0-1: %u", pStats->io_sizes[i]);
+        else if (i == SLIC_STAT_BUCKETS-1)
+            printf(" %d+: %u", 1 << i, pStats->io_sizes[i]);
+        else
+            printf(" %d-%d: %u", 1 << i, (2 << i) - 1, pStats->io_sizes[i]);
+    }
+    printf("\n");
+} /* PrintIOStats() */
+
+//
+// Print the op counts and run/literal lengths of an encoded or decoded image
+//
+void PrintStats(SLICSTATE *pState)
+{
+    static const char *szKinds[SLIC_STAT_COUNT] = {"index", "diff", "luma", "run", "literal", "rgba", "gradient", "match", "alpha"};
+    SLICSTATS stats;
+    slic_size_t iOps = 0, iBytes = 0, iPixels = 0;
+    int i, iLast;
+
+    if (slic_get_stats(pState, &stats) != SLIC_SUCCESS) {
+        printf("op statistics aren't kept for this format (only 1-8 bpp, RGB565 and 24/32-bpp images)\n");
+        if (stats.io_calls)
+            PrintIOStats(&stats);
+        return;
+    }
+    printf("op        count       bytes      pixels  bits/pixel\n");
+    for (i=0; i<SLIC_STAT_COUNT; i++) {
+        iOps += stats.ops[i];
+        iBytes += stats.bytes[i];
+        if (i != SLIC_STAT_ALPHA) // its pixels are coded again by the RGB ops
+            iPixels += stats.pixels[i];
+    }
+    for (i=0; i<SLIC_STAT_COUNT; i++) {
+        printf("%-8s %10lld %10lld %10lld (%5.1f%%) %6.2f\n", szKinds[i], (long long)stats.ops[i], (long long)stats.bytes[i],
+               (long long)stats.pixels[i], iPixels ? 100.0 * stats.pixels[i] / iPixels : 0.0,
+               stats.pixels[i] ? 8.0 * stats.bytes[i] / stats.pixels[i] : 0.0);
+    }
+    printf("total    %10lld %10lld %10lld\n", (long long)iOps, (long long)iBytes, (long long)iPixels);
+    if (iPixels == 0) { // nothing coded yet
+        if (stats.io_calls)
+            PrintIOStats(&stats);
+        return;
+    }
+    printf("cache hits: %.1f%% of the pixels not in runs\n",
+           (iPixels > stats.pixels[SLIC_STAT_RUN]) ? 100.0 * stats.pixels[SLIC_STAT_INDEX] / (iPixels - stats.pixels[SLIC_STAT_RUN]) : 0.0);
+    for (iLast = SLIC_STAT_BUCKETS-1; iLast > 0 && stats.run_lengths[iLast] == 0 && stats.literal_lengths[iLast] == 0; iLast--) {};
+    printf("length      runs  literals\n");
+    for (i=0; i<=iLast; i++) {
+        char szLen[16];
+        if (i == 0)
+            strcpy(szLen, "1");
+        else if (i == SLIC_STAT_BUCKETS-1)
+            sprintf(szLen, "%d+", 1 << i);
+        else
+            sprintf(szLen, "%d-%d", 1 << i, (2 << i) - 1);
+        printf("%-11s %4u %9u\n", szLen, stats.run_lengths[i], stats.literal_lengths[i]);
+    }
+    if (stats.literal_splits)
+        printf("literal ops split by buffer writes: %u\n", stats.literal_splits);
+    if (stats.io_calls)
+        PrintIOStats(&stats);
+} /* PrintStats() */
+
 int main(int argc, const char * argv[]) {
     int i, rc, iOutIndex;
     int iDataSize;
     FILE *ohandle;
     uint8_t *pOutput;
-    int iWidth, iHeight, iBpp, iPitch;
+    int iWidth, iHeight, iBpp, iPitch, iColorspace;
     uint8_t ucPalette[1024];
     uint8_t *pData, *pBitmap;
     SLICSTATE state;
+    int bStats = 0, bAuto = 0, bSortPalette = 0, iSourceBpp = 0, iTolerance = 0, bGradient = 0, bStored = 0, iEffort = 0;
+    SLICDICT dict, *pDict = NULL;
+    static SLICENCODEWINDOW window; // history of the match op; the decoder only needs window.window
+    uint8_t ucStrip[SLIC_ENCODE_STRIP_SIZE]; // strip of the alpha plane
    
+    if (argc > 3 && strcmp(argv[1], "--train") == 0)
+        return TrainDictionary(argv[2], argc - 3, &argv[3]);
+    while (argc > 1 && (strcmp(argv[1], "--stats") == 0 || strcmp(argv[1], "--auto") == 0 || strcmp(argv[1], "--sort-palette") == 0 || strcmp(argv[1], "--dict") == 0 || strcmp(argv[1], "--tolerance") == 0 || strcmp(argv[1], "--gradient") == 0 || strcmp(argv[1], "--stored") == 0 || strcmp(argv[1], "--match") == 0)) {
+        if (strcmp(argv[1], "--stats") == 0) {
+            bStats = 1;
+            slic_set_clock(ClockNs);
+        } else if (strcmp(argv[1], "--auto") == 0) {
+            bAuto = 1;
+        } else if (strcmp(argv[1], "--gradient") == 0) {
+            bGradient = 1;
+        } else if (strcmp(argv[1], "--stored") == 0) {
+            bStored = 1;
+        } else if (strcmp(argv[1], "--match") == 0) {
+            iEffort = (argc > 2) ? atoi(argv[2]) : 0;
+            if (iEffort < 1 || iEffort > SLIC_MAX_EFFORT) {
+                printf("The match effort must be 1 to %d\n", SLIC_MAX_EFFORT);
+                return -1;
+            }
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--dict") == 0) {
+            pData = (argc > 2) ? ReadFile((char *)argv[2], &iDataSize) : NULL;
+            if (pData == NULL || iDataSize != sizeof(SLICDICT)) {
+                printf("Error reading the dictionary %s\n", (argc > 2) ? argv[2] : "");
+                return -1;
+            }
+            memcpy(&dict, pData, sizeof(dict));
+            free(pData);
+            pDict = &dict;
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--tolerance") == 0) {
+            iTolerance = (argc > 2) ? atoi(argv[2]) : -1;
+            if (iTolerance < 0 || iTolerance > SLIC_MAX_TOLERANCE) {
+                printf("The tolerance must be 0 to %d\n", SLIC_MAX_TOLERANCE);
+                return -1;
+            }
+            argc--;
+            argv++;
+        } else {
+            bSortPalette = 1;
+        }
+        argc--;
+        argv++;
+    }
     if (argc != 3 && argc != 2) {
        printf("SLIC codec library demo program\n");
-       printf("Usage: slic_conv <infile> <outfile>\n");
+       printf("Usage: slic_conv [--stats] [--auto] [--sort-palette] [--dict <dictfile>] [--tolerance <n>] [--gradient] [--stored] [--match <effort>] <infile> <outfile>\n");
+       printf("       slic_conv --train <dictfile> <image> [image ...]\n");
        printf("\nor (to generate an image dynamically)\n       slic_conv <outfile.slc>\n");
         printf("The input and output files can be either WinBMP (*.bmp) or SLIC (*.slc)\n");
+        printf("16-bit gray, gray+alpha, 48 and 64-bpp images use binary PGM/PPM/PAM (*.pgm, *.ppm, *.pam)\n");
+        printf("--stats prints how the image was coded (op counts, run and literal lengths)\n");
+        printf("        and, when decoding, the time spent reading the file vs. decoding it\n");
+        printf("--auto stores 24/32-bpp images in the smallest format which holds them without loss\n");
+        printf("       (24-bpp, palette, RGB565 or grayscale)\n");
+        printf("--sort-palette reorders the palette of 8-bpp palette images so that they compress better\n");
+        printf("--train makes a dictionary from a set of small images of one format (e.g. icons),\n");
+        printf("        which --dict then starts the encoder or decoder with\n");
+        printf("--tolerance encodes near-losslessly; each color channel may be off by up to n levels\n");
+        printf("--gradient codes ramps of a constant step with the gradient op (needs a decoder\n");
+        printf("           which knows it)\n");
+        printf("--stored codes incompressible 24/32-bpp pixels as raw blocks (needs a decoder which\n");
+        printf("         knows them)\n");
+        printf("--match copies repeated runs of 24/32-bpp pixels (text, icons, tiles) from the last\n");
+        printf("        %d pixels; effort 1 is the fastest, %d the smallest\n", SLIC_WINDOW_SIZE, SLIC_MAX_EFFORT);
        return 0;
     }
 
+    memset(ucPalette, 0, sizeof(ucPalette)); // BMP files may have fewer than 256 colors
     if (argc == 3) {
        iOutIndex = 2; // argv index of output filename
        i = (int)strlen(argv[1]);
@@ -265,15 +659,44 @@ int main(int argc, const char * argv[]) {
            pData = ReadFile((char *)argv[1], &iDataSize);
            if (pData != NULL) {
                rc = slic_init_decode(NULL, &state, pData, iDataSize, ucPalette, NULL, slic_read_fake);
+               if (rc == SLIC_SUCCESS && (state.dict_flags & SLIC_DICT_NEEDED)) {
+                   rc = (pDict) ? slic_set_dictionary(&state, pDict) : SLIC_NEED_DICTIONARY;
+                   if (rc != SLIC_SUCCESS)
+                       printf("The file needs the dictionary with ID %08x\n", state.dict_id);
+               }
+               if (rc == SLIC_SUCCESS && (state.flags & SLIC_FLAG_MATCH))
+                   rc = slic_set_window(&state, &window.window);
+               if (rc == SLIC_SUCCESS && (state.flags & SLIC_FLAG_ALPHA_PLANE))
+                   rc = slic_set_strip(&state, ucStrip);
+               if (rc != SLIC_SUCCESS) {
+                   printf("slic_init_decode() returned %d\n", rc);
+                   free(pData);
+                   return -1;
+               }
                printf("decompressing a slic %d x %d x %d-bpp file\n", state.width, state.height, state.bpp);
-               pBitmap = (uint8_t *)malloc(state.width * state.height * (state.bpp >> 3) + 8);
+               if (((slic_size_t)state.width * state.bpp + 7) / 8 * state.height > 0x7fffffff) {
+                   printf("The image is too large to decode into memory\n");
+                   free(pData);
+                   return -1;
+               }
+               iPitch = (state.width * state.bpp + 7) >> 3;
+               pBitmap = (uint8_t *)malloc((size_t)iPitch * state.height);
                // do it in small runs for testing Arduino code
                for (int y=0; y<state.height; y++) {
-                   rc = slic_decode(&state, &pBitmap[y * state.width * (state.bpp >> 3)], state.width);
+                   rc = slic_decode(&state, &pBitmap[y * iPitch], state.width);
+                   if (rc != SLIC_SUCCESS && rc != SLIC_DONE)
+                       break;
                } // for y
                 if (rc == SLIC_SUCCESS || rc == SLIC_DONE) {
                     printf("success!\n");
-                    WriteBMP((char *)argv[2], pBitmap, ucPalette, state.width, state.height, state.bpp);
+                    if (bStats)
+                        PrintStats(&state);
+                    if (state.colorspace == SLIC_GRAYALPHA)
+                        WritePNM((char *)argv[2], pBitmap, state.width, state.height, 2);
+                    else if (state.colorspace == SLIC_GRAY16 || state.bpp > 32)
+                        WritePNM((char *)argv[2], pBitmap, state.width, state.height, (state.bpp > 32) ? state.bpp / 16 : 1);
+                    else
+                        WriteBMP((char *)argv[2], pBitmap, (state.colorspace == SLIC_PALETTE) ? ucPalette : NULL, state.width, state.height, state.bpp);
                     free(pBitmap);
                     free(pData);
             } else {
@@ -285,26 +708,16 @@ int main(int argc, const char * argv[]) {
                return -1;
            }
        }
-       pBitmap = ReadBMP(argv[1], &iWidth, &iHeight, &iBpp, ucPalette);
+       if (IsPNM(argv[1]))
+           pBitmap = ReadPNM(argv[1], &iWidth, &iHeight, &iBpp, &iColorspace);
+       else
+           pBitmap = ReadBMP(argv[1], &iWidth, &iHeight, &iBpp, ucPalette);
        if (pBitmap == NULL)
        {
            fprintf(stderr, "Unable to open file: %s\n", argv[1]);
            return -1; // bad filename passed?
        }
-        if (iBpp == 4) {
-            // convert to 8-bpp to support this bitmap
-            uint8_t uc, *s, *d, *pTemp = (uint8_t *)malloc(iWidth*iHeight);
-            s = pBitmap; d = pTemp;
-            for (int i=0; i<iWidth*iHeight; i+=2) {
-                uc = *s++;
-                *d++ = (uc >> 4);
-                *d++ = uc & 0xf;
-            }
-            free(pBitmap);
-            pBitmap = pTemp;
-            iBpp = 8;
-        }
-        iPitch = (iWidth * iBpp) >> 3;
+        iPitch = (iWidth * iBpp + 7) >> 3; // 1/2/4-bpp rows are padded to whole bytes
     } else { // create the bitmap in code
        iOutIndex = 1;  // argv index of output filename
        iWidth = iHeight = 128;
@@ -324,17 +737,96 @@ int main(int argc, const char * argv[]) {
            }
        } // for y
     }
-    pOutput = malloc(iWidth * iHeight); // output buffer
-    iDataSize = iWidth * iHeight;
-    rc = slic_init_encode(NULL, &state, iWidth, iHeight, iBpp, ucPalette, NULL, NULL, pOutput, iDataSize);
+    if (bAuto && (iBpp == 24 || iBpp == 32)) {
+        if (iBpp == 24 && !IsPNM(argv[1])) { // BMP pixels are BGR; the library takes RGB
+            for (i=0; i<iWidth * iHeight; i++) {
+                uint8_t u8 = pBitmap[i*3];
+                pBitmap[i*3] = pBitmap[i*3+2];
+                pBitmap[i*3+2] = u8;
+            }
+        }
+        iSourceBpp = iBpp;
+        rc = slic_choose_format(pBitmap, iWidth, iHeight, iSourceBpp, iPitch, &iBpp, &iColorspace, ucPalette);
+        if (rc != SLIC_SUCCESS) {
+            printf("slic_choose_format() returned %d\n", rc);
+            return -1;
+        }
+        printf("--auto: storing it as %d-bpp %s\n", iBpp, (iColorspace == SLIC_PALETTE) ? "palette" :
+               (iColorspace == SLIC_GRAYSCALE) ? "grayscale" : (iColorspace == SLIC_RGB565) ? "RGB565" : "RGB(A)");
+    }
+    if (bSortPalette && iBpp == 8 && !iSourceBpp && argc == 3 && !IsPNM(argv[1])) { // BMP files always have a palette at 8-bpp
+        rc = slic_sort_palette(pBitmap, iWidth, iHeight, iPitch, ucPalette);
+        if (rc != SLIC_SUCCESS) {
+            printf("slic_sort_palette() returned %d\n", rc);
+            return -1;
+        }
+    }
+    iDataSize = ((iPitch * iHeight) << 1) + 1024; // 2x the raw size covers the worst case
+    pOutput = malloc(iDataSize); // output buffer
+    rc = slic_init_encode(NULL, &state, iWidth, iHeight, iBpp, (iSourceBpp && iColorspace != SLIC_PALETTE) ? NULL : ucPalette, NULL, NULL, pOutput, iDataSize);
+    if (rc == SLIC_SUCCESS && iSourceBpp)
+        rc = slic_set_option(&state, SLIC_OPTION_SOURCE_BPP, iSourceBpp);
+    else if (rc == SLIC_SUCCESS && iBpp == 16 && argc == 3 && IsPNM(argv[1])) // 16-bit gray or gray+alpha instead of RGB565
+        rc = slic_set_option(&state, SLIC_OPTION_COLORSPACE, iColorspace);
+    if (rc == SLIC_SUCCESS && iBpp == 32 && pDict == NULL) // the dictionary is trained with alpha inline
+        rc = slic_set_option(&state, SLIC_OPTION_ALPHA, ChooseAlphaMode(pBitmap, iWidth, iHeight));
+    if (rc == SLIC_SUCCESS && (state.flags & SLIC_FLAG_ALPHA_PLANE))
+        rc = slic_set_strip(&state, ucStrip);
+    if (rc == SLIC_SUCCESS && iTolerance) {
+        rc = slic_set_option(&state, SLIC_OPTION_TOLERANCE, iTolerance);
+        if (rc != SLIC_SUCCESS) {
+            printf("Only 8-bit gray, RGB565 and 24/32-bpp images can be encoded near-losslessly\n");
+            return -1;
+        }
+    }
+    if (rc == SLIC_SUCCESS && bGradient) {
+        rc = slic_set_option(&state, SLIC_OPTION_GRADIENT, 1);
+        if (rc != SLIC_SUCCESS) {
+            printf("Only 1-8 bpp, RGB565 and 24/32-bpp images can use the gradient op\n");
+            return -1;
+        }
+    }
+    if (rc == SLIC_SUCCESS && bStored) {
+        rc = slic_set_option(&state, SLIC_OPTION_STORED, 1);
+        if (rc != SLIC_SUCCESS) {
+            printf("Only 24/32-bpp images can use stored blocks\n");
+            return -1;
+        }
+    }
+    if (rc == SLIC_SUCCESS && iEffort) {
+        rc = slic_set_option(&state, SLIC_OPTION_MATCH, iEffort);
+        if (rc != SLIC_SUCCESS) {
+            printf("Only 24/32-bpp images can use the match op\n");
+            return -1;
+        }
+        rc = slic_set_encode_window(&state, &window);
+    }
+    if (rc == SLIC_SUCCESS && pDict) {
+        if (pDict->palette_count && state.colorspace == SLIC_PALETTE && memcmp(ucPalette, pDict->palette, pDict->palette_count * 3) != 0) {
+            printf("The image's palette isn't the dictionary's\n");
+            return -1;
+        }
+        rc = slic_set_dictionary(&state, pDict);
+        if (rc != SLIC_SUCCESS) {
+            printf("The dictionary isn't for %d-bpp images like this one\n", iBpp);
+            return -1;
+        }
+    }
     printf("Compressing a %d x %d x %d bitmap as SLIC data\n", iWidth, iHeight, iBpp);
+    if (bStats) {
+        slic_size_t iEstimate, iError;
+        if (slic_estimate(pBitmap, iWidth, iHeight, iSourceBpp ? iSourceBpp : iBpp, iPitch, &iEstimate, &iError) == SLIC_SUCCESS)
+            printf("slic_estimate(): %lld +/- %lld bytes as %d-bpp with the default options\n", (long long)iEstimate, (long long)iError, iSourceBpp ? iSourceBpp : iBpp);
+    }
     // Encode one line at a time
     for (int y=0; y<iHeight && rc == SLIC_SUCCESS; y++) {
         rc = slic_encode(&state, &pBitmap[iPitch * y], iWidth);
     } // for y
     if (rc == SLIC_DONE) {
-        iDataSize = state.iOffset;
-        printf("SLIC image successfully created. %d bytes = %d:1 compression\n", iDataSize, ((iWidth*iHeight*iBpp)>>3) / iDataSize);
+        iDataSize = (int)state.iOffset;
+        printf("SLIC image successfully created. %d bytes = %d:1 compression\n", iDataSize, ((iWidth*iHeight*(iSourceBpp ? iSourceBpp : iBpp))>>3) / iDataSize);
+        if (bStats)
+            PrintStats(&state);
         ohandle = fopen(argv[iOutIndex], "w+b");
         if (ohandle != NULL) {
             fwrite(pOutput, 1, iDataSize, ohandle);
@@ -5,13 +5,191 @@
 //  Created by Larry Bank on 2/14/22.
 //  Demonstrates the SLIC library
 //  by generating a compressed image dynamically
+//  and compares it with the same image encoded at compile time
+//  and into a growing buffer (also with images which fill many of its
+//  chunks, again after init() reuses them, and with the match op). The compile-time encoder is a second copy of
+//  the RGB565 one, so it's also run on random images and compared with
+//  slic_encode(); the exit code is 1 if anything doesn't match.
 //
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "../../src/slic.h"
+#include "../../src/slic_constexpr.h"
+#include "../../src/slic_buffer.h"
 SLIC slic; // static instance of class
+//
+// The demo image: a red border with a blue X on a black background
+//
+constexpr std::array<uint16_t, 128*128> MakeImage()
+{
+    std::array<uint16_t, 128*128> usImage{};
+    for (int y=0; y<128; y++) {
+        for (int x=0; x<128; x++) {
+            if (y == 0 || y == 127 || x == 0 || x == 127)
+                usImage[y*128+x] = 0xf800; // pure red
+            else if (x == y || x == 127-y)
+                usImage[y*128+x] = 0x1f; // blue
+        }
+    }
+    return usImage;
+} /* MakeImage() */
+static constexpr auto usDemoImage = MakeImage();
+static constexpr auto ucDemoImage = slic_constexpr_rgb565<usDemoImage, 128, 128>(); // SLIC data built by the compiler
+static_assert(ucDemoImage.size() < sizeof(usDemoImage) / 8, "the demo image should compress at least 8:1");
+//
+// Make a random RGB565 image out of runs (some long enough for the 256 and
+// 1024 run ops), small steps, repeats of a few colors (the cache) and noise
+//
+static void MakeRandomImage(uint16_t *pImage, int iCount)
+{
+    static const uint16_t usColors[4] = {0x0000, 0xffff, 0xf800, 0x07e0};
+    uint16_t px = 0;
+    int i = 0, n, iKind;
+
+    while (i < iCount) {
+        iKind = rand() & 7;
+        n = 1 + (rand() % ((iKind == 0) ? 2000 : 20));
+        if (n > iCount - i)
+            n = iCount - i;
+        while (n--) {
+            if (iKind == 0 || iKind == 1) // run
+                ;
+            else if (iKind == 2 || iKind == 3) // small steps of each channel
+                px = (uint16_t)(px + ((rand() % 3) - 1) * 0x800 + ((rand() % 3) - 1) * 0x20 + ((rand() % 3) - 1));
+            else if (iKind == 4 || iKind == 5) // a few colors over and over
+                px = usColors[rand() & 3];
+            else
+                px = (uint16_t)rand();
+            pImage[i++] = px;
+        }
+    }
+} /* MakeRandomImage() */
+//
+// Encode random images of random sizes with slic_constexpr_rgb565() and
+// slic_encode(); returns the number which don't match
+//
+static int CheckConstexprEncoder(int iImages)
+{
+    SLIC enc;
+    uint16_t *pImage;
+    uint8_t *pOut, *pConst;
+    int i, iWidth, iHeight, iSize, iErrors = 0;
+
+    srand(1);
+    for (i=0; i<iImages; i++) {
+        iWidth = 1 + (rand() % 300);
+        iHeight = 1 + (rand() % 60);
+        iSize = iWidth * iHeight * 4 + 64;
+        pImage = (uint16_t *)malloc(iWidth * iHeight * 2);
+        pOut = (uint8_t *)malloc(iSize);
+        pConst = (uint8_t *)malloc(iSize);
+        MakeRandomImage(pImage, iWidth * iHeight);
+        enc.init_encode_ram(iWidth, iHeight, 16, NULL, pOut, iSize);
+        if (enc.encode((uint8_t *)pImage, iWidth * iHeight) != SLIC_DONE ||
+            slic_constexpr_rgb565(pImage, iWidth, iHeight, NULL) != (size_t)enc.get_output_size() ||
+            slic_constexpr_rgb565(pImage, iWidth, iHeight, pConst) != (size_t)enc.get_output_size() ||
+            memcmp(pOut, pConst, (size_t)enc.get_output_size()) != 0) {
+            if (iErrors++ == 0)
+                printf("Random image %d (%d x %d) doesn't match\n", i, iWidth, iHeight);
+        }
+        free(pImage);
+        free(pOut);
+        free(pConst);
+    }
+    return iErrors;
+} /* CheckConstexprEncoder() */
+//
+// Encode a noisy iWidth x iHeight 24-bpp image with the RAM encoder and
+// with enc into buf (with the match op at iEffort, if it isn't 0); returns
+// 0 if the data is the same
+//
+static int CompareBufferEncoder(SLICBufferEncoder &enc, SLICBuffer &buf, int iWidth, int iHeight, int bChecksum, int iEffort)
+{
+    static SLICENCODEWINDOW ramWindow, bufWindow;
+    SLIC ram;
+    int i, rc, iSize = iWidth * iHeight * 3;
+    uint8_t *pImage = (uint8_t *)malloc(iSize);
+    uint8_t *pOut = (uint8_t *)malloc(iSize * 2 + 1024);
+
+    for (i=0; i<iSize; i++) // noise with a few runs, so that most of it can't be compressed
+        pImage[i] = (i % 3000 < 300) ? 0x40 : (uint8_t)rand();
+    for (i=9000; i<iSize && iEffort; i++) // except by matches, which can copy it from 3000 pixels back
+        pImage[i] = pImage[i - 9000];
+    ram.init_encode_ram(iWidth, iHeight, 24, NULL, pOut, iSize * 2 + 1024);
+    ram.set_option(SLIC_OPTION_CHECKSUM, bChecksum); // the checksum is copied into the chunks
+    if (iEffort) {
+        ram.set_option(SLIC_OPTION_MATCH, iEffort);
+        ram.set_window(&ramWindow);
+    }
+    for (i=0; i<iHeight; i++) // as enc is given it; matches end with each call
+        ram.encode(&pImage[i * iWidth * 3], iWidth);
+    rc = enc.init(buf, iWidth, iHeight, 24);
+    if (rc == SLIC_SUCCESS)
+        rc = enc.set_option(SLIC_OPTION_CHECKSUM, bChecksum);
+    if (rc == SLIC_SUCCESS && iEffort) {
+        rc = enc.set_option(SLIC_OPTION_MATCH, iEffort);
+        if (rc == SLIC_SUCCESS)
+            rc = enc.set_window(&bufWindow);
+    }
+    for (i=0; i<iHeight && rc == SLIC_SUCCESS; i++) // a row at a time to cross chunks in the middle of calls
+        rc = enc.encode(std::span((const uint8_t *)&pImage[i * iWidth * 3], iWidth * 3));
+    if (rc != SLIC_DONE || buf.size() != (size_t)ram.get_output_size() || buf.to_vector() != std::vector<uint8_t>(pOut, pOut + (size_t)ram.get_output_size()))
+        rc = 1;
+    else
+        rc = 0;
+    free(pImage);
+    free(pOut);
+    return rc;
+} /* CompareBufferEncoder() */
+//
+// Encode images which fill many chunks of a buffer, up to and past the
+// largest chunk size, then encode another one into the same buffer; its
+// chunks are reused, so it mustn't allocate any more memory. A last one
+// uses the match op.
+//
+static int CheckBufferEncoder(void)
+{
+    SLICBuffer buf;
+    SLICBufferEncoder enc;
+    size_t iCapacity;
+    int i, n, iErrors = 0;
+
+    srand(2);
+    if (CompareBufferEncoder(enc, buf, 1000, 1000, 0, 0) != 0) {
+        printf("The buffer encoder's %d-chunk image doesn't match!\n", buf.chunk_count());
+        iErrors++;
+    } else {
+        printf("The buffer encoder produced the same %d bytes in %d chunk(s)\n", (int)buf.size(), buf.chunk_count());
+    }
+    for (i=0, n=0; i<buf.chunk_count(); i++) // chunks filled at the largest size
+        if (buf.chunk(i).size() > SLIC_BUFFER_MAX_CHUNK / 2)
+            n++;
+    if (n < 2) {
+        printf("The buffer didn't grow to its largest chunk size!\n");
+        iErrors++;
+    }
+    iCapacity = buf.capacity();
+    if (CompareBufferEncoder(enc, buf, 1000, 900, 1, 0) != 0) { // a little smaller, with a checksum
+        printf("The buffer encoder's image doesn't match after init()!\n");
+        iErrors++;
+    } else if (buf.capacity() != iCapacity) {
+        printf("The buffer encoder allocated more chunks after init()!\n");
+        iErrors++;
+    } else {
+        printf("After init(), the buffer encoder produced the same %d bytes in its %d kept chunk(s)\n", (int)buf.size(), buf.chunk_count());
+    }
+#ifdef SLIC_MATCH
+    if (CompareBufferEncoder(enc, buf, 500, 300, 0, 4) != 0) {
+        printf("The buffer encoder's image with matches doesn't match!\n");
+        iErrors++;
+    } else {
+        printf("With matches, the buffer encoder produced the same %d bytes\n", (int)buf.size());
+    }
+#endif
+    return iErrors;
+} /* CheckBufferEncoder() */
 
 int main(int argc, const char * argv[]) {
     int rc;
@@ -20,6 +198,7 @@ int main(int argc, const char * argv[]) {
     uint8_t *pOutput;
     uint16_t usLine[128]; // temp line
     int iWidth, iHeight, iBpp, iPitch;
+    int iErrors = 0;
     
     if (argc != 2) {
        printf("SLIC demo program\n");
@@ -46,8 +225,28 @@ int main(int argc, const char * argv[]) {
             }
             rc = slic.encode((uint8_t *)usLine, iWidth); // add each line 1 at a time
         } // for y
-        iOutSize = slic.get_output_size();
+        iOutSize = (int)slic.get_output_size(); // a RAM buffer, so it fits in an int
         printf("32768 bytes of image compressed to %d bytes of slic output\n", iOutSize);
+        if (iOutSize == (int)ucDemoImage.size() && memcmp(pOutput, ucDemoImage.data(), iOutSize) == 0)
+            printf("The compile-time encoder produced the same %d bytes\n", iOutSize);
+        else {
+            printf("The compile-time encoder's %d bytes don't match!\n", (int)ucDemoImage.size());
+            iErrors++;
+        }
+        rc = CheckConstexprEncoder(1000);
+        if (rc == 0)
+            printf("The compile-time encoder matched slic_encode() on 1000 random images\n");
+        else
+            printf("The compile-time encoder didn't match slic_encode() on %d of 1000 random images!\n", rc);
+        iErrors += rc;
+        SLICBuffer buf = slic_encode_to_buffer(std::span((const uint8_t *)usDemoImage.data(), sizeof(usDemoImage)), iWidth, iHeight, iBpp);
+        if (buf.size() == (size_t)iOutSize && buf.to_vector() == std::vector<uint8_t>(pOutput, pOutput + iOutSize))
+            printf("The buffer encoder produced the same %d bytes in %d chunk(s)\n", iOutSize, buf.chunk_count());
+        else {
+            printf("The buffer encoder's %d bytes don't match!\n", (int)buf.size());
+            iErrors++;
+        }
+        iErrors += CheckBufferEncoder();
         ohandle = fopen(argv[1], "w+b");
         if (ohandle != NULL) {
             fwrite(pOutput, 1, iOutSize, ohandle);
@@ -55,7 +254,8 @@ int main(int argc, const char * argv[]) {
         }
     } else {
         printf("init_encode() returned error %d\n", rc);
+        iErrors++;
     }
     free(pOutput);
-    return 0;
+    return (iErrors) ? 1 : 0;
 } /* main() */
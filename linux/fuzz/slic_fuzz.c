@@ -0,0 +1,202 @@
+//
+//  slic_fuzz.c
+//  SLIC decoder fuzz harness
+//
+//  Decodes untrusted data every way an application can: from memory and
+//  through a read callback which returns short reads, a row at a time and
+//  in one call, and through the palette LUT. Built with libFuzzer it's the
+//  LLVMFuzzerTestOneInput() entry point; otherwise main() runs the files
+//  given on the command line (for AFL, use @@) or, with -n, mutates seed
+//  images of every pixel type on its own.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/slic.h"
+#include "../../src/slic.inl"
+
+#define MAX_OUTPUT (16*1024*1024) // skip images which would need more memory than this
+
+static int iReadSize; // vary the size of the callback reads to split ops
+
+static int fuzz_read(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen)
+{
+    if (iLen > iReadSize)
+        iLen = iReadSize;
+    if (pFile->iPos + iLen > pFile->iSize)
+        iLen = (int32_t)(pFile->iSize - pFile->iPos);
+    if (iLen <= 0)
+        return 0;
+    memcpy(pBuf, &pFile->pData[pFile->iPos], iLen);
+    pFile->iPos += iLen;
+    return iLen;
+} /* fuzz_read() */
+//
+// Decode the image once; the output buffer is exactly the size of the image
+// so that the sanitizers catch any write past it
+//
+static void fuzz_decode(const uint8_t *pData, size_t iSize, int bCallback, int bRows, int iOutputBpp)
+{
+    static SLICWINDOW window;
+    SLICSTATE state;
+    uint8_t ucPalette[768], ucChunk[64], ucStrip[SLIC_DECODE_STRIP_SIZE];
+    uint8_t *pOut;
+    uint32_t y, iLen;
+    slic_size_t iPitch, iOutSize;
+    int rc, iBpp;
+
+    rc = slic_init_decode(NULL, &state, (uint8_t *)pData, (int)iSize, ucPalette, NULL, bCallback ? fuzz_read : NULL);
+    if (rc != SLIC_SUCCESS)
+        return;
+    iLen = sizeof(ucChunk);
+    slic_get_chunk(&state, SLIC_CHUNK_METADATA, ucChunk, &iLen);
+    if (iOutputBpp && slic_set_option(&state, SLIC_OPTION_PALETTE_OUTPUT, iOutputBpp) != SLIC_SUCCESS)
+        return;
+    if ((state.flags & SLIC_FLAG_MATCH) && slic_set_window(&state, &window) != SLIC_SUCCESS)
+        return;
+    if ((state.flags & SLIC_FLAG_ALPHA_PLANE) && slic_set_strip(&state, ucStrip) != SLIC_SUCCESS)
+        return;
+    if ((slic_size_t)state.width * state.height > MAX_OUTPUT)
+        return;
+    iBpp = iOutputBpp ? iOutputBpp : state.bpp;
+    iPitch = ((slic_size_t)state.width * iBpp + 7) >> 3;
+    iOutSize = iPitch * state.height;
+    pOut = (uint8_t *)malloc((size_t)iOutSize);
+    if (bRows) {
+        for (y=0; y<state.height; y++) {
+            rc = slic_decode(&state, &pOut[y * iPitch], state.width);
+            if (rc != SLIC_SUCCESS)
+                break;
+        }
+    } else {
+        rc = slic_decode(&state, pOut, (int)(state.width * state.height));
+    }
+    if (rc == SLIC_DONE) // the data is finished; asking for more has to be harmless
+        slic_decode(&state, pOut, 0);
+    free(pOut);
+} /* fuzz_decode() */
+
+int LLVMFuzzerTestOneInput(const uint8_t *pData, size_t iSize)
+{
+    iReadSize = (iSize & 7) ? (int)(iSize & 7) : FILE_BUF_SIZE;
+    fuzz_decode(pData, iSize, 0, 0, 0);
+    fuzz_decode(pData, iSize, 0, 1, 0);
+    fuzz_decode(pData, iSize, 1, 1, 0);
+    fuzz_decode(pData, iSize, 1, 0, 16);
+    fuzz_decode(pData, iSize, 0, 1, 24);
+    return 0;
+} /* LLVMFuzzerTestOneInput() */
+
+#ifndef SLIC_LIBFUZZER
+//
+// Make a valid file of each pixel type for the mutation loop to start from
+//
+static int make_seed(uint8_t *pOut, int iOutSize, int iBpp, int iColorspace, int iOption, int iValue)
+{
+    static SLICENCODEWINDOW window;
+    SLICSTATE state;
+    uint8_t ucPixels[32*8*8], ucPalette[768], ucStrip[SLIC_ENCODE_STRIP_SIZE];
+    int i, w = 32, h = 8;
+
+    for (i=0; i<(int)sizeof(ucPixels); i++) // runs, ramps, small steps, noise and a repeat of the noise
+        ucPixels[i] = (uint8_t)((i < 256) ? 0x40 : (i < 512) ? (i * 3) : (i < 1024) ? (i >> 2) : (i < 1792) ? rand() : ucPixels[i - 384]);
+    for (i=0; i<768; i++)
+        ucPalette[i] = (uint8_t)(i * 7);
+    if (slic_init_encode(NULL, &state, w, h, iBpp, (iColorspace == SLIC_PALETTE) ? ucPalette : NULL, NULL, NULL, pOut, iOutSize) != SLIC_SUCCESS)
+        return 0;
+    if (iBpp == 16)
+        slic_set_option(&state, SLIC_OPTION_COLORSPACE, iColorspace);
+    if (iOption >= 0)
+        slic_set_option(&state, iOption, iValue);
+    if (state.flags & SLIC_FLAG_MATCH)
+        slic_set_encode_window(&state, &window);
+    if (state.flags & SLIC_FLAG_ALPHA_PLANE)
+        slic_set_strip(&state, ucStrip);
+    slic_add_chunk(&state, SLIC_CHUNK_METADATA, (const uint8_t *)"seed", 4);
+    if (slic_encode(&state, ucPixels, w * h) != SLIC_DONE)
+        return 0;
+    return (int)state.iOffset;
+} /* make_seed() */
+
+static void fuzz_loop(int iIterations)
+{
+    static const int iSeeds[][4] = { // bpp, colorspace, option, value
+        {1, SLIC_GRAYSCALE, -1, 0}, {2, SLIC_PALETTE, -1, 0}, {4, SLIC_GRAYSCALE, -1, 0},
+        {8, SLIC_GRAYSCALE, -1, 0}, {8, SLIC_PALETTE, SLIC_OPTION_CHECKSUM, 1},
+        {16, SLIC_RGB565, -1, 0}, {16, SLIC_GRAY16, -1, 0}, {16, SLIC_GRAYALPHA, -1, 0},
+        {24, SLIC_SRGB, -1, 0}, {24, SLIC_SRGB, SLIC_OPTION_STORED, 1}, {32, SLIC_SRGB, -1, 0}, {32, SLIC_SRGB, SLIC_OPTION_STORED, 1}, {32, SLIC_SRGB, SLIC_OPTION_ALPHA, SLIC_ALPHA_PLANE},
+        {32, SLIC_SRGB, SLIC_OPTION_ALPHA, SLIC_ALPHA_CONSTANT}, {48, SLIC_SRGB, -1, 0}, {64, SLIC_SRGB, -1, 0},
+        {8, SLIC_GRAYSCALE, SLIC_OPTION_GRADIENT, 1}, {16, SLIC_RGB565, SLIC_OPTION_GRADIENT, 1}, {24, SLIC_SRGB, SLIC_OPTION_GRADIENT, 1},
+        {24, SLIC_SRGB, SLIC_OPTION_MATCH, 4}, {32, SLIC_SRGB, SLIC_OPTION_MATCH, 9}
+    };
+    const int iSeedCount = sizeof(iSeeds) / sizeof(iSeeds[0]);
+    uint8_t ucSeed[4096], *pData;
+    int i, j, iSize, iEdits;
+
+    for (i=0; i<iIterations; i++) {
+        const int *pSeed = iSeeds[i % iSeedCount];
+        iSize = make_seed(ucSeed, sizeof(ucSeed), pSeed[0], pSeed[1], pSeed[2], pSeed[3]);
+        if (iSize == 0)
+            continue;
+        iEdits = 1 + (rand() & 7);
+        for (j=0; j<iEdits; j++) {
+            switch (rand() & 3) {
+                case 0: // flip a bit
+                    ucSeed[rand() % iSize] ^= (uint8_t)(1 << (rand() & 7));
+                    break;
+                case 1: // random byte
+                    ucSeed[rand() % iSize] = (uint8_t)rand();
+                    break;
+                case 2: // truncate
+                    iSize = 1 + rand() % iSize;
+                    break;
+                default: // interesting values in the header
+                    ucSeed[rand() % (iSize < 24 ? iSize : 24)] = (rand() & 1) ? 0xff : 0;
+                    break;
+            }
+        }
+        pData = (uint8_t *)malloc(iSize); // exactly sized so that reads past the end are caught
+        memcpy(pData, ucSeed, iSize);
+        LLVMFuzzerTestOneInput(pData, iSize);
+        free(pData);
+    }
+    printf("%d iterations done\n", iIterations);
+} /* fuzz_loop() */
+
+int main(int argc, const char * argv[]) {
+    FILE *f;
+    uint8_t *pData;
+    long iSize;
+    int i;
+
+    if (argc < 2) {
+        printf("SLIC decoder fuzz harness\n");
+        printf("Usage: slic_fuzz <file> [file ...]\n");
+        printf("       slic_fuzz -n <iterations> [random seed] (mutate built-in seed images)\n");
+        return 0;
+    }
+    if (strcmp(argv[1], "-n") == 0 && (argc == 3 || argc == 4)) {
+        if (argc == 4)
+            srand(atoi(argv[3]));
+        fuzz_loop(atoi(argv[2]));
+        return 0;
+    }
+    for (i=1; i<argc; i++) {
+        f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            printf("Error opening file %s\n", argv[i]);
+            continue;
+        }
+        fseek(f, 0L, SEEK_END);
+        iSize = ftell(f);
+        fseek(f, 0L, SEEK_SET);
+        pData = (uint8_t *)malloc(iSize ? iSize : 1);
+        if (fread(pData, 1, iSize, f) == (size_t)iSize)
+            LLVMFuzzerTestOneInput(pData, (size_t)iSize);
+        free(pData);
+        fclose(f);
+    }
+    return 0;
+} /* main() */
+#endif // !SLIC_LIBFUZZER
@@ -20,16 +20,50 @@
 // include the C code which does the actual work
 #include "slic.inl"
 
-int SLIC::init_encode_ram(uint16_t iWidth, uint16_t iHeight, int iBpp, uint8_t *pPalette, uint8_t *pOut, int iOutSize)
+int SLIC::init_encode_ram(uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette, uint8_t *pOut, int iOutSize)
 {
     return slic_init_encode(NULL, &_slic, iWidth, iHeight, iBpp, pPalette, NULL, NULL, pOut, iOutSize);
 } /* init_encode() */
 
-int SLIC::init_encode(const char *filename, uint16_t iWidth, uint16_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite)
+int SLIC::init_encode(const char *filename, uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite)
 {
     return slic_init_encode(filename, &_slic, iWidth, iHeight, iBpp, pPalette, pfnOpen, pfnWrite, NULL, 0);
 } /* init_encode() */
 
+int SLIC::set_option(int iOption, int iValue)
+{
+    return slic_set_option(&_slic, iOption, iValue);
+} /* set_option() */
+
+int SLIC::add_chunk(int iType, const uint8_t *pData, uint32_t iLen)
+{
+    return slic_add_chunk(&_slic, iType, pData, iLen);
+} /* add_chunk() */
+
+int SLIC::set_dictionary(const SLICDICT *pDict)
+{
+    return slic_set_dictionary(&_slic, pDict);
+} /* set_dictionary() */
+#ifdef SLIC_MATCH
+
+int SLIC::set_window(SLICENCODEWINDOW *pWindow)
+{
+    return slic_set_encode_window(&_slic, pWindow);
+} /* set_window() */
+
+int SLIC::set_window(SLICWINDOW *pWindow)
+{
+    return slic_set_window(&_slic, pWindow);
+} /* set_window() */
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+
+int SLIC::set_strip(uint8_t *pStrip)
+{
+    return slic_set_strip(&_slic, pStrip);
+} /* set_strip() */
+#endif
+
 int SLIC::encode(uint8_t *pPixels, int iPixelCount)
 {
     return slic_encode(&_slic, pPixels, iPixelCount);
@@ -50,16 +84,32 @@ int SLIC::init_decode(const char *filename, uint8_t *pPalette, SLIC_OPEN_CALLBAC
     return slic_init_decode(filename, &_slic, NULL, 0, pPalette, pfnOpen, pfnRead);
 } /* init_decode() */
 
+int SLIC::get_chunk(int iType, uint8_t *pDst, uint32_t *pLen)
+{
+    return slic_get_chunk(&_slic, iType, pDst, pLen);
+} /* get_chunk() */
+
+uint32_t SLIC::get_dictionary_id()
+{
+    return _slic.dict_id;
+} /* get_dictionary_id() */
+
 int SLIC::decode(uint8_t *pOut, int iOutSize)
 {
     return slic_decode(&_slic, pOut, iOutSize);
 } /* decode() */
 
-int SLIC::get_output_size()
+slic_size_t SLIC::get_output_size()
 {
     return _slic.iOffset;
 } /* get_output_size() */
 
+#ifdef SLIC_STATS
+int SLIC::get_stats(SLICSTATS *pStats)
+{
+    return slic_get_stats(&_slic, pStats);
+} /* get_stats() */
+#endif
 int SLIC::get_width()
 {
     return _slic.width;
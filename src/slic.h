@@ -29,6 +29,34 @@ extern "C" {
 #if defined(__x86__) || defined(__x86_64__) || defined(__aarch64__)
 #define UNALIGNED_ALLOWED
 #endif
+//
+// 16-bits per channel pixel types need 64-bit math and extra code space
+// which is wasted on tiny 8-bit MCUs
+//
+#ifndef __AVR__
+#define SLIC_HIGH_BIT_DEPTH
+#endif
+//
+// 32-bpp images can code their alpha channel as a separate plane in strips
+// of SLIC_ALPHA_STRIP_SIZE pixels; the encoder buffers a strip of pixels and
+// the decoder its alpha values, in a buffer given to slic_set_strip() so that
+// SLICSTATE doesn't grow for images which don't use it. The code is left out
+// on tiny 8-bit MCUs.
+//
+#ifndef __AVR__
+#define SLIC_ALPHA_STRIPS
+#define SLIC_ALPHA_STRIP_SIZE 256
+#define SLIC_ENCODE_STRIP_SIZE (SLIC_ALPHA_STRIP_SIZE * 4) // bytes of the encoder's strip buffer
+#define SLIC_DECODE_STRIP_SIZE SLIC_ALPHA_STRIP_SIZE // bytes of the decoder's
+#endif
+//
+// The match op copies pixels from a window of the ones before them; the
+// encoder and decoder each need a SLICWINDOW of ~56K for it, which is more RAM
+// than tiny 8-bit MCUs have
+//
+#ifndef __AVR__
+#define SLIC_MATCH
+#endif
 
 /* A pointer to a slic_header struct has to be supplied to all of qoi's functions.
 It describes either the input format (for slic_write and slic_encode), or is
@@ -49,6 +77,10 @@ enum {
  SLIC_GRAYSCALE,
  SLIC_PALETTE,
  SLIC_RGB565,
+// 16-bpp, 1 channel of 16-bit gray
+ SLIC_GRAY16,
+// 16-bpp, 8-bit gray followed by 8-bit alpha
+ SLIC_GRAYALPHA,
  SLIC_COLORSPACE_COUNT
 };
 
@@ -67,11 +99,54 @@ typedef struct header_tag {
 } slic_header;
 
 #define SLIC_HEADER_SIZE 10
+//
+// The top bit of the colorspace byte marks an extended header; a byte of
+// SLIC_FLAG_xxx bits follows the 10 byte header, then any data those flags need
+//
+#define SLIC_COLORSPACE_MASK  0x7f
+#define SLIC_EXTENDED_HEADER  0x80
+#define SLIC_FLAG_ALPHA_PLANE    0x01 /* 32-bpp alpha is coded as a plane at the start of each strip */
+#define SLIC_FLAG_CONSTANT_ALPHA 0x02 /* 32-bpp alpha is the same for every pixel; 1 byte of alpha follows */
+#define SLIC_FLAG_PALETTE_COUNT  0x04 /* the palette has fewer than 256 entries; 1 byte of (count-1) follows */
+#define SLIC_FLAG_LARGE          0x08 /* 32-bit width and height follow; the 16-bit header fields are 0 */
+#define SLIC_FLAG_CHUNKS         0x10 /* a list of chunks follows the other extended header data */
+#define SLIC_FLAG_CHECKSUM       0x20 /* the file ends with a 4-byte LE CRC32C of everything before it */
+#define SLIC_FLAG_STORED         0x40 /* 24/32-bpp: SLIC_OP_STORED blocks replace the run of 60 op */
+#define SLIC_FLAG_MORE           0x80 /* a second byte of flags follows; its bits are the flags from 0x100 up */
+#define SLIC_FLAG_GRADIENT      0x100 /* 1-8 bpp, RGB565 and 24/32-bpp: the gradient op replaces the longest short run op */
+#define SLIC_FLAG_MATCH         0x200 /* 24/32-bpp: the match op replaces the longest short run op left */
+#ifdef SLIC_MATCH
+#define SLIC_FLAGS_KNOWN (SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA | SLIC_FLAG_PALETTE_COUNT | SLIC_FLAG_LARGE | SLIC_FLAG_CHUNKS | SLIC_FLAG_CHECKSUM | SLIC_FLAG_STORED | SLIC_FLAG_MORE | SLIC_FLAG_GRADIENT | SLIC_FLAG_MATCH)
+#else
+#define SLIC_FLAGS_KNOWN (SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA | SLIC_FLAG_PALETTE_COUNT | SLIC_FLAG_LARGE | SLIC_FLAG_CHUNKS | SLIC_FLAG_CHECKSUM | SLIC_FLAG_STORED | SLIC_FLAG_MORE | SLIC_FLAG_GRADIENT)
+#endif
+//
+// Each chunk is a type byte, a 4-byte little-endian length and that many bytes
+// of data; the list ends with a SLIC_CHUNK_END byte. Decoders skip the chunk
+// types they don't know unless the SLIC_CHUNK_CRITICAL bit is set, which means
+// the image can't be decoded without understanding that chunk.
+//
+#define SLIC_CHUNK_END      0x00
+#define SLIC_CHUNK_METADATA 0x01 /* application data (text, EXIF, etc.); not interpreted by SLIC */
+#define SLIC_CHUNK_DICTIONARY (SLIC_CHUNK_CRITICAL | 0x02) /* 4-byte LE ID of the SLICDICT the image was coded with + 1 byte of SLIC_DICT_xxx flags */
+#define SLIC_CHUNK_CRITICAL 0x80
+#define SLIC_DICT_PALETTE 0x01 /* the palette is the dictionary's and isn't stored in the file */
+//
+// Pixel counts and file positions; 64-bits so that gigapixel images can be
+// streamed, but AVR keeps them small since it can't address such images anyway
+//
+#ifdef __AVR__
+typedef int32_t slic_size_t;
+#define SLIC_MAX_PIXELS 0x7fffffffL
+#else
+typedef int64_t slic_size_t;
+#define SLIC_MAX_PIXELS (1LL << 48) /* width * height, so that byte counts can't overflow */
+#endif
 
 typedef struct slic_file_tag
 {
-  int32_t iPos; // current file position
-  int32_t iSize; // file size
+  slic_size_t iPos; // current file position
+  slic_size_t iSize; // file size
   uint8_t *pData; // memory file pointer
   void * fHandle; // class pointer to File/SdFat or whatever you want
 } SLICFILE;
@@ -85,6 +160,140 @@ typedef struct slic_file_tag
 #define FILE_BUF_SIZE 1024
 #endif
 
+//
+// slic_estimate() encodes this many bands of this many rows of an image
+//
+#define SLIC_ESTIMATE_BANDS 64
+#define SLIC_ESTIMATE_ROWS 1
+
+//
+// Number of chunks the encoder can be given and the decoder remembers;
+// the decoder skips any more than that
+//
+#ifdef __AVR__
+#define SLIC_MAX_CHUNKS 1
+#else
+#define SLIC_MAX_CHUNKS 8
+#endif
+
+typedef struct chunk_tag {
+    const uint8_t *pData; // encoder: the data to write
+    slic_size_t iOffset; // decoder: offset of the data when decoding from memory
+    uint32_t iLen;
+    uint8_t type;
+} slic_chunk;
+
+//
+// A dictionary for a set of small images (icons, glyphs) which have the same
+// pixel format: the cache contents and previous pixel that the encoder and
+// decoder start with instead of zeros and black, and optionally the palette.
+// slic_train_dictionary() builds one from a sample of the images. Files
+// coded with it name its ID in a SLIC_CHUNK_DICTIONARY chunk, and can only
+// be decoded when it's given to slic_set_dictionary().
+//
+typedef struct slic_dict_tag {
+    uint32_t id; // written to the header of each image
+    uint8_t bpp, colorspace; // the pixel format it's for
+    uint16_t palette_count; // entries of palette[] in use, 0 = the images store their own palette
+    uint32_t prev_pixel; // the pixel "before" the first one
+    uint32_t index[64]; // starting cache, laid out as SLICSTATE.index is for the format
+    uint8_t palette[768];
+} SLICDICT;
+
+#ifdef SLIC_MATCH
+//
+// The pixels which the match op can copy from: the last SLIC_WINDOW_SIZE of
+// them, as they're coded (24-bpp and separately stored alpha as opaque).
+// slic_set_window() gives one (32K) to the decoder. The encoder also keeps
+// hash chains of where each 3-pixel sequence was seen, so it's given a
+// SLICENCODEWINDOW (56K) with slic_set_encode_window(). Both are too big for
+// the stack of most MCUs.
+//
+#define SLIC_WINDOW_SIZE 8192 // how far back a match can reach (a power of 2, up to 8192)
+#define SLIC_MATCH_HASH_BITS 12
+#define SLIC_MIN_MATCH 3
+#define SLIC_MAX_MATCH (SLIC_MIN_MATCH + 2047)
+#define SLIC_MAX_EFFORT 9 // largest SLIC_OPTION_MATCH
+
+typedef struct slic_window_tag {
+    uint32_t pos; // pixels which have gone through it
+    uint32_t pixels[SLIC_WINDOW_SIZE]; // the last of them, at [pos & (SLIC_WINDOW_SIZE-1)]
+} SLICWINDOW;
+
+typedef struct slic_encode_window_tag {
+    SLICWINDOW window;
+    uint16_t head[1 << SLIC_MATCH_HASH_BITS]; // newest position of each hash (its low 16 bits)
+    uint16_t chain[SLIC_WINDOW_SIZE]; // the position before it with the same hash
+} SLICENCODEWINDOW;
+#endif
+
+#ifndef __AVR__
+#define SLIC_DICT_CANDIDATES 4 // colors counted for each cache entry while training
+
+typedef struct slic_trainer_tag {
+    SLICDICT dict; // what it's being trained for
+    uint32_t colors[65][SLIC_DICT_CANDIDATES]; // the most frequent first colors of each cache entry, then first pixels
+    uint32_t counts[65][SLIC_DICT_CANDIDATES]; // and the number of images they were seen in
+} SLICTRAINER;
+#endif
+
+//
+// Compression statistics; build the library and the program with -DSLIC_STATS
+// to have slic_encode() and slic_decode() count the ops of 8-bpp (and packed),
+// RGB565 and 24/32-bpp images; for the other formats slic_get_stats() returns
+// SLIC_INVALID_PARAM. Both count the same numbers for a file.
+// With callbacks, the calls to them are counted too; given a clock with
+// slic_set_clock(), the time spent in them and in between is measured.
+//
+#ifdef SLIC_STATS
+enum {
+    SLIC_STAT_INDEX = 0, // index (cache) ops
+    SLIC_STAT_DIFF,
+    SLIC_STAT_LUMA,
+    SLIC_STAT_RUN, // all of the run ops
+    SLIC_STAT_LITERAL, // pixels coded as they are: bad runs, SLIC_OP_RGB and stored blocks
+    SLIC_STAT_RGBA, // SLIC_OP_RGBA
+    SLIC_STAT_GRADIENT, // the gradient ops
+    SLIC_STAT_MATCH, // SLIC_OP_MATCH
+    SLIC_STAT_ALPHA, // the alpha planes of SLIC_ALPHA_PLANE strips; ops counts the planes and
+                     // pixels their values, which the RGB ops code again
+    SLIC_STAT_COUNT
+};
+#define SLIC_STAT_BUCKETS 16 // length histograms: 1, 2-3, 4-7, ... 32768 and more
+#define SLIC_IO_BUCKETS 32 // time histograms: 0-1, 2-3, 4-7, ... 2^31 and more ticks
+
+typedef uint64_t (SLIC_CLOCK_CALLBACK)(void); // any monotonic time base, e.g. ns or cycles
+
+typedef struct slic_stats_tag {
+    slic_size_t ops[SLIC_STAT_COUNT]; // number of ops of each kind
+    slic_size_t bytes[SLIC_STAT_COUNT]; // bytes of data they take
+    slic_size_t pixels[SLIC_STAT_COUNT]; // pixels they code; the cache hit rate is
+                                         // pixels[SLIC_STAT_INDEX] / the pixels not in runs
+    uint32_t run_lengths[SLIC_STAT_BUCKETS]; // runs of identical pixels (over any number of ops)
+    uint32_t literal_lengths[SLIC_STAT_BUCKETS]; // unbroken chains of literal pixels
+    uint32_t literal_splits; // encoder: literal ops ended early because the buffer was written out
+    uint8_t chain_kind; // kind of the last op; runs and literals add up over their ops
+    slic_size_t chain_len;
+    uint32_t io_calls; // pfnRead/pfnWrite calls
+    uint32_t io_refills; // buffers read by get_more_data() or written by dump_encoded_data()
+    slic_size_t io_bytes; // bytes they read or wrote
+    uint32_t io_sizes[SLIC_STAT_BUCKETS]; // bytes per call
+    uint64_t io_ticks; // clock ticks spent in the callbacks
+    uint64_t compute_ticks; // ticks spent in slic_encode()/slic_decode() outside of them
+    uint32_t io_times[SLIC_IO_BUCKETS]; // ticks per call
+    uint32_t compute_times[SLIC_IO_BUCKETS]; // compute ticks from the end of one call to the start of the next
+    uint64_t io_mark; // time the codec last started or returned from a callback
+    uint64_t io_since; // compute ticks since the last callback
+} SLICSTATS;
+#endif // SLIC_STATS
+
+//
+// The read callback copies up to iLen of the next bytes of the file to pBuf
+// and returns how many it copied (0 at the end or on an error). The data is
+// read strictly in order and the codec never changes pFile->iPos, so the
+// callback can keep its own position there (or in fHandle) and never has to
+// seek.
+//
 typedef int (SLIC_READ_CALLBACK)(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen);
 typedef int (SLIC_WRITE_CALLBACK)(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen);
 typedef int (SLIC_OPEN_CALLBACK)(const char *filename, SLICFILE *pFile);
@@ -92,29 +301,91 @@ typedef int (SLIC_OPEN_CALLBACK)(const char *filename, SLICFILE *pFile);
 typedef struct state_tag {
     int32_t run; // number of consecutive identical pixels
     int32_t bad_run; // number of consecutive uncompressible pixels
-    uint16_t width, height;
-    int32_t iOffset; // input or output data offset
+    uint32_t grad_delta; // decoder: step of the gradient which run counts the pixels of, 0 = none
+    uint32_t width, height;
+    slic_size_t iOffset; // input or output data offset
     uint8_t bpp, colorspace, extra_pixel, prev_op;
     uint8_t *pOutBuffer; // start of output buffer
     uint8_t *pOutPtr; // current output pointer
     uint8_t *pInPtr; // current input pointer
     uint8_t *pInEnd;
     uint32_t curr_pixel, prev_pixel;
-    int32_t iPixelCount;
+#ifdef SLIC_HIGH_BIT_DEPTH
+    uint64_t curr_pixel64, prev_pixel64; // 48/64-bpp pixels
+#endif
+    slic_size_t iPixelCount;
     int32_t iOutSize; // output buffer size
     SLIC_READ_CALLBACK *pfnRead;
     SLIC_WRITE_CALLBACK *pfnWrite;
+    uint8_t *pPalette; // palette to write with the header or the decoder's LUT
+    uint8_t header_pending; // encoder hasn't written the header yet
+    uint8_t decoder; // the state was set up by slic_init_decode()
+    uint8_t output_bpp; // decoder: 16 or 24 to output palette images through a LUT, 0 = indices
+    uint16_t palette_count; // number of palette entries stored in the file
+    uint16_t flags; // SLIC_FLAG_xxx bits of the extended header
+    uint8_t alpha; // alpha value of SLIC_FLAG_CONSTANT_ALPHA images
+    uint8_t source_bpp; // encoder: 24 or 32 when slic_encode() is given RGB(A) pixels to convert, 0 = none
+    uint8_t tolerance; // encoder: how far a color channel may be moved to code a pixel in fewer bytes, 0 = lossless
+    uint8_t chunk_count;
+    uint8_t dict_flags; // SLIC_DICT_xxx bits of the dictionary in use, or needed by the decoder
+    uint32_t dict_id; // its ID
+#ifdef SLIC_MATCH
+    SLICWINDOW *pWindow; // decoder: history of the match op, from slic_set_window()
+    SLICENCODEWINDOW *pEncodeWindow; // encoder: the same with hash chains, from slic_set_encode_window()
+    uint16_t match_dist; // decoder: distance of the match which run counts the pixels of, 0 = none
+    uint8_t match_effort; // encoder: SLIC_OPTION_MATCH
+#endif
+    slic_chunk chunks[SLIC_MAX_CHUNKS];
+    uint32_t crc; // SLIC_FLAG_CHECKSUM: CRC32C of the data written or read so far
+    uint8_t *pCrcPtr; // decoder: first byte of the input buffer not yet in the CRC, NULL when not checking
+#ifdef SLIC_ALPHA_STRIPS
+    uint8_t alpha_prev, alpha_index[8]; // alpha plane coder state
+    uint16_t strip_len, strip_pos; // pixels in the current strip, position in it
+    slic_size_t iStripPixels; // pixels not yet covered by a strip (decoder)
+    uint8_t *pStrip; // from slic_set_strip(); encoder: pixels of the strip, decoder: its alpha values
+#endif
+#ifdef SLIC_STATS
+    SLICSTATS stats;
+#endif
     uint32_t index[64];
     SLICFILE file;
     uint8_t ucFileBuf[FILE_BUF_SIZE];
 } SLICSTATE;
 
-int slic_init_encode(const char *filename, SLICSTATE *pState, uint16_t iWidth, uint16_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize);
+int slic_init_encode(const char *filename, SLICSTATE *pState, uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize);
+int slic_set_option(SLICSTATE *pState, int iOption, int iValue);
+int slic_add_chunk(SLICSTATE *pState, int iType, const uint8_t *pData, uint32_t iLen);
 int slic_encode(SLICSTATE *pState, uint8_t *pPixels, int iPixelCount);
+#ifndef __AVR__
+int slic_choose_format(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iBpp, int iPitch, int *piBpp, int *piColorspace, uint8_t *pPalette);
+int slic_sort_palette(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iPitch, uint8_t *pPalette);
+#endif
+int slic_estimate(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iBpp, int iPitch, slic_size_t *pSize, slic_size_t *pError);
+int slic_set_dictionary(SLICSTATE *pState, const SLICDICT *pDict);
+#ifdef SLIC_MATCH
+int slic_set_window(SLICSTATE *pState, SLICWINDOW *pWindow);
+int slic_set_encode_window(SLICSTATE *pState, SLICENCODEWINDOW *pWindow);
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+int slic_set_strip(SLICSTATE *pState, uint8_t *pStrip);
+#endif
+#ifndef __AVR__
+int slic_init_trainer(SLICTRAINER *pTrainer, uint32_t u32ID, int iBpp, uint8_t *pPalette);
+int slic_train_dictionary(SLICTRAINER *pTrainer, uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iPitch);
+int slic_get_dictionary(SLICTRAINER *pTrainer, SLICDICT *pDict);
+#endif
 
 int slic_init_decode(const char *filename, SLICSTATE *pState, uint8_t *pData, int iDataSize, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_READ_CALLBACK *pfnRead);
+int slic_get_chunk(SLICSTATE *pState, int iType, uint8_t *pDst, uint32_t *pLen);
 int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize);
 
+int slic_set_isa(int iISA);
+int slic_get_isa(void);
+#ifdef SLIC_STATS
+int slic_get_stats(SLICSTATE *pState, SLICSTATS *pStats);
+int slic_set_clock(SLIC_CLOCK_CALLBACK *pfnClock);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -123,15 +394,21 @@ int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize);
 #define SLIC_OP_DIFF    0x40 /* 01xxxxxx */
 #define SLIC_OP_LUMA    0x80 /* 10xxxxxx */
 #define SLIC_OP_RUN     0xc0 /* 11xxxxxx */
+#define SLIC_OP_MATCH   0xf9 /* 11111001 + (length-3) + 2-byte LE (distance-1) | ((length-3) >> 8) << 13, with SLIC_FLAG_MATCH */
+#define SLIC_OP_GRADIENT 0xfa /* 11111010 + (count-1) + the DIFF or LUMA op of the step, with SLIC_FLAG_GRADIENT */
+#define SLIC_OP_STORED  0xfb /* 11111011 + (count-1) + count RGB triplets, with SLIC_FLAG_STORED */
 #define SLIC_OP_RUN256  0xfc /* 11111100 */
 #define SLIC_OP_RUN1024 0xfd /* 11111101 */
 #define SLIC_OP_RGB     0xfe /* 11111110 */
 #define SLIC_OP_RGBA    0xff /* 11111111 */
 
+#define SLIC_RGB_HASH(C) (((C * 3) + ((C >> 8) * 5) + ((C >> 16) * 7) + ((C >> 24) * 11)) & 63)
+
 // gray / palette ops
 #define SLIC_OP_RUN8      0x00
 #define SLIC_OP_RUN8_256  0x3F
 #define SLIC_OP_RUN8_1024 0x3E
+#define SLIC_OP_GRADIENT8 0x3D /* + (count-1) + the step, with SLIC_FLAG_GRADIENT */
 #define SLIC_OP_BADRUN8   0x40
 #define SLIC_OP_DIFF8     0x80
 #define SLIC_OP_INDEX8    0xc0
@@ -142,12 +419,47 @@ int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize);
 #define SLIC_OP_RUN16      0x00
 #define SLIC_OP_RUN16_256  0x3F
 #define SLIC_OP_RUN16_1024 0x3E
+#define SLIC_OP_GRADIENT16 0x3D /* + (count-1) + the step of each field as a LE RGB565 value, with SLIC_FLAG_GRADIENT */
 #define SLIC_OP_BADRUN16   0x40
 #define SLIC_OP_DIFF16     0x80
 #define SLIC_OP_INDEX16    0xc0
 
 #define SLIC_RGB565_HASH(C) ((((C & 0x1f) * 1) + (((C >> 5) & 0x3f) * 6) + ((C >> 11) * 12)) & 0x7)
 
+// 16-bit grayscale ops
+#define SLIC_OP_RUN_G16      0x00 /* 00xxxxxx - same run codes as RUN8 */
+#define SLIC_OP_RUN_G16_256  0x3F
+#define SLIC_OP_RUN_G16_1024 0x3E
+#define SLIC_OP_BADRUN_G16   0x40 /* 01xxxxxx + N 16-bit literals */
+#define SLIC_OP_DIFF_G16     0x80 /* 10xxxxxx - delta of -32 to +31 */
+#define SLIC_OP_INDEX_G16    0xc0 /* 110xxxxx - 32 entry cache */
+#define SLIC_OP_LUMA_G16     0xe0 /* 111xxxxx + 1 byte - delta of -4096 to +4095 */
+
+#define SLIC_GRAY16_HASH(C) (((C) + (((C) >> 5) * 3) + (((C) >> 10) * 7)) & 0x1f)
+
+// gray+alpha ops
+#define SLIC_OP_RUN_GA      0x00 /* 00xxxxxx - same run codes as RUN8 */
+#define SLIC_OP_RUN_GA_256  0x3F
+#define SLIC_OP_RUN_GA_1024 0x3E
+#define SLIC_OP_INDEX_GA    0x40 /* 01xxxxxx - 64 entry cache */
+#define SLIC_OP_DIFF_GA     0x80 /* 10aaaggg - gray and alpha deltas of -4 to +3 */
+#define SLIC_OP_ALPHA_GA    0xc0 /* 110pgggg + new alpha - gray delta of -8 to +7, plus the alpha delta if p=1 */
+#define SLIC_OP_LUMA_GA     0xe0 /* 1110xxxx + 1 byte - gray and alpha deltas of -32 to +31 */
+#define SLIC_OP_BADRUN_GA   0xf0 /* 1111xxxx + 1-15 gray/alpha pairs */
+#define SLIC_OP_GRAY_GA     0xff /* followed by a new gray value, same alpha */
+
+#define SLIC_GA_HASH(C) ((((C) & 0xff) * 3 + ((C) >> 8) * 5) & 0x3f)
+
+// 48/64-bpp ops (16-bits per channel)
+// DIFF, LUMA and the RUN ops are the same as 24/32-bpp and work on the
+// lower 8 bits of each channel difference
+#define SLIC_OP_INDEX64   0x00 /* 000xxxxx - 32 entry cache */
+#define SLIC_OP_LUMA64    0x20 /* 001xxxxx + 2 bytes - 9-bit green, 6-bit r/b deltas */
+#define SLIC_OP_RGB48     0xfe /* followed by 3 16-bit values */
+#define SLIC_OP_RGBA64    0xff /* followed by 4 16-bit values */
+
+#define SLIC_RGB64_HASH(C) ((((uint32_t)(C) & 0xffff) * 3 + ((uint32_t)((C) >> 16) & 0xffff) * 5 + ((uint32_t)((C) >> 32) & 0xffff) * 7 + (uint32_t)((C) >> 48) * 11) & 0x1f)
+
 #define SLIC_OP_MASK    0xc0 /* 11000000 */
 
 // SLIC_MAGIC = "SLIC"
@@ -160,7 +472,46 @@ enum {
     SLIC_BAD_FILE,
     SLIC_DECODE_ERROR,
     SLIC_IO_ERROR,
-    SLIC_ENCODE_OVERFLOW
+    SLIC_ENCODE_OVERFLOW,
+    SLIC_CHECKSUM_ERROR,
+    SLIC_NEED_DICTIONARY, // the image was coded with a dictionary which hasn't been given to slic_set_dictionary()
+    SLIC_NEED_WINDOW, // the image uses the match op and slic_set_window() hasn't been given a window
+    SLIC_NEED_STRIP // the image has an alpha plane and slic_set_strip() hasn't been given a strip buffer
+};
+
+// slic_set_option() options; the encoder options must be set before the first call to slic_encode()
+enum {
+    SLIC_OPTION_COLORSPACE = 0, // SLIC_GRAY16 or SLIC_GRAYALPHA instead of SLIC_RGB565 for 16-bpp
+    SLIC_OPTION_ALPHA, // how 32-bpp images store their alpha channel (SLIC_ALPHA_xxx)
+    SLIC_OPTION_PALETTE_OUTPUT, // decoder only: output palette images as 16 (RGB565) or 24-bpp pixels
+    SLIC_OPTION_CHECKSUM, // 1 = end the file with a CRC32C which slic_decode() verifies
+    SLIC_OPTION_STORED, // 24/32-bpp: 1 = code incompressible pixels as stored blocks (not readable by older decoders), 0 = off (default)
+    SLIC_OPTION_SOURCE_BPP, // 24 or 32: slic_encode() converts RGB(A) pixels to the image's format (see slic_choose_format())
+    SLIC_OPTION_TOLERANCE, // 1-SLIC_MAX_TOLERANCE: near-lossless; color channels may be off by this much (8-bit gray, RGB565, 24/32-bpp), 0 = lossless
+    SLIC_OPTION_GRADIENT, // 1-8 bpp, RGB565, 24/32-bpp: 1 = code ramps of a constant step with the gradient op (not readable by older decoders), 0 = off (default)
+    SLIC_OPTION_MATCH, // 24/32-bpp: 1-SLIC_MAX_EFFORT = copy repeated pixel sequences from a window (slic_set_encode_window()); higher is slower and smaller, 0 = off (default)
+    SLIC_OPTION_COUNT
+};
+
+// largest SLIC_OPTION_TOLERANCE, in levels of each channel (e.g. of the 5 and 6 bits of RGB565)
+#define SLIC_MAX_TOLERANCE 15
+
+// SLIC_OPTION_ALPHA values
+enum {
+    SLIC_ALPHA_INLINE = 0, // alpha changes are coded with the RGBA op (default)
+    SLIC_ALPHA_PLANE, // alpha is coded as its own plane of 8-bit ops in strips of pixels
+    SLIC_ALPHA_CONSTANT // every pixel has the alpha of the first one; only RGB is coded
+};
+
+// slic_set_isa() kernel sets for the SIMD code; SLIC_ISA_AUTO picks the best one
+// the CPU has, unless the SLIC_ISA environment variable names another one
+// ("scalar", "sse4", "avx2" or "neon")
+enum {
+    SLIC_ISA_AUTO = 0,
+    SLIC_ISA_SCALAR, // plain C
+    SLIC_ISA_SSE4, // x86 with SSSE3 and SSE4.2
+    SLIC_ISA_AVX2, // x86 with AVX2 and SSE4.2
+    SLIC_ISA_NEON // ARM with NEON (and the CRC32 instructions if the compiler targets them)
 };
 
 #ifdef __cplusplus
@@ -170,19 +521,34 @@ enum {
 class SLIC
 {
   public:
-    int init_encode_ram(uint16_t iWidth, uint16_t iHeight, int iBpp, uint8_t *pPalette, uint8_t *pOut, int iOutSize);
-    int init_encode(const char *filename, uint16_t iWidth, uint16_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite);
+    int init_encode_ram(uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette, uint8_t *pOut, int iOutSize);
+    int init_encode(const char *filename, uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite);
+    int set_option(int iOption, int iValue);
+    int add_chunk(int iType, const uint8_t *pData, uint32_t iLen);
+    int set_dictionary(const SLICDICT *pDict);
+#ifdef SLIC_MATCH
+    int set_window(SLICENCODEWINDOW *pWindow); // encoder
+    int set_window(SLICWINDOW *pWindow); // decoder
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+    int set_strip(uint8_t *pStrip);
+#endif
     int encode(uint8_t *pPixels, int iPixelCount);
 
     int init_decode_ram(uint8_t *pData, int iDataSize, uint8_t *pPalette);
     int init_decode_flash(uint8_t *pData, int iDataSize, uint8_t *pPalette);
     int init_decode(const char *filename, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_READ_CALLBACK *pfnRead);
+    int get_chunk(int iType, uint8_t *pDst, uint32_t *pLen);
+    uint32_t get_dictionary_id();
     int decode(uint8_t *pOut, int iOutSize);
     int get_width();
     int get_height();
     int get_bpp();
     int get_colorspace();
-    int get_output_size();
+    slic_size_t get_output_size();
+#ifdef SLIC_STATS
+    int get_stats(SLICSTATS *pStats);
+#endif
 private:
   SLICSTATE _slic;
 };
@@ -17,7 +17,60 @@
 
 #ifdef ARDUINO
 #include <Arduino.h>
+#else
+#include <stdlib.h> // getenv() for SLIC_ISA
+#endif
+//
+// The run scans and fills, the CRC32C of SLIC_FLAG_CHECKSUM and the 24-bpp
+// packing have SIMD versions which are picked at run time (see slic_set_isa()).
+// The x86 ones are compiled with target attributes and only used when CPUID
+// says the CPU has them; the ARM ones are used when the compiler targets them.
+//
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SLIC_SIMD_X86
+#define SLIC_CRC32C_SSE42
+#include <immintrin.h>
+#include <nmmintrin.h>
+#elif defined(__ARM_NEON) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+#define SLIC_SIMD_NEON
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define SLIC_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#endif
+//
+// 24-bpp output is decoded as a batch of 32-bit pixels which are then packed
+// into the output with byte shuffles (SSSE3 or NEON), so that nothing is
+// written past the end of the output buffer
+//
+#if defined(UNALIGNED_ALLOWED) && defined(SLIC_SIMD_X86)
+#define SLIC_PACK24
+#define SLIC_PACK24_X86
+#elif defined(UNALIGNED_ALLOWED) && defined(SLIC_SIMD_NEON) && defined(__ARM_NEON)
+#define SLIC_PACK24
+#define SLIC_PACK24_NEON
+#endif
+#define SLIC_PACK24_BATCH 128
+//
+// Pixels converted at a time for SLIC_OPTION_SOURCE_BPP (on the stack)
+//
+#ifdef __AVR__
+#define SLIC_CONVERT_CHUNK 16
+#else
+#define SLIC_CONVERT_CHUNK 256
 #endif
+//
+// Neighboring index pairs counted by slic_sort_palette() (6 bytes each, on the stack)
+//
+#define SLIC_PAIR_SLOTS 2048
+//
+// SLICSTATE.dict_flags bits besides the SLIC_DICT_xxx ones stored in the file
+//
+#define SLIC_DICT_USED   0x40 /* encoder: write the chunk, decoder: the dictionary was given */
+#define SLIC_DICT_NEEDED 0x80 /* decoder: the header names a dictionary which hasn't been given yet */
 
 // Simple callback example for Harvard architecture FLASH memory access
 int slic_flash_read(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen)
@@ -35,13 +88,609 @@ int iBytesRead = 0;
     return iBytesRead;
 } /* slic_flash_read() */
 
-int slic_init_encode(const char *filename, SLICSTATE *pState, uint16_t iWidth, uint16_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize) {
-    slic_header hdr;
-    int rc;
+#ifdef __AVR__
+// 4 bits at a time to save FLASH, and kept out of RAM
+static const uint32_t ulCRC32C[16] PROGMEM = {
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3,
+    0x61c69362, 0x7198540d, 0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9,
+    0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+};
+#else
+static const uint32_t ulCRC32C[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+#endif
+//
+// The CRC32C kernels take and return the inverted CRC
+//
+static uint32_t slic_crc32c_table(uint32_t crc, const uint8_t *p, int iLen)
+{
+    while (iLen-- > 0) {
+#ifdef __AVR__
+        crc ^= *p++;
+        crc = (crc >> 4) ^ pgm_read_dword(&ulCRC32C[crc & 0xf]);
+        crc = (crc >> 4) ^ pgm_read_dword(&ulCRC32C[crc & 0xf]);
+#else
+        crc = (crc >> 8) ^ ulCRC32C[(crc ^ *p++) & 0xff];
+#endif
+    }
+    return crc;
+} /* slic_crc32c_table() */
+#ifdef SLIC_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t slic_crc32c_sse42(uint32_t crc, const uint8_t *p, int iLen)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc, u64;
+    while (iLen >= 8) {
+        memcpy(&u64, p, 8);
+        crc64 = _mm_crc32_u64(crc64, u64);
+        p += 8;
+        iLen -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (iLen-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+} /* slic_crc32c_sse42() */
+#endif // SLIC_CRC32C_SSE42
+#ifdef SLIC_CRC32C_ARM
+static uint32_t slic_crc32c_arm(uint32_t crc, const uint8_t *p, int iLen)
+{
+    uint64_t u64;
+    while (iLen >= 8) {
+        memcpy(&u64, p, 8);
+        crc = __crc32cd(crc, u64);
+        p += 8;
+        iLen -= 8;
+    }
+    while (iLen-- > 0)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+} /* slic_crc32c_arm() */
+#endif // SLIC_CRC32C_ARM
+//
+// The run kernels work on bytes and a 4-byte pattern which repeats from the
+// start of the data (a pixel of 8, 16 or 32 bits times 0x01010101, 0x10001 or
+// 1). The scans return how many bytes from s match it, up to iBytes; the
+// fills write it to iBytes bytes of d.
+//
+static int slic_scan_scalar(const uint8_t *s, int iBytes, uint32_t u32Pattern)
+{
+    int i = 0;
+#ifdef UNALIGNED_ALLOWED
+    while (i + 4 <= iBytes && *(const uint32_t *)&s[i] == u32Pattern)
+        i += 4;
+#endif
+    while (i < iBytes && s[i] == (uint8_t)(u32Pattern >> ((i & 3) * 8)))
+        i++;
+    return i;
+} /* slic_scan_scalar() */
+
+static void slic_fill_scalar(uint8_t *d, int iBytes, uint32_t u32Pattern)
+{
+    int i = 0;
+#ifdef UNALIGNED_ALLOWED
+    for (; i + 4 <= iBytes; i += 4)
+        *(uint32_t *)&d[i] = u32Pattern;
+#endif
+    for (; i < iBytes; i++)
+        d[i] = (uint8_t)(u32Pattern >> ((i & 3) * 8));
+} /* slic_fill_scalar() */
+#ifdef SLIC_SIMD_X86
+__attribute__((target("sse4.2")))
+static int slic_scan_sse4(const uint8_t *s, int iBytes, uint32_t u32Pattern)
+{
+    const __m128i pattern = _mm_set1_epi32((int)u32Pattern);
+    int i, iMask;
+
+    for (i=0; i+16 <= iBytes; i+=16) {
+        iMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&s[i]), pattern)) ^ 0xffff;
+        if (iMask)
+            return i + __builtin_ctz(iMask);
+    }
+    return i + slic_scan_scalar(&s[i], iBytes - i, u32Pattern);
+} /* slic_scan_sse4() */
+
+__attribute__((target("sse4.2")))
+static void slic_fill_sse4(uint8_t *d, int iBytes, uint32_t u32Pattern)
+{
+    const __m128i pattern = _mm_set1_epi32((int)u32Pattern);
+    int i;
+
+    for (i=0; i+16 <= iBytes; i+=16)
+        _mm_storeu_si128((__m128i *)&d[i], pattern);
+    slic_fill_scalar(&d[i], iBytes - i, u32Pattern);
+} /* slic_fill_sse4() */
+
+__attribute__((target("avx2")))
+static int slic_scan_avx2(const uint8_t *s, int iBytes, uint32_t u32Pattern)
+{
+    const __m256i pattern = _mm256_set1_epi32((int)u32Pattern);
+    uint32_t u32Mask;
+    int i;
+
+    for (i=0; i+32 <= iBytes; i+=32) {
+        u32Mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&s[i]), pattern));
+        if (u32Mask)
+            return i + __builtin_ctz(u32Mask);
+    }
+    if (i + 16 <= iBytes) {
+        u32Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&s[i]), _mm256_castsi256_si128(pattern))) ^ 0xffff;
+        if (u32Mask)
+            return i + __builtin_ctz(u32Mask);
+        i += 16;
+    }
+    return i + slic_scan_scalar(&s[i], iBytes - i, u32Pattern);
+} /* slic_scan_avx2() */
+
+__attribute__((target("avx2")))
+static void slic_fill_avx2(uint8_t *d, int iBytes, uint32_t u32Pattern)
+{
+    const __m256i pattern = _mm256_set1_epi32((int)u32Pattern);
+    int i;
+
+    for (i=0; i+32 <= iBytes; i+=32)
+        _mm256_storeu_si256((__m256i *)&d[i], pattern);
+    if (i + 16 <= iBytes) {
+        _mm_storeu_si128((__m128i *)&d[i], _mm256_castsi256_si128(pattern));
+        i += 16;
+    }
+    slic_fill_scalar(&d[i], iBytes - i, u32Pattern);
+} /* slic_fill_avx2() */
+#endif // SLIC_SIMD_X86
+#if defined(SLIC_SIMD_NEON) && defined(__ARM_NEON)
+#ifdef __aarch64__
+static int slic_scan_neon(const uint8_t *s, int iBytes, uint32_t u32Pattern)
+{
+    const uint8x16_t pattern = vreinterpretq_u8_u32(vdupq_n_u32(u32Pattern));
+    int i;
+
+    for (i=0; i+16 <= iBytes; i+=16) {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(&s[i]), pattern)) == 0)
+            break; // the scalar code finds the first byte which differs
+    }
+    return i + slic_scan_scalar(&s[i], iBytes - i, u32Pattern);
+} /* slic_scan_neon() */
+#endif // __aarch64__
+
+static void slic_fill_neon(uint8_t *d, int iBytes, uint32_t u32Pattern)
+{
+    const uint8x16_t pattern = vreinterpretq_u8_u32(vdupq_n_u32(u32Pattern));
+    int i;
+
+    for (i=0; i+16 <= iBytes; i+=16)
+        vst1q_u8(&d[i], pattern);
+    slic_fill_scalar(&d[i], iBytes - i, u32Pattern);
+} /* slic_fill_neon() */
+#endif // SLIC_SIMD_NEON
+
+#ifdef SLIC_PACK24
+//
+// The pack24 kernels store as many whole groups of 32-bit pixels as 24-bit
+// RGB as there are in iCount and return how many they did
+//
+#ifdef SLIC_PACK24_X86
+//
+// Pack 16 pixels at a time; the 4 bytes of each group of 4 pixels which the
+// shuffle zeroes are filled by shifting in the next group
+//
+__attribute__((target("ssse3")))
+static int slic_pack24_ssse3(uint8_t *d, const uint32_t *s, int iCount)
+{
+    const __m128i shuf = _mm_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+    __m128i a, b, c, e;
+    int i;
+
+    for (i=0; i+16 <= iCount; i+=16) {
+        a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&s[i]), shuf);
+        b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&s[i+4]), shuf);
+        c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&s[i+8]), shuf);
+        e = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&s[i+12]), shuf);
+        _mm_storeu_si128((__m128i *)d, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i *)&d[16], _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i *)&d[32], _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(e, 4)));
+        d += 48;
+    }
+    return i;
+} /* slic_pack24_ssse3() */
+#endif // SLIC_PACK24_X86
+#ifdef SLIC_PACK24_NEON
+static int slic_pack24_neon(uint8_t *d, const uint32_t *s, int iCount)
+{
+    uint8x16x4_t v;
+    uint8x16x3_t rgb;
+    int i;
+
+    for (i=0; i+16 <= iCount; i+=16) {
+        v = vld4q_u8((const uint8_t *)&s[i]);
+        rgb.val[0] = v.val[0];
+        rgb.val[1] = v.val[1];
+        rgb.val[2] = v.val[2];
+        vst3q_u8(&d[i * 3], rgb);
+    }
+    return i;
+} /* slic_pack24_neon() */
+#endif // SLIC_PACK24_NEON
+#endif // SLIC_PACK24
+//
+// The analyze kernels look at iCount RGBA pixels for what slic_choose_format()
+// needs to know and return the SLIC_NOT_xxx bits of what they found. An
+// RGB565 pixel is one whose 8-bit values have their top bits repeated in
+// the low bits, as 565 to 888 conversions make them.
+//
+#define SLIC_NOT_OPAQUE 1
+#define SLIC_NOT_GRAY 2
+#define SLIC_NOT_RGB565 4
+#define SLIC_RGB565_BITS(u32) (((u32) & 0xf8fcf8) | (((u32) >> 5) & 0x70007) | (((u32) >> 6) & 0x300))
+
+static uint32_t slic_analyze_scalar(const uint8_t *s, int iCount)
+{
+    uint32_t u32, u32Alpha = 0xffffffff, u32Gray = 0, u32RGB565 = 0;
+    int i;
+
+    for (i=0; i<iCount; i++) {
+        memcpy(&u32, &s[i*4], 4);
+        u32Alpha &= u32;
+        u32Gray |= (u32 ^ (u32 >> 8)) & 0xffff; // R == G == B
+        u32RGB565 |= u32 ^ SLIC_RGB565_BITS(u32);
+    }
+    return ((u32Alpha < 0xff000000) ? SLIC_NOT_OPAQUE : 0) | (u32Gray ? SLIC_NOT_GRAY : 0) | ((u32RGB565 & 0xffffff) ? SLIC_NOT_RGB565 : 0);
+} /* slic_analyze_scalar() */
+#ifdef SLIC_SIMD_X86
+//
+// The analysis is limited by memory bandwidth, so AVX2 uses this one too
+//
+__attribute__((target("sse4.2")))
+static uint32_t slic_analyze_sse4(const uint8_t *s, int iCount)
+{
+    const __m128i mask565 = _mm_set1_epi32(0xf8fcf8), low53 = _mm_set1_epi32(0x70007), low6 = _mm_set1_epi32(0x300);
+    __m128i v, alpha = _mm_set1_epi32(-1), gray = _mm_setzero_si128(), rgb565 = _mm_setzero_si128();
+    uint32_t u32Flags;
+    int i;
+
+    for (i=0; i+4 <= iCount; i+=4) {
+        v = _mm_loadu_si128((const __m128i *)&s[i*4]);
+        alpha = _mm_and_si128(alpha, v);
+        gray = _mm_or_si128(gray, _mm_xor_si128(v, _mm_srli_epi32(v, 8)));
+        rgb565 = _mm_or_si128(rgb565, _mm_xor_si128(v, _mm_or_si128(_mm_and_si128(v, mask565),
+                 _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 5), low53), _mm_and_si128(_mm_srli_epi32(v, 6), low6)))));
+    }
+    u32Flags = slic_analyze_scalar(&s[i*4], iCount - i);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_srai_epi32(alpha, 24), _mm_set1_epi32(-1))) != 0xffff)
+        u32Flags |= SLIC_NOT_OPAQUE;
+    if (!_mm_testz_si128(gray, _mm_set1_epi32(0xffff)))
+        u32Flags |= SLIC_NOT_GRAY;
+    if (!_mm_testz_si128(rgb565, _mm_set1_epi32(0xffffff)))
+        u32Flags |= SLIC_NOT_RGB565;
+    return u32Flags;
+} /* slic_analyze_sse4() */
+#endif // SLIC_SIMD_X86
+#if defined(SLIC_SIMD_NEON) && defined(__ARM_NEON) && defined(__aarch64__)
+static uint32_t slic_analyze_neon(const uint8_t *s, int iCount)
+{
+    const uint32x4_t mask565 = vdupq_n_u32(0xf8fcf8), low53 = vdupq_n_u32(0x70007), low6 = vdupq_n_u32(0x300);
+    uint32x4_t v, alpha = vdupq_n_u32(0xffffffff), gray = vdupq_n_u32(0), rgb565 = vdupq_n_u32(0);
+    uint32_t u32Flags;
+    int i;
+
+    for (i=0; i+4 <= iCount; i+=4) {
+        v = vreinterpretq_u32_u8(vld1q_u8(&s[i*4]));
+        alpha = vandq_u32(alpha, v);
+        gray = vorrq_u32(gray, veorq_u32(v, vshrq_n_u32(v, 8)));
+        rgb565 = vorrq_u32(rgb565, veorq_u32(v, vorrq_u32(vandq_u32(v, mask565),
+                 vorrq_u32(vandq_u32(vshrq_n_u32(v, 5), low53), vandq_u32(vshrq_n_u32(v, 6), low6)))));
+    }
+    u32Flags = slic_analyze_scalar(&s[i*4], iCount - i);
+    if (vminvq_u32(alpha) < 0xff000000)
+        u32Flags |= SLIC_NOT_OPAQUE;
+    if (vmaxvq_u32(vandq_u32(gray, vdupq_n_u32(0xffff))))
+        u32Flags |= SLIC_NOT_GRAY;
+    if (vmaxvq_u32(vandq_u32(rgb565, vdupq_n_u32(0xffffff))))
+        u32Flags |= SLIC_NOT_RGB565;
+    return u32Flags;
+} /* slic_analyze_neon() */
+#endif // SLIC_SIMD_NEON
+//
+// A set of kernels; there's one constant table for each ISA, and the one in
+// use is a pointer to it, so switching sets never changes a table which
+// another thread might be reading
+//
+typedef struct slic_kernels_tag {
+    int iISA;
+    uint32_t (*pfnCRC32C)(uint32_t crc, const uint8_t *p, int iLen);
+    int (*pfnScan)(const uint8_t *s, int iBytes, uint32_t u32Pattern);
+    void (*pfnFill)(uint8_t *d, int iBytes, uint32_t u32Pattern);
+    uint32_t (*pfnAnalyze)(const uint8_t *s, int iCount);
+#ifdef SLIC_PACK24
+    int (*pfnPack24)(uint8_t *d, const uint32_t *s, int iCount); // NULL for none
+#endif
+} SLICKERNELS;
+
+static const SLICKERNELS slic_kernels_scalar = {SLIC_ISA_SCALAR, slic_crc32c_table, slic_scan_scalar, slic_fill_scalar, slic_analyze_scalar
+#ifdef SLIC_PACK24
+    , NULL
+#endif
+};
+#ifdef SLIC_SIMD_X86
+static const SLICKERNELS slic_kernels_sse4 = {SLIC_ISA_SSE4, slic_crc32c_sse42, slic_scan_sse4, slic_fill_sse4, slic_analyze_sse4
+#ifdef SLIC_PACK24_X86
+    , slic_pack24_ssse3
+#endif
+};
+static const SLICKERNELS slic_kernels_avx2 = {SLIC_ISA_AVX2, slic_crc32c_sse42, slic_scan_avx2, slic_fill_avx2, slic_analyze_sse4
+#ifdef SLIC_PACK24_X86
+    , slic_pack24_ssse3 // an AVX2 version measured slower
+#endif
+};
+#endif // SLIC_SIMD_X86
+#ifdef SLIC_SIMD_NEON
+static const SLICKERNELS slic_kernels_neon = {SLIC_ISA_NEON,
+#ifdef SLIC_CRC32C_ARM
+    slic_crc32c_arm,
+#else
+    slic_crc32c_table,
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    slic_scan_neon,
+#else
+    slic_scan_scalar,
+#endif
+#ifdef __ARM_NEON
+    slic_fill_neon,
+#else
+    slic_fill_scalar,
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    slic_analyze_neon
+#else
+    slic_analyze_scalar
+#endif
+#ifdef SLIC_PACK24_NEON
+    , slic_pack24_neon
+#endif
+};
+#endif // SLIC_SIMD_NEON
+//
+// The set in use, NULL until the first image picks one. Threads which start
+// coding at the same time may all pick, but they store the same pointer, and
+// the loads and stores are atomic so that no thread sees half of one. AVR
+// has no threads, and other compilers get a plain (aligned) pointer.
+//
+#if defined(__GNUC__) && !defined(__AVR__)
+#define SLIC_LOAD_KERNELS() __atomic_load_n(&slic_pKernels, __ATOMIC_ACQUIRE)
+#define SLIC_STORE_KERNELS(p) __atomic_store_n(&slic_pKernels, (p), __ATOMIC_RELEASE)
+#else
+#define SLIC_LOAD_KERNELS() (slic_pKernels)
+#define SLIC_STORE_KERNELS(p) (slic_pKernels = (p))
+#endif
+static const SLICKERNELS *slic_pKernels = NULL;
+//
+// Check that the CPU (and this build) can run the kernels of an ISA
+//
+static int slic_isa_supported(int iISA)
+{
+    switch (iISA) {
+        case SLIC_ISA_SCALAR:
+            return 1;
+#ifdef SLIC_SIMD_X86
+        case SLIC_ISA_SSE4:
+            return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("ssse3");
+        case SLIC_ISA_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("ssse3");
+#endif
+#ifdef SLIC_SIMD_NEON
+        case SLIC_ISA_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+} /* slic_isa_supported() */
+//
+// Switch to the kernels of an ISA; SLIC_ISA_AUTO picks the best one the CPU
+// has, unless the SLIC_ISA environment variable names a supported one
+//
+static int slic_pick_kernels(int iISA)
+{
+    const SLICKERNELS *pKernels = &slic_kernels_scalar;
+
+    if (iISA == SLIC_ISA_AUTO) {
+#ifndef ARDUINO
+        static const char *szNames[] = {"auto", "scalar", "sse4", "avx2", "neon"};
+        const char *szISA = getenv("SLIC_ISA");
+        int i;
+        for (i=SLIC_ISA_SCALAR; szISA != NULL && i<=SLIC_ISA_NEON; i++) {
+            if (strcmp(szISA, szNames[i]) == 0 && slic_isa_supported(i))
+                iISA = i;
+        }
+#endif
+        if (iISA == SLIC_ISA_AUTO)
+            iISA = slic_isa_supported(SLIC_ISA_AVX2) ? SLIC_ISA_AVX2 : slic_isa_supported(SLIC_ISA_SSE4) ? SLIC_ISA_SSE4 :
+                   slic_isa_supported(SLIC_ISA_NEON) ? SLIC_ISA_NEON : SLIC_ISA_SCALAR;
+    }
+    if (!slic_isa_supported(iISA))
+        return SLIC_INVALID_PARAM;
+#ifdef SLIC_SIMD_X86
+    if (iISA == SLIC_ISA_SSE4)
+        pKernels = &slic_kernels_sse4;
+    else if (iISA == SLIC_ISA_AVX2)
+        pKernels = &slic_kernels_avx2;
+#endif
+#ifdef SLIC_SIMD_NEON
+    if (iISA == SLIC_ISA_NEON)
+        pKernels = &slic_kernels_neon;
+#endif
+    SLIC_STORE_KERNELS(pKernels);
+    return SLIC_SUCCESS;
+} /* slic_pick_kernels() */
+//
+// The kernels in use; the first call picks them
+//
+static const SLICKERNELS *slic_get_kernels(void)
+{
+    const SLICKERNELS *pKernels = SLIC_LOAD_KERNELS();
+
+    if (pKernels == NULL) {
+        slic_pick_kernels(SLIC_ISA_AUTO);
+        pKernels = SLIC_LOAD_KERNELS();
+    }
+    return pKernels;
+} /* slic_get_kernels() */
+//
+// Use the kernels of an ISA (SLIC_ISA_xxx) from now on; returns
+// SLIC_INVALID_PARAM if the CPU or this build can't run them. It's safe to
+// call while other threads are coding images, since every set writes the
+// same data; each kernel call uses whichever set was in use when it started.
+//
+int slic_set_isa(int iISA)
+{
+    return slic_pick_kernels(iISA);
+} /* slic_set_isa() */
+//
+// The ISA of the kernels in use (picking them if it hasn't been done yet)
+//
+int slic_get_isa(void)
+{
+    return slic_get_kernels()->iISA;
+} /* slic_get_isa() */
+//
+// Update a CRC32C (Castagnoli) with iLen more bytes; start with a crc of 0
+//
+static uint32_t slic_crc32c(uint32_t crc, const uint8_t *p, int iLen)
+{
+    return ~(*slic_get_kernels()->pfnCRC32C)(~crc, p, iLen);
+} /* slic_crc32c() */
+#ifdef SLIC_PACK24
+//
+// Store iCount 32-bit pixels as 24-bit RGB
+//
+static void slic_pack24(uint8_t *d, const uint32_t *s, int iCount)
+{
+    const SLICKERNELS *pKernels = slic_get_kernels(); // read once, in case another thread switches them
+    int i = 0;
+
+    if (pKernels->pfnPack24)
+        i = (*pKernels->pfnPack24)(d, s, iCount);
+    d += i * 3;
+    for (; i<iCount-1; i++) { // the 4th byte is overwritten by the next pixel
+        *(uint32_t *)d = s[i];
+        d += 3;
+    }
+    if (i < iCount) {
+        d[0] = (uint8_t)s[i];
+        d[1] = (uint8_t)(s[i] >> 8);
+        d[2] = (uint8_t)(s[i] >> 16);
+    }
+} /* slic_pack24() */
+#endif // SLIC_PACK24
+
+//
+// Check that a bits-per-pixel and colorspace pair is one we know how to encode
+//
+static int slic_valid_format(int iBpp, int iColorspace)
+{
+    switch (iBpp) {
+        case 1:
+        case 2:
+        case 4:
+        case 8:
+            return (iColorspace == SLIC_GRAYSCALE || iColorspace == SLIC_PALETTE);
+        case 16:
+#ifdef SLIC_HIGH_BIT_DEPTH
+            if (iColorspace == SLIC_GRAY16)
+                return 1;
+#endif
+            return (iColorspace == SLIC_RGB565 || iColorspace == SLIC_GRAYALPHA);
+#ifdef SLIC_HIGH_BIT_DEPTH
+        case 48:
+        case 64:
+#endif
+        case 24:
+        case 32:
+            return (iColorspace == SLIC_SRGB || iColorspace == SLIC_LINEAR);
+    }
+    return 0;
+} /* slic_valid_format() */
+//
+// Check that a format can be encoded near-losslessly (SLIC_OPTION_TOLERANCE);
+// palette indices and the 16-bit gray/alpha formats have their own meanings
+//
+static int slic_near_format(int iBpp, int iColorspace)
+{
+    return (iBpp == 8 && iColorspace == SLIC_GRAYSCALE) || (iBpp == 16 && iColorspace == SLIC_RGB565) || iBpp == 24 || iBpp == 32;
+} /* slic_near_format() */
+//
+// Check that a format has a gradient op (SLIC_OPTION_GRADIENT)
+//
+static int slic_gradient_format(int iBpp, int iColorspace)
+{
+    return iBpp <= 8 || (iBpp == 16 && iColorspace == SLIC_RGB565) || iBpp == 24 || iBpp == 32;
+} /* slic_gradient_format() */
+
+int slic_init_encode(const char *filename, SLICSTATE *pState, uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_WRITE_CALLBACK *pfnWrite, uint8_t *pOut, int iOutSize) {
+    int rc, iColorspace;
     
-    if (pState == NULL || iWidth < 1 || iHeight < 1 || (iBpp != 8 && iBpp != 16 && iBpp != 24 && iBpp != 32)) {
+    if (iBpp >= 24)
+        iColorspace = SLIC_SRGB;
+    else if (iBpp == 16)
+        iColorspace = SLIC_RGB565;
+    else if (iBpp <= 8 && pPalette == NULL)
+        iColorspace = SLIC_GRAYSCALE;
+    else
+        iColorspace = SLIC_PALETTE;
+    if (pState == NULL || iWidth < 1 || iHeight < 1 || !slic_valid_format(iBpp, iColorspace)) {
         return SLIC_INVALID_PARAM;
     }
+#ifdef __AVR__
+    if (iWidth > 0xffff || iHeight > 0xffff) // no room for the extended header's size
+        return SLIC_INVALID_PARAM;
+#endif
+    if ((uint64_t)iWidth * iHeight > (uint64_t)SLIC_MAX_PIXELS)
+        return SLIC_INVALID_PARAM;
     if (pfnOpen || pfnWrite || filename) {
         if (!(pfnOpen && filename)) {
             return SLIC_INVALID_PARAM; // if one is defined, so must the other
@@ -52,6 +701,7 @@ int slic_init_encode(const char *filename, SLICSTATE *pState, uint16_t iWidth, u
     }
     pState->run = 0;
     pState->bad_run = 0;
+    pState->grad_delta = 0;
     pState->extra_pixel = 0;
     pState->width = iWidth;
     pState->height = iHeight;
@@ -68,447 +718,2748 @@ int slic_init_encode(const char *filename, SLICSTATE *pState, uint16_t iWidth, u
     }
     pState->iOffset = 0;
     pState->prev_op = -1;
+    memset(pState->index, 0, sizeof(pState->index)); // must match the decoder's starting cache
+#ifdef SLIC_STATS
+    memset(&pState->stats, 0, sizeof(pState->stats));
+#endif
     pState->curr_pixel = pState->prev_pixel = 0xff000000;
-    pState->iPixelCount = pState->width * pState->height;
-    // encode the header in the output to start
-    hdr.width = iWidth;
-    hdr.height = iHeight;
-    hdr.bpp = iBpp;
-    hdr.magic = SLIC_MAGIC;
-    if (iBpp >= 24)
-        hdr.colorspace = SLIC_SRGB;
-    else if (iBpp == 16)
-        hdr.colorspace = SLIC_RGB565;
-    else if (iBpp == 8 && pPalette == NULL)
-        hdr.colorspace = SLIC_GRAYSCALE;
+#ifdef SLIC_HIGH_BIT_DEPTH
+    pState->curr_pixel64 = pState->prev_pixel64 = 0xffff000000000000ULL;
+#endif
+    if (iBpp < 8) // packed pixels are coded as bytes
+        pState->iPixelCount = (((slic_size_t)iWidth * iBpp + 7) >> 3) * iHeight;
     else
-        hdr.colorspace = SLIC_PALETTE;
-    memcpy(pState->pOutPtr, &hdr, SLIC_HEADER_SIZE);
-    pState->pOutPtr += SLIC_HEADER_SIZE;
-    if (pPalette && iBpp == 8) {
-        memcpy(pState->pOutPtr, pPalette, 768);
-        pState->pOutPtr += 768;
-    }
-    // for file writing, init output data size var
-    pState->iOffset = (int)(pState->pOutPtr - pState->pOutBuffer);
+        pState->iPixelCount = (slic_size_t)iWidth * iHeight;
+    pState->colorspace = (uint8_t)iColorspace;
+    pState->pPalette = pPalette;
+    pState->flags = 0;
+    pState->alpha = 0xff;
+    pState->decoder = 0;
+    pState->output_bpp = 0;
+    pState->source_bpp = 0;
+    pState->tolerance = 0;
+#ifdef SLIC_MATCH
+    pState->pEncodeWindow = NULL;
+    pState->match_effort = 0;
+#endif
+    pState->palette_count = 0;
+    pState->chunk_count = 0;
+    pState->dict_flags = 0;
+    pState->dict_id = 0;
+    pState->crc = 0;
+    pState->pCrcPtr = NULL;
+#ifdef SLIC_ALPHA_STRIPS
+    pState->alpha_prev = 0xff;
+    memset(pState->alpha_index, 0, sizeof(pState->alpha_index));
+    pState->strip_len = 0;
+    pState->pStrip = NULL;
+#endif
+    // The header is written by the first call to slic_encode() so that
+    // options can still change it after this call
+    pState->header_pending = 1;
     return SLIC_SUCCESS;
 } /* slic_init_encode() */
 //
+// Turn the decoder's palette into a LUT so that palette images are output as
+// RGB565 or 24-bpp pixels. The palette passed to slic_init_decode() is used
+// as is for 24-bpp and converted in place to 256 RGB565 values for 16-bpp.
+//
+static int slic_set_palette_output(SLICSTATE *pState, int iBpp)
+{
+    uint8_t *s, *d;
+    uint16_t u16;
+    int i;
+
+    if (!pState->decoder || pState->colorspace != SLIC_PALETTE || pState->pPalette == NULL || pState->output_bpp)
+        return SLIC_INVALID_PARAM;
+    if (pState->dict_flags & SLIC_DICT_NEEDED) // the palette may come from it
+        return SLIC_INVALID_PARAM;
+    if (iBpp == 16) { // each 2-byte entry is written below the 3-byte entry it came from
+        s = d = pState->pPalette;
+        for (i=0; i<256; i++) {
+            u16 = ((s[0] >> 3) << 11) | ((s[1] >> 2) << 5) | (s[2] >> 3);
+            *d++ = (uint8_t)u16; // the palette may not be 16-bit aligned
+            *d++ = (uint8_t)(u16 >> 8);
+            s += 3;
+        }
+    } else if (iBpp != 24) {
+        return SLIC_INVALID_PARAM;
+    }
+    pState->output_bpp = (uint8_t)iBpp;
+    return SLIC_SUCCESS;
+} /* slic_set_palette_output() */
+//
+// Change an encoder option; only allowed before the first pixels are encoded
+// SLIC_OPTION_PALETTE_OUTPUT is for the decoder and can be set once after slic_init_decode()
+//
+int slic_set_option(SLICSTATE *pState, int iOption, int iValue)
+{
+    if (pState == NULL || iOption < 0 || iOption >= SLIC_OPTION_COUNT)
+        return SLIC_INVALID_PARAM;
+    if (iOption == SLIC_OPTION_PALETTE_OUTPUT)
+        return slic_set_palette_output(pState, iValue);
+    if (pState->decoder || !pState->header_pending)
+        return SLIC_INVALID_PARAM;
+    switch (iOption) {
+        case SLIC_OPTION_COLORSPACE:
+            if (!slic_valid_format(pState->bpp, iValue))
+                return SLIC_INVALID_PARAM;
+            if (iValue == SLIC_PALETTE && pState->pPalette == NULL)
+                return SLIC_INVALID_PARAM;
+            if (pState->tolerance && !slic_near_format(pState->bpp, iValue))
+                return SLIC_INVALID_PARAM;
+            if ((pState->flags & SLIC_FLAG_GRADIENT) && !slic_gradient_format(pState->bpp, iValue))
+                return SLIC_INVALID_PARAM;
+            pState->colorspace = (uint8_t)iValue;
+            break;
+        case SLIC_OPTION_ALPHA:
+            if (pState->bpp != 32)
+                return SLIC_INVALID_PARAM;
+            pState->flags &= ~(SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA);
+            if (iValue == SLIC_ALPHA_CONSTANT)
+                pState->flags |= SLIC_FLAG_CONSTANT_ALPHA;
+#ifdef SLIC_ALPHA_STRIPS
+            else if (iValue == SLIC_ALPHA_PLANE)
+                pState->flags |= SLIC_FLAG_ALPHA_PLANE;
+#endif
+            else if (iValue != SLIC_ALPHA_INLINE)
+                return SLIC_INVALID_PARAM;
+            break;
+        case SLIC_OPTION_CHECKSUM:
+            if (iValue)
+                pState->flags |= SLIC_FLAG_CHECKSUM;
+            else
+                pState->flags &= ~SLIC_FLAG_CHECKSUM;
+            break;
+        case SLIC_OPTION_STORED:
+            if (pState->bpp != 24 && pState->bpp != 32)
+                return SLIC_INVALID_PARAM;
+            if (iValue)
+                pState->flags |= SLIC_FLAG_STORED;
+            else
+                pState->flags &= ~SLIC_FLAG_STORED;
+            break;
+        case SLIC_OPTION_SOURCE_BPP:
+            if (iValue != 0 && iValue != 24 && iValue != 32)
+                return SLIC_INVALID_PARAM;
+            if (iValue && (iValue < pState->bpp || pState->colorspace == SLIC_GRAY16 || pState->colorspace == SLIC_GRAYALPHA))
+                return SLIC_INVALID_PARAM;
+            pState->source_bpp = (iValue == pState->bpp) ? 0 : (uint8_t)iValue;
+            break;
+        case SLIC_OPTION_TOLERANCE:
+            if (iValue < 0 || iValue > SLIC_MAX_TOLERANCE)
+                return SLIC_INVALID_PARAM;
+            if (iValue && !slic_near_format(pState->bpp, pState->colorspace))
+                return SLIC_INVALID_PARAM;
+            pState->tolerance = (uint8_t)iValue;
+            break;
+        case SLIC_OPTION_GRADIENT:
+            if (iValue && !slic_gradient_format(pState->bpp, pState->colorspace))
+                return SLIC_INVALID_PARAM;
+            if (iValue)
+                pState->flags |= SLIC_FLAG_GRADIENT;
+            else
+                pState->flags &= ~SLIC_FLAG_GRADIENT;
+            break;
+#ifdef SLIC_MATCH
+        case SLIC_OPTION_MATCH:
+            if (iValue < 0 || iValue > SLIC_MAX_EFFORT || (iValue && pState->bpp != 24 && pState->bpp != 32))
+                return SLIC_INVALID_PARAM;
+            pState->match_effort = (uint8_t)iValue;
+            if (iValue)
+                pState->flags |= SLIC_FLAG_MATCH;
+            else
+                pState->flags &= ~SLIC_FLAG_MATCH;
+            break;
+#else
+        case SLIC_OPTION_MATCH: // the match op isn't compiled in
+            if (iValue)
+                return SLIC_INVALID_PARAM;
+            break;
+#endif
+    }
+    return SLIC_SUCCESS;
+} /* slic_set_option() */
+//
+// Add a chunk to the header; like the options, this must be done before the
+// first call to slic_encode(). The data isn't copied, so it has to stay valid
+// until then.
+//
+int slic_add_chunk(SLICSTATE *pState, int iType, const uint8_t *pData, uint32_t iLen)
+{
+    slic_chunk *pChunk;
+
+    if (pState == NULL || pState->decoder || !pState->header_pending)
+        return SLIC_INVALID_PARAM;
+    if (iType <= SLIC_CHUNK_END || iType > 0xff || (pData == NULL && iLen) || pState->chunk_count >= SLIC_MAX_CHUNKS)
+        return SLIC_INVALID_PARAM;
+    pChunk = &pState->chunks[pState->chunk_count++];
+    pChunk->type = (uint8_t)iType;
+    pChunk->pData = pData;
+    pChunk->iLen = iLen;
+    pChunk->iOffset = 0;
+    pState->flags |= SLIC_FLAG_CHUNKS;
+    return SLIC_SUCCESS;
+} /* slic_add_chunk() */
+//
+// Start coding an image with a dictionary's cache, previous pixel and
+// palette. The encoder can be given one after slic_init_encode() and the
+// options, before the first slic_encode(); its ID goes in the header, and
+// palette images use the dictionary's palette (if it has one) instead of
+// storing their own. The decoder must be given the dictionary named by the
+// header (SLICSTATE.dict_id) after slic_init_decode() and before
+// SLIC_OPTION_PALETTE_OUTPUT or the first slic_decode(), which returns
+// SLIC_NEED_DICTIONARY until then.
+//
+int slic_set_dictionary(SLICSTATE *pState, const SLICDICT *pDict)
+{
+    if (pState == NULL || pDict == NULL || pDict->bpp != pState->bpp || pDict->colorspace != pState->colorspace)
+        return SLIC_INVALID_PARAM;
+    if (pState->decoder) {
+        if (!(pState->dict_flags & SLIC_DICT_NEEDED) || pDict->id != pState->dict_id)
+            return SLIC_INVALID_PARAM;
+        if (pState->dict_flags & SLIC_DICT_PALETTE) {
+            if (pDict->palette_count == 0 || pDict->palette_count > 256)
+                return SLIC_INVALID_PARAM;
+            pState->palette_count = pDict->palette_count;
+            if (pState->pPalette) { // the unused entries are black
+                memcpy(pState->pPalette, pDict->palette, pDict->palette_count * 3);
+                memset(&pState->pPalette[pDict->palette_count * 3], 0, 768 - pDict->palette_count * 3);
+            }
+        }
+        pState->dict_flags &= ~SLIC_DICT_NEEDED;
+    } else {
+        if (!pState->header_pending || (pState->dict_flags & SLIC_DICT_USED))
+            return SLIC_INVALID_PARAM;
+        pState->dict_id = pDict->id;
+        if (pState->colorspace == SLIC_PALETTE && pDict->palette_count) {
+            pState->pPalette = (uint8_t *)pDict->palette; // only read
+            pState->dict_flags |= SLIC_DICT_PALETTE;
+        }
+        pState->flags |= SLIC_FLAG_CHUNKS;
+    }
+    pState->dict_flags |= SLIC_DICT_USED;
+    memcpy(pState->index, pDict->index, sizeof(pState->index));
+    pState->curr_pixel = pState->prev_pixel = pDict->prev_pixel;
+    return SLIC_SUCCESS;
+} /* slic_set_dictionary() */
+#ifdef SLIC_MATCH
+//
+// Give the decoder the window which the match op copies pixels from; it's
+// emptied, so one window can be used for one image after another. It's
+// needed when the header has SLIC_FLAG_MATCH, before the first slic_decode(),
+// which returns SLIC_NEED_WINDOW until then.
+//
+int slic_set_window(SLICSTATE *pState, SLICWINDOW *pWindow)
+{
+    if (pState == NULL || pWindow == NULL || !pState->decoder)
+        return SLIC_INVALID_PARAM; // the encoder's has hash chains too
+    if (pState->iPixelCount != (slic_size_t)pState->width * pState->height)
+        return SLIC_INVALID_PARAM; // already started
+    pWindow->pos = 0;
+    pState->pWindow = pWindow;
+    return SLIC_SUCCESS;
+} /* slic_set_window() */
+//
+// Give the encoder its window and hash chains, before the first slic_encode()
+// when SLIC_OPTION_MATCH is set; like the decoder's, it's emptied
+//
+int slic_set_encode_window(SLICSTATE *pState, SLICENCODEWINDOW *pWindow)
+{
+    if (pState == NULL || pWindow == NULL || pState->decoder)
+        return SLIC_INVALID_PARAM;
+    if (!pState->header_pending)
+        return SLIC_INVALID_PARAM; // already started
+    pWindow->window.pos = 0;
+    memset(pWindow->head, 0, sizeof(pWindow->head));
+    pState->pEncodeWindow = pWindow;
+    return SLIC_SUCCESS;
+} /* slic_set_encode_window() */
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+//
+// Give the encoder or decoder the buffer of the strip being coded, for
+// 32-bpp images with an alpha plane: SLIC_ENCODE_STRIP_SIZE bytes for the
+// encoder (before the first slic_encode() when SLIC_ALPHA_PLANE is set) and
+// SLIC_DECODE_STRIP_SIZE for the decoder (when the header has
+// SLIC_FLAG_ALPHA_PLANE, before the first slic_decode(), which returns
+// SLIC_NEED_STRIP until then). It needs no alignment.
+//
+int slic_set_strip(SLICSTATE *pState, uint8_t *pStrip)
+{
+    if (pState == NULL || pStrip == NULL)
+        return SLIC_INVALID_PARAM;
+    if (pState->decoder ? (pState->iPixelCount != (slic_size_t)pState->width * pState->height) : !pState->header_pending)
+        return SLIC_INVALID_PARAM; // already started
+    pState->pStrip = pStrip;
+    return SLIC_SUCCESS;
+} /* slic_set_strip() */
+#endif
+#ifdef SLIC_STATS
+static SLIC_CLOCK_CALLBACK *slic_pfnClock = NULL;
+//
+// Set the clock which times the read/write callbacks (NULL to only count
+// them); it's shared by all of the images
+//
+int slic_set_clock(SLIC_CLOCK_CALLBACK *pfnClock)
+{
+    slic_pfnClock = pfnClock;
+    return SLIC_SUCCESS;
+} /* slic_set_clock() */
+//
+// Histogram bucket of a byte count or a number of ticks
+//
+static int slic_io_bucket(uint64_t u64, int iBuckets)
+{
+    int i = 0;
+    while (u64 > 1 && i < iBuckets-1) {
+        u64 >>= 1;
+        i++;
+    }
+    return i;
+} /* slic_io_bucket() */
+//
+// The codec was entered (bStart) or is about to return or call back; the
+// time since it was last entered or returned from a callback was spent on
+// compute
+//
+static uint64_t slic_io_mark(SLICSTATE *pState, int bStart)
+{
+    SLICSTATS *pStats = &pState->stats;
+    uint64_t t;
+
+    if (slic_pfnClock == NULL)
+        return 0;
+    t = (*slic_pfnClock)();
+    if (!bStart) {
+        pStats->compute_ticks += t - pStats->io_mark;
+        pStats->io_since += t - pStats->io_mark;
+    }
+    pStats->io_mark = t;
+    return t;
+} /* slic_io_mark() */
+//
+// Count a callback which started at time t and moved iLen bytes
+//
+static void slic_io_done(SLICSTATE *pState, uint64_t t, int iLen)
+{
+    SLICSTATS *pStats = &pState->stats;
+
+    pStats->io_calls++;
+    if (iLen > 0)
+        pStats->io_bytes += iLen;
+    pStats->io_sizes[slic_io_bucket((iLen > 0) ? iLen : 0, SLIC_STAT_BUCKETS)]++;
+    if (slic_pfnClock) {
+        pStats->io_mark = (*slic_pfnClock)();
+        pStats->io_ticks += pStats->io_mark - t;
+        pStats->io_times[slic_io_bucket(pStats->io_mark - t, SLIC_IO_BUCKETS)]++;
+        pStats->compute_times[slic_io_bucket(pStats->io_since, SLIC_IO_BUCKETS)]++;
+        pStats->io_since = 0;
+    }
+} /* slic_io_done() */
+
+static int slic_io_read(SLICSTATE *pState, uint8_t *pBuf, int32_t iLen)
+{
+    uint64_t t = slic_io_mark(pState, 0);
+    int rc = (*pState->pfnRead)(&pState->file, pBuf, iLen);
+    slic_io_done(pState, t, rc);
+    return rc;
+} /* slic_io_read() */
+
+static int slic_io_write(SLICSTATE *pState, uint8_t *pBuf, int32_t iLen)
+{
+    uint64_t t = slic_io_mark(pState, 0);
+    int rc = (*pState->pfnWrite)(&pState->file, pBuf, iLen);
+    slic_io_done(pState, t, iLen);
+    return rc;
+} /* slic_io_write() */
+#define SLIC_READ(pState, pBuf, iLen) slic_io_read(pState, pBuf, iLen)
+#define SLIC_WRITE(pState, pBuf, iLen) slic_io_write(pState, pBuf, iLen)
+#define SLIC_IO_ENTER(pState) slic_io_mark(pState, 1);
+#define SLIC_IO_LEAVE(pState) slic_io_mark(pState, 0);
+#define SLIC_IO_REFILL(pState) pState->stats.io_refills++;
+#else
+#define SLIC_READ(pState, pBuf, iLen) (*pState->pfnRead)(&pState->file, pBuf, iLen)
+#define SLIC_WRITE(pState, pBuf, iLen) (*pState->pfnWrite)(&pState->file, pBuf, iLen)
+#define SLIC_IO_ENTER(pState)
+#define SLIC_IO_LEAVE(pState)
+#define SLIC_IO_REFILL(pState)
+#endif // SLIC_STATS
+//
 // Output buffer is full and we need to write it
+// The write callback may give the encoder a new buffer to fill by changing
+// pOutBuffer and iOutSize (at least 64 bytes), so the callers recalculate
+// the end of it
 //
 static uint8_t * dump_encoded_data(SLICSTATE *pState, uint8_t *pOut)
 {
 int iLen;
     
     iLen = (int)(pOut - pState->pOutBuffer); // length of data to write
-    (*pState->pfnWrite)(&pState->file, pState->pOutBuffer, iLen);
+    if (pState->flags & SLIC_FLAG_CHECKSUM)
+        pState->crc = slic_crc32c(pState->crc, pState->pOutBuffer, iLen);
+    SLIC_IO_REFILL(pState)
+    SLIC_WRITE(pState, pState->pOutBuffer, iLen);
     pState->iOffset += iLen;
-    return pState->ucFileBuf;
+    return pState->pOutBuffer;
 } /* dump_encoded_data() */
 //
-// Encode 1 or more pixels into the output stream
+// Count the palette entries to store; 1/2/4-bpp images can only use the
+// first 2/4/16 and trailing black (unused) entries don't need to be stored
 //
-int slic_encode(SLICSTATE *pState, uint8_t *s, int iPixelCount) {
-	int iBpp, run, bad_run, prev_op;
-    uint8_t *d;
-    const uint8_t *pEnd, *pDstEnd;
-    uint32_t *index;
-    uint32_t px, px_prev;
-    uint16_t px16, px16_prev, px16_next;
-    uint16_t *index16, *s16, *pEnd16;
+static int slic_palette_count(SLICSTATE *pState)
+{
+    int iCount = (pState->bpp < 8) ? (1 << pState->bpp) : 256;
+    const uint8_t *p = pState->pPalette;
 
-	if (pState == NULL || s == NULL || iPixelCount < 1)
+    while (iCount > 1 && (p[iCount*3-3] | p[iCount*3-2] | p[iCount*3-1]) == 0)
+        iCount--;
+    return iCount;
+} /* slic_palette_count() */
+//
+// Append header data (palette, chunks) to the output; with a write callback
+// it's written in pieces as the buffer fills
+//
+static int slic_write_bytes(SLICSTATE *pState, const uint8_t *s, uint32_t iLen)
+{
+    uint32_t n;
+
+    while (iLen) {
+        n = (uint32_t)(&pState->pOutBuffer[pState->iOutSize] - pState->pOutPtr);
+        if (n == 0) {
+            if (!pState->pfnWrite)
+                return SLIC_ENCODE_OVERFLOW;
+            pState->pOutPtr = dump_encoded_data(pState, pState->pOutPtr);
+            continue;
+        }
+        if (n > iLen)
+            n = iLen;
+        memcpy(pState->pOutPtr, s, n);
+        pState->pOutPtr += n;
+        s += n;
+        iLen -= n;
+    }
+    return SLIC_SUCCESS;
+} /* slic_write_bytes() */
+//
+// Write the file header (chunks and palette) to the start of the output
+//
+static int slic_write_header(SLICSTATE *pState)
+{
+    slic_header hdr;
+    uint8_t ucChunk[5];
+    int i, n, rc, iExtra = 0; // extended header bytes
+    int iPalette = 0; // palette bytes
+
+#ifdef SLIC_MATCH
+    if ((pState->flags & SLIC_FLAG_MATCH) && pState->pEncodeWindow == NULL)
+        return SLIC_INVALID_PARAM; // slic_set_encode_window() wasn't called
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+    if ((pState->flags & SLIC_FLAG_ALPHA_PLANE) && pState->pStrip == NULL)
+        return SLIC_INVALID_PARAM; // slic_set_strip() wasn't called
+#endif
+    if (pState->colorspace == SLIC_PALETTE && !(pState->dict_flags & SLIC_DICT_PALETTE)) {
+        pState->palette_count = (uint16_t)slic_palette_count(pState);
+        if (pState->palette_count < 256)
+            pState->flags |= SLIC_FLAG_PALETTE_COUNT;
+        iPalette = pState->palette_count * 3;
+    }
+    if (pState->width > 0xffff || pState->height > 0xffff)
+        pState->flags |= SLIC_FLAG_LARGE;
+    if (pState->flags & 0xff00)
+        pState->flags |= SLIC_FLAG_MORE;
+    if (pState->flags)
+        iExtra = 1 + ((pState->flags & SLIC_FLAG_MORE) ? 1 : 0) + ((pState->flags & SLIC_FLAG_CONSTANT_ALPHA) ? 1 : 0) + ((pState->flags & SLIC_FLAG_PALETTE_COUNT) ? 1 : 0) + ((pState->flags & SLIC_FLAG_LARGE) ? 8 : 0);
+    // the chunks and palette are checked as they're written
+    if (pState->iOutSize < SLIC_HEADER_SIZE + iExtra)
+        return SLIC_ENCODE_OVERFLOW;
+    if (pState->flags & SLIC_FLAG_LARGE) {
+        hdr.width = hdr.height = 0; // in the extended header
+    } else {
+        hdr.width = (uint16_t)pState->width;
+        hdr.height = (uint16_t)pState->height;
+    }
+    hdr.bpp = pState->bpp;
+    hdr.magic = SLIC_MAGIC;
+    hdr.colorspace = pState->colorspace | (iExtra ? SLIC_EXTENDED_HEADER : 0);
+    memcpy(pState->pOutPtr, &hdr, SLIC_HEADER_SIZE);
+    pState->pOutPtr += SLIC_HEADER_SIZE;
+    if (iExtra) {
+        *pState->pOutPtr++ = (uint8_t)pState->flags;
+        if (pState->flags & SLIC_FLAG_MORE)
+            *pState->pOutPtr++ = (uint8_t)(pState->flags >> 8);
+        if (pState->flags & SLIC_FLAG_CONSTANT_ALPHA)
+            *pState->pOutPtr++ = pState->alpha;
+        if (pState->flags & SLIC_FLAG_PALETTE_COUNT)
+            *pState->pOutPtr++ = (uint8_t)(pState->palette_count - 1);
+        if (pState->flags & SLIC_FLAG_LARGE) { // little-endian
+            for (n=0; n<32; n+=8)
+                *pState->pOutPtr++ = (uint8_t)(pState->width >> n);
+            for (n=0; n<32; n+=8)
+                *pState->pOutPtr++ = (uint8_t)(pState->height >> n);
+        }
+    }
+    if (pState->flags & SLIC_FLAG_CHUNKS) {
+        if (pState->dict_flags & SLIC_DICT_USED) {
+            uint8_t ucDict[10] = {SLIC_CHUNK_DICTIONARY, 5, 0, 0, 0};
+            for (n=0; n<4; n++)
+                ucDict[n+5] = (uint8_t)(pState->dict_id >> (n*8));
+            ucDict[9] = pState->dict_flags & SLIC_DICT_PALETTE;
+            rc = slic_write_bytes(pState, ucDict, sizeof(ucDict));
+            if (rc != SLIC_SUCCESS)
+                return rc;
+        }
+        for (i=0; i<pState->chunk_count; i++) {
+            ucChunk[0] = pState->chunks[i].type;
+            for (n=0; n<4; n++)
+                ucChunk[n+1] = (uint8_t)(pState->chunks[i].iLen >> (n*8));
+            rc = slic_write_bytes(pState, ucChunk, 5);
+            if (rc == SLIC_SUCCESS)
+                rc = slic_write_bytes(pState, pState->chunks[i].pData, pState->chunks[i].iLen);
+            if (rc != SLIC_SUCCESS)
+                return rc;
+        }
+        ucChunk[0] = SLIC_CHUNK_END;
+        rc = slic_write_bytes(pState, ucChunk, 1);
+        if (rc != SLIC_SUCCESS)
+            return rc;
+    }
+    rc = slic_write_bytes(pState, pState->pPalette, iPalette);
+    if (rc != SLIC_SUCCESS)
+        return rc;
+    if (!pState->pfnWrite) // the write callback keeps count of what it's written
+        pState->iOffset = (int)(pState->pOutPtr - pState->pOutBuffer);
+    pState->header_pending = 0;
+    return SLIC_SUCCESS;
+} /* slic_write_header() */
+//
+// Add the fields of two RGB565 pixels, or bytes 0-2 of two 32-bit pixels,
+// without carrying from one into the next (byte 3 of the result is 0)
+//
+#define SLIC_ADD_565(a, b) ((((a) & 0x7bef) + ((b) & 0x7bef)) ^ (((a) ^ (b)) & 0x8410))
+#define SLIC_ADD_RGB(a, b) ((((a) & 0x7f7f7f) + ((b) & 0x7f7f7f)) ^ (((a) ^ (b)) & 0x808080))
+//
+// Store a pending run (less than 1024 pixels) with the run ops shared
+// by the 8 and 16-bit pixel types; iMax is the longest run of one op byte
+// (61 when the gradient op takes the 62)
+//
+static uint8_t * slic_store_run8(uint8_t *d, int run, int iMax)
+{
+    while (run >= 256) {
+        *d++ = SLIC_OP_RUN8_256;
+        run -= 256;
+    }
+    while (run >= iMax) {
+        *d++ = SLIC_OP_RUN8 | (iMax - 1);
+        run -= iMax;
+    }
+    if (run > 0) {
+        *d++ = SLIC_OP_RUN8 | (run - 1);
+    }
+    return d;
+} /* slic_store_run8() */
+//
+// Store a pending run (less than 1024 pixels) with the 24/32/48/64-bpp run ops;
+// iMax is the longest run of one op byte (59 when SLIC_OP_STORED takes the 60,
+// 58 when SLIC_OP_GRADIENT takes the 59 and 57 when SLIC_OP_MATCH takes the 58)
+//
+static uint8_t * slic_store_run(uint8_t *d, int run, int iMax)
+{
+    while (run >= 256) {
+        *d++ = SLIC_OP_RUN256;
+        run -= 256;
+    }
+    while (run >= iMax) {
+        *d++ = SLIC_OP_RUN | (iMax - 1);
+        run -= iMax;
+    }
+    if (run > 0) {
+        *d++ = SLIC_OP_RUN | (run - 1);
+    }
+    return d;
+} /* slic_store_run() */
+//
+// Longest run of one 24/32-bpp run op
+//
+static int slic_max_run(SLICSTATE *pState)
+{
+    if (pState->flags & SLIC_FLAG_MATCH)
+        return 57;
+    if (pState->flags & SLIC_FLAG_GRADIENT)
+        return 58;
+    return (pState->flags & SLIC_FLAG_STORED) ? 59 : 60;
+} /* slic_max_run() */
+//
+// Length of the ramp (pixels of a constant step, up to 256) which starts with
+// px, whose step from the pixel before it is delta; the rest of it is at s
+//
+static int slic_ramp_len8(const uint8_t *s, const uint8_t *pEnd, uint8_t px, uint8_t delta)
+{
+    int n = 1;
+
+    while (n < 256 && s < pEnd && *s == (uint8_t)(px + delta)) {
+        px = *s++;
+        n++;
+    }
+    return n;
+} /* slic_ramp_len8() */
+
+static int slic_ramp_len565(const uint16_t *s, const uint16_t *pEnd, uint16_t px, uint16_t delta)
+{
+    int n = 1;
+
+    while (n < 256 && s < pEnd && *s == (uint16_t)SLIC_ADD_565(px, delta)) {
+        px = *s++;
+        n++;
+    }
+    return n;
+} /* slic_ramp_len565() */
+
+static int slic_ramp_len_rgb(const uint8_t *s, const uint8_t *pEnd, uint32_t px, uint32_t delta, int iBpp, uint32_t alpha)
+{
+    int n = 1;
+    uint32_t u32;
+
+    while (n < 256 && s < pEnd) {
+        px = (px & 0xff000000) | SLIC_ADD_RGB(px, delta);
+        u32 = s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | alpha;
+        if (iBpp == 4)
+            u32 |= (uint32_t)s[3] << 24;
+        if (u32 != px)
+            break;
+        s += iBpp;
+        n++;
+    }
+    return n;
+} /* slic_ramp_len_rgb() */
+#ifdef SLIC_MATCH
+#define SLIC_WINDOW_MASK (SLIC_WINDOW_SIZE - 1)
+#define SLIC_MATCH_HASH(a, b, c) ((((a) ^ ((b) * 31) ^ ((c) * 961)) * 0x9e3779b1) >> (32 - SLIC_MATCH_HASH_BITS))
+//
+// Read a 24/32-bpp pixel as it's coded; ulOr is the alpha of pixels whose
+// alpha isn't coded by the RGB ops
+//
+static uint32_t slic_window_pixel(const uint8_t *s, int iBpp, uint32_t ulOr)
+{
+    uint32_t px = s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16);
+
+    if (iBpp == 4)
+        px |= (uint32_t)s[3] << 24;
+    return px | ulOr;
+} /* slic_window_pixel() */
+//
+// Add iCount pixels to the window; the encoder (pChains, the SLICENCODEWINDOW
+// around pWin) also links the position of each 3-pixel sequence into its hash
+// chain as its last pixel goes in
+//
+static void slic_window_add(SLICWINDOW *pWin, const uint8_t *s, int iCount, int iBpp, uint32_t ulOr, SLICENCODEWINDOW *pChains)
+{
+    uint32_t px, pos = pWin->pos, h;
+
+    for (; iCount > 0; iCount--, s += iBpp, pos++) {
+        px = slic_window_pixel(s, iBpp, ulOr);
+        pWin->pixels[pos & SLIC_WINDOW_MASK] = px;
+        if (pChains && pos >= 2) {
+            h = SLIC_MATCH_HASH(pWin->pixels[(pos - 2) & SLIC_WINDOW_MASK], pWin->pixels[(pos - 1) & SLIC_WINDOW_MASK], px);
+            pChains->chain[(pos - 2) & SLIC_WINDOW_MASK] = pChains->head[h];
+            pChains->head[h] = (uint16_t)(pos - 2);
+        }
+    }
+    pWin->pos = pos;
+} /* slic_window_add() */
+//
+// Rough number of bytes which the other ops would code iCount pixels in;
+// it stops counting once it's more than iLimit
+//
+static int slic_match_cost(SLICSTATE *pState, const uint8_t *s, int iCount, int iBpp, uint32_t alpha, uint32_t px_prev, int iLimit)
+{
+    int iCost = 0;
+    uint32_t px;
+    signed char vr, vg, vb, vg_r, vg_b;
+
+    for (; iCount > 0 && iCost <= iLimit; iCount--, s += iBpp) {
+        px = slic_window_pixel(s, iBpp, alpha);
+        if (px == px_prev)
+            continue; // the rest of a run
+        if ((px ^ px_prev) & 0xff000000) {
+            iCost += 5;
+        } else if (pState->index[SLIC_RGB_HASH(px)] == px) {
+            iCost++;
+        } else {
+            vr = (uint8_t)px - (uint8_t)px_prev;
+            vg = (uint8_t)(px >> 8) - (uint8_t)(px_prev >> 8);
+            vb = (uint8_t)(px >> 16) - (uint8_t)(px_prev >> 16);
+            vg_r = vr - vg;
+            vg_b = vb - vg;
+            if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                iCost++;
+            else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                iCost += 2;
+            else
+                iCost += 4;
+        }
+        if (iCount > 1 && slic_window_pixel(&s[iBpp], iBpp, alpha) == px)
+            iCost++; // a run starts
+        px_prev = px;
+    }
+    return iCost;
+} /* slic_match_cost() */
+//
+// Find the longest earlier copy of the pixels at s (all of the window's
+// pixels are before them) by walking the hash chain of the first three, up
+// to 2^(effort-1) candidates; returns its length or 0
+//
+static int slic_find_match(SLICENCODEWINDOW *pChains, const uint8_t *s, const uint8_t *pEnd, int iBpp, uint32_t alpha, int iEffort, int *piDist)
+{
+    const SLICWINDOW *pWin = &pChains->window;
+    uint32_t pos = pWin->pos, px, h, dist, dist_prev = 0;
+    int i, n, iMax, iBest = 0, iDepth = 1 << (iEffort - 1);
+    const int iNice = 8 << iEffort; // long enough to stop looking
+
+    iMax = (int)((pEnd - s) / iBpp);
+    if (iMax > SLIC_MAX_MATCH)
+        iMax = SLIC_MAX_MATCH;
+    if (iMax < SLIC_MIN_MATCH)
+        return 0;
+    h = SLIC_MATCH_HASH(slic_window_pixel(s, iBpp, alpha), slic_window_pixel(&s[iBpp], iBpp, alpha), slic_window_pixel(&s[iBpp*2], iBpp, alpha));
+    dist = (uint16_t)(pos - pChains->head[h]);
+    while (iDepth-- && dist > dist_prev && dist <= SLIC_WINDOW_SIZE && dist <= pos) {
+        // the pixels at or past s are copies of the ones being coded
+        for (n=0; n<iMax; n++) {
+            i = n - (int)dist;
+            px = (i < 0) ? pWin->pixels[(pos + i) & SLIC_WINDOW_MASK] : slic_window_pixel(&s[i * iBpp], iBpp, alpha);
+            if (px != slic_window_pixel(&s[n * iBpp], iBpp, alpha))
+                break;
+        }
+        if (n > iBest) {
+            iBest = n;
+            *piDist = (int)dist;
+            if (n >= iNice || n == iMax)
+                break;
+        }
+        dist_prev = dist; // the chain only goes back; a shorter distance is a stale link
+        dist = (uint16_t)(pos - pChains->chain[(pos - dist) & SLIC_WINDOW_MASK]);
+    }
+    return (iBest >= SLIC_MIN_MATCH) ? iBest : 0;
+} /* slic_find_match() */
+#endif // SLIC_MATCH
+#ifdef SLIC_STATS
+//
+// Histogram bucket of a run or literal chain length
+//
+static int slic_stat_bucket(slic_size_t iLen)
+{
+    int i = 0;
+    while (iLen > 1 && i < SLIC_STAT_BUCKETS-1) {
+        iLen >>= 1;
+        i++;
+    }
+    return i;
+} /* slic_stat_bucket() */
+//
+// Count iOps ops of a kind (0 when the last op grows) which take iBytes and
+// code iPixels; runs and literals which follow ones of the same kind add to
+// their length
+//
+static void slic_stat(SLICSTATE *pState, int iKind, int iOps, int iBytes, int iPixels)
+{
+    SLICSTATS *pStats = &pState->stats;
+    uint32_t *pHist;
+
+    pStats->ops[iKind] += iOps;
+    pStats->bytes[iKind] += iBytes;
+    pStats->pixels[iKind] += iPixels;
+    if (iKind != pStats->chain_kind) {
+        pStats->chain_kind = (uint8_t)iKind;
+        pStats->chain_len = 0;
+    }
+    if (iKind == SLIC_STAT_RUN || iKind == SLIC_STAT_LITERAL) {
+        pHist = (iKind == SLIC_STAT_RUN) ? pStats->run_lengths : pStats->literal_lengths;
+        if (pStats->chain_len)
+            pHist[slic_stat_bucket(pStats->chain_len)]--;
+        pStats->chain_len += iPixels;
+        pHist[slic_stat_bucket(pStats->chain_len)]++;
+    }
+} /* slic_stat() */
+//
+// Count the ops slic_store_run8()/slic_store_run() write for a pending run
+//
+static void slic_stat_run(SLICSTATE *pState, int run, int iMax)
+{
+    int iOps = (run >> 8) + ((run & 255) / iMax) + (((run & 255) % iMax) != 0);
+    if (run > 0)
+        slic_stat(pState, SLIC_STAT_RUN, iOps, iOps, run);
+} /* slic_stat_run() */
+//
+// Copy the statistics of the pixels coded so far. The coders of GRAY16,
+// GRAYALPHA and 48/64-bpp images don't count their ops, so for those only
+// the callbacks are counted and SLIC_INVALID_PARAM is returned.
+//
+int slic_get_stats(SLICSTATE *pState, SLICSTATS *pStats)
+{
+    if (pState == NULL || pStats == NULL)
+        return SLIC_INVALID_PARAM;
+    memcpy(pStats, &pState->stats, sizeof(SLICSTATS));
+    if ((pState->bpp == 16 && pState->colorspace != SLIC_RGB565) || pState->bpp > 32)
         return SLIC_INVALID_PARAM;
+    return SLIC_SUCCESS;
+} /* slic_get_stats() */
+#define SLIC_STAT(pState, iKind, iOps, iBytes, iPixels) slic_stat(pState, iKind, iOps, iBytes, iPixels);
+#define SLIC_STAT_RUN(pState, run, iMax) slic_stat_run(pState, run, iMax);
+#define SLIC_STAT_SPLIT(pState, bOpen) if (bOpen) pState->stats.literal_splits++;
+#else
+#define SLIC_STAT(pState, iKind, iOps, iBytes, iPixels)
+#define SLIC_STAT_RUN(pState, run, iMax)
+#define SLIC_STAT_SPLIT(pState, bOpen)
+#endif // SLIC_STATS
+//
+// The last pixel has been encoded; write what's left and set the final size
+//
+static void slic_finish_encode(SLICSTATE *pState, uint8_t *d)
+{
+int iLen = (int)(d - pState->pOutBuffer);
+
+    if (pState->flags & SLIC_FLAG_CHECKSUM)
+        pState->crc = slic_crc32c(pState->crc, pState->pOutBuffer, iLen);
+    if (pState->pfnWrite) {
+        SLIC_WRITE(pState, pState->pOutBuffer, iLen);
+        pState->iOffset += iLen;
+    } else {
+        pState->iOffset = iLen;
+    }
+} /* slic_finish_encode() */
+//
+// Encode 8-bit gray + 8-bit alpha pixels
+//
+static int slic_encode_ga8(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int run, bad_run, prev_op, index_pos, dg, da;
+    uint8_t *d;
+    const uint8_t *pEnd, *pDstEnd;
+    uint16_t px, px_prev;
+    uint16_t *index16 = (uint16_t *)pState->index;
+
     run = pState->run;
+    bad_run = pState->bad_run;
+    prev_op = pState->prev_op;
+    px_prev = (uint16_t)pState->prev_pixel;
     d = pState->pOutPtr;
+    pEnd = &s[iPixelCount * 2];
+    pDstEnd = &pState->pOutBuffer[pState->iOutSize-16]; // leave room for a run + multi-byte op
+    for (; s < pEnd; s += 2) {
+        if (d >= pDstEnd) {
+            if (pState->pfnWrite) {
+                d = dump_encoded_data(pState, d);
+                pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+                bad_run = 0; // can't update bad_run count once written
+                prev_op = -1;
+            } else {
+                return SLIC_ENCODE_OVERFLOW;
+            }
+        }
+        px = s[0] | (s[1] << 8);
+        if (px == px_prev) {
+            if (++run == 1024) { // don't let the pending run get too long to store
+                *d++ = SLIC_OP_RUN_GA_1024;
+                run = 0;
+            }
+            prev_op = SLIC_OP_RUN_GA;
+            continue;
+        }
+        if (run) {
+            d = slic_store_run8(d, run, 62);
+            run = 0;
+        }
+        index_pos = SLIC_GA_HASH(px);
+        if (index16[index_pos] == px) {
+            *d++ = SLIC_OP_INDEX_GA | index_pos;
+            prev_op = SLIC_OP_INDEX_GA;
+        } else {
+            index16[index_pos] = px;
+            dg = (int)s[0] - (int)(px_prev & 0xff);
+            da = (int)s[1] - (int)(px_prev >> 8);
+            if (dg >= -4 && dg < 4 && da >= -4 && da < 4) {
+                *d++ = SLIC_OP_DIFF_GA | ((da + 4) << 3) | (dg + 4);
+                prev_op = SLIC_OP_DIFF_GA;
+            } else if (dg >= -32 && dg < 32 && da >= -32 && da < 32) {
+                dg = ((dg + 32) << 6) | (da + 32);
+                *d++ = SLIC_OP_LUMA_GA | (dg >> 8);
+                *d++ = (uint8_t)dg;
+                prev_op = SLIC_OP_LUMA_GA;
+            } else if (dg >= -8 && dg < 8) { // anti-aliased edge of a solid color
+                *d++ = SLIC_OP_ALPHA_GA | (dg + 8);
+                *d++ = s[1];
+                prev_op = SLIC_OP_ALPHA_GA;
+            } else if (dg - da >= -8 && dg - da < 8) { // premultiplied edge (gray follows alpha)
+                *d++ = SLIC_OP_ALPHA_GA | 0x10 | (dg - da + 8);
+                *d++ = s[1];
+                prev_op = SLIC_OP_ALPHA_GA;
+            } else if (da == 0) {
+                *d++ = SLIC_OP_GRAY_GA;
+                *d++ = s[0];
+                prev_op = SLIC_OP_GRAY_GA;
+            } else if (prev_op == SLIC_OP_BADRUN_GA && bad_run < 15) {
+                bad_run++; // add this bad pixel to an existing run
+                *d++ = s[0];
+                *d++ = s[1];
+                d[-1-(bad_run*2)]++;
+            } else { // start a new run of bad pixels
+                *d++ = SLIC_OP_BADRUN_GA | 0;
+                *d++ = s[0];
+                *d++ = s[1];
+                bad_run = 1;
+                prev_op = SLIC_OP_BADRUN_GA;
+            }
+        }
+        px_prev = px;
+    } // for each pixel
+    if (pState->iPixelCount == 0) { // wrap up any remaining repeats
+        d = slic_store_run8(d, run, 62);
+        run = 0;
+        slic_finish_encode(pState, d);
+    }
+    pState->prev_pixel = px_prev;
+    pState->pOutPtr = d;
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->prev_op = prev_op;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_ga8() */
+#ifdef SLIC_HIGH_BIT_DEPTH
+//
+// Encode 16-bit grayscale pixels
+//
+static int slic_encode_gray16(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int run, bad_run, prev_op, index_pos, diff;
+    uint8_t *d;
+    const uint8_t *pDstEnd;
+    uint16_t px, px_prev, *s16, *pEnd16;
+    uint16_t *index16 = (uint16_t *)pState->index;
+
+    run = pState->run;
     bad_run = pState->bad_run;
-    px_prev = pState->prev_pixel;
     prev_op = pState->prev_op;
-    px = pState->curr_pixel;
-    index = pState->index;
+    px_prev = (uint16_t)pState->prev_pixel;
+    d = pState->pOutPtr;
+    s16 = (uint16_t *)s;
+    pEnd16 = &s16[iPixelCount];
+    pDstEnd = &pState->pOutBuffer[pState->iOutSize-16]; // leave room for a run + multi-byte op
+    while (s16 < pEnd16) {
+        if (d >= pDstEnd) {
+            if (pState->pfnWrite) {
+                d = dump_encoded_data(pState, d);
+                pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+                bad_run = 0; // can't update bad_run count once written
+                prev_op = -1;
+            } else {
+                return SLIC_ENCODE_OVERFLOW;
+            }
+        }
+        px = *s16++;
+        if (px == px_prev) {
+            if (++run == 1024) { // don't let the pending run get too long to store
+                *d++ = SLIC_OP_RUN_G16_1024;
+                run = 0;
+            }
+            prev_op = SLIC_OP_RUN_G16;
+            continue;
+        }
+        if (run) {
+            d = slic_store_run8(d, run, 62);
+            run = 0;
+        }
+        index_pos = SLIC_GRAY16_HASH(px);
+        if (index16[index_pos] == px) {
+            *d++ = SLIC_OP_INDEX_G16 | index_pos;
+            prev_op = SLIC_OP_INDEX_G16;
+        } else {
+            index16[index_pos] = px;
+            diff = (int)px - (int)px_prev;
+            if (diff >= -32 && diff < 32) {
+                *d++ = SLIC_OP_DIFF_G16 | (diff + 32);
+                prev_op = SLIC_OP_DIFF_G16;
+            } else if (diff >= -4096 && diff < 4096) {
+                diff += 4096;
+                *d++ = SLIC_OP_LUMA_G16 | (diff >> 8);
+                *d++ = (uint8_t)diff;
+                prev_op = SLIC_OP_LUMA_G16;
+            } else if (prev_op == SLIC_OP_BADRUN_G16 && bad_run < 64) {
+                bad_run++; // add this bad pixel to an existing run
+                *d++ = (uint8_t)px;
+                *d++ = (uint8_t)(px >> 8);
+                d[-1-(bad_run*2)]++;
+            } else { // start a new run of bad pixels
+                *d++ = SLIC_OP_BADRUN_G16 | 0;
+                *d++ = (uint8_t)px;
+                *d++ = (uint8_t)(px >> 8);
+                bad_run = 1;
+                prev_op = SLIC_OP_BADRUN_G16;
+            }
+        }
+        px_prev = px;
+    } // for each pixel
+    if (pState->iPixelCount == 0) { // wrap up any remaining repeats
+        d = slic_store_run8(d, run, 62);
+        run = 0;
+        slic_finish_encode(pState, d);
+    }
+    pState->prev_pixel = px_prev;
+    pState->pOutPtr = d;
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->prev_op = prev_op;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_gray16() */
+//
+// Encode 48-bpp (RGB) or 64-bpp (RGBA) pixels with 16-bits per channel
+//
+static int slic_encode_rgb64(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int run, index_pos, iBpp, i;
+    uint8_t *d;
+    const uint8_t *pEnd, *pDstEnd;
+    uint16_t *s16;
+    uint64_t px, px_prev, *index64 = (uint64_t *)pState->index;
+
     iBpp = pState->bpp >> 3;
-    if (iPixelCount > pState->iPixelCount)
-        iPixelCount = pState->iPixelCount;
-    pState->iPixelCount -= iPixelCount;
+    run = pState->run;
+    px_prev = pState->prev_pixel64;
+    d = pState->pOutPtr;
     pEnd = &s[iPixelCount * iBpp];
-    pDstEnd = &pState->pOutBuffer[pState->iOutSize-5]; // leave extra bytes for multi-byte ops
-    
-    if (iBpp == 1) { // grayscale or 8-bit palette image
-        uint8_t px8, px8_prev, px8_next;
-        uint8_t *index8 = (uint8_t *)pState->index;
-        px8 = (uint8_t)pState->prev_pixel;
-        px8_prev = (uint8_t)pState->curr_pixel;
-        if (pState->extra_pixel) {
-            pState->extra_pixel = 0;
-            px8_next = s[0];
-            goto restart_8bit; // try again
-        }
-        while (s < pEnd) {
-            if (d >= pDstEnd) {
-                if (pState->pfnWrite) {
-                    d = dump_encoded_data(pState, d);
-                    bad_run = 0; // can't update bad_run count once written
+    pDstEnd = &pState->pOutBuffer[pState->iOutSize-16]; // leave room for a run + multi-byte op
+    for (; s < pEnd; s += iBpp) {
+        if (d >= pDstEnd) {
+            if (pState->pfnWrite) {
+                d = dump_encoded_data(pState, d);
+                pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+            } else {
+                return SLIC_ENCODE_OVERFLOW;
+            }
+        }
+        s16 = (uint16_t *)s;
+        px = s16[0] | ((uint64_t)s16[1] << 16) | ((uint64_t)s16[2] << 32);
+        if (iBpp == 8)
+            px |= ((uint64_t)s16[3] << 48);
+        else
+            px |= 0xffff000000000000ULL;
+        if (px == px_prev) {
+            if (++run == 1024) { // don't let the pending run get too long to store
+                *d++ = SLIC_OP_RUN1024;
+                run = 0;
+            }
+            continue;
+        }
+        if (run) {
+            d = slic_store_run(d, run, 60);
+            run = 0;
+        }
+        index_pos = SLIC_RGB64_HASH(px);
+        if (index64[index_pos] == px) {
+            *d++ = SLIC_OP_INDEX64 | index_pos;
+        } else {
+            index64[index_pos] = px;
+            if ((px >> 48) == (px_prev >> 48)) {
+                // channel differences wrap at 16-bits
+                int vr = (int16_t)(px - px_prev);
+                int vg = (int16_t)((px >> 16) - (px_prev >> 16));
+                int vb = (int16_t)((px >> 32) - (px_prev >> 32));
+                int vg_r = vr - vg;
+                int vg_b = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    *d++ = SLIC_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    *d++ = SLIC_OP_LUMA | (vg + 32);
+                    *d++ = (vg_r + 8) << 4 | (vg_b + 8);
+                } else if (vg_r >= -32 && vg_r < 32 && vg >= -256 && vg < 256 && vg_b >= -32 && vg_b < 32) {
+                    uint32_t u = ((uint32_t)(vg + 256) << 12) | ((vg_r + 32) << 6) | (vg_b + 32);
+                    *d++ = SLIC_OP_LUMA64 | (u >> 16);
+                    *d++ = (uint8_t)(u >> 8);
+                    *d++ = (uint8_t)u;
                 } else {
-                    return SLIC_ENCODE_OVERFLOW;
+                    *d++ = SLIC_OP_RGB48;
+                    for (i = 0; i < 48; i += 8) // little-endian channel order
+                        *d++ = (uint8_t)(px >> i);
                 }
+            } else {
+                *d++ = SLIC_OP_RGBA64;
+                for (i = 0; i < 64; i += 8)
+                    *d++ = (uint8_t)(px >> i);
             }
-            px8 = *s++;
-            px8_next = s[0];
-            if (px8 == px8_prev) {
-                run++;
-                prev_op = SLIC_OP_RUN8;
+        }
+        px_prev = px;
+    } // for each pixel
+    if (pState->iPixelCount == 0) { // wrap up any remaining repeats
+        d = slic_store_run(d, run, 60);
+        run = 0;
+        slic_finish_encode(pState, d);
+    }
+    pState->prev_pixel64 = px_prev;
+    pState->pOutPtr = d;
+    pState->run = run;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_rgb64() */
+#endif // SLIC_HIGH_BIT_DEPTH
+//
+// 1/2/4-bpp images are coded as bytes of packed pixels (MSB first) with
+// each row padded to a whole byte. Convert a pixel count to a byte count;
+// it must cover whole rows, or whole bytes when rows have no padding
+//
+static int slic_packed_bytes(SLICSTATE *pState, int iPixelCount)
+{
+slic_size_t iBits = (slic_size_t)pState->width * pState->bpp;
+
+    if (iBits & 7) { // padded rows
+        if (iPixelCount % pState->width)
+            return -1;
+        return (int)((iPixelCount / pState->width) * ((iBits + 7) >> 3));
+    }
+    iBits = (slic_size_t)iPixelCount * pState->bpp;
+    if (iBits & 7)
+        return -1;
+    return (int)(iBits >> 3);
+} /* slic_packed_bytes() */
+//
+// Limit a count of pixels to those left in the image and take them from it
+//
+static int slic_take_pixels(SLICSTATE *pState, int iCount)
+{
+    if (iCount > pState->iPixelCount)
+        iCount = (int)pState->iPixelCount;
+    pState->iPixelCount -= iCount;
+    return iCount;
+} /* slic_take_pixels() */
+//
+// Encode 24/32-bpp pixels
+//
+static int slic_encode_rgb(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int iBpp, run, bad_run, iMaxRun, bGradient;
+    uint8_t *d, *pStored; // end of the last RGB op or stored block
+    const uint8_t *pEnd, *pDstEnd;
+    uint32_t *index = pState->index;
+    uint32_t px, px_prev, alpha;
+#ifdef SLIC_MATCH
+    SLICENCODEWINDOW *pWin = (pState->flags & SLIC_FLAG_MATCH) ? pState->pEncodeWindow : NULL;
+    const uint8_t *pSync = s; // first pixel not yet in the window
+#endif
+
+    iBpp = pState->bpp >> 3;
+    // the alpha of 24-bpp pixels and of 32-bpp pixels whose alpha is stored
+    // elsewhere is always coded as opaque
+    alpha = (iBpp == 3 || (pState->flags & (SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA))) ? 0xff000000 : 0;
+    run = pState->run;
+    bad_run = pState->bad_run; // pixels in the RGB op or stored block which ends at pStored
+    px = pState->curr_pixel;
+    px_prev = pState->prev_pixel;
+    d = pState->pOutPtr;
+    pStored = bad_run ? d : NULL;
+    iMaxRun = slic_max_run(pState);
+    bGradient = (pState->flags & SLIC_FLAG_GRADIENT);
+    pEnd = &s[iPixelCount * iBpp];
+    pDstEnd = &pState->pOutBuffer[pState->iOutSize-16]; // leave extra bytes for a run + multi-byte ops
+    for (; s < pEnd; s += iBpp) {
+        if (d >= pDstEnd) {
+            if (pState->pfnWrite) {
+                SLIC_STAT_SPLIT(pState, d == pStored && bad_run < 256 && (pState->flags & SLIC_FLAG_STORED))
+                d = dump_encoded_data(pState, d);
+                pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+                bad_run = 0; // can't update bad_run count once written
+                pStored = NULL;
+            } else {
+                return SLIC_ENCODE_OVERFLOW;
             }
-            else {
-                int index_pos, index_next;
-                while (run >= 1024) {
-                    *d++ = SLIC_OP_RUN8_1024;
-                    run -= 1024;
+        }
+#ifdef UNALIGNED_ALLOWED
+        px = *(uint32_t *)s;
+#else
+        px = (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24);
+#endif
+        px |= alpha;
+        if (px == px_prev) {
+            if (iBpp == 4 && alpha == 0) { // the pixels of the run can be compared as they are
+                int n = (int)((pEnd - s) >> 2) - 1;
+                if (n > 1023 - run)
+                    n = 1023 - run;
+                n = (*slic_get_kernels()->pfnScan)(&s[4], n * 4, px) >> 2;
+                s += n * 4;
+                run += n;
+            }
+            if (++run == 1024) { // don't let the pending run get too long to store
+                *d++ = SLIC_OP_RUN1024;
+                run = 0;
+                SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, 1024)
+            }
+        }
+        else {
+            int index_pos;
+            if (run > 0) {
+                SLIC_STAT_RUN(pState, run, iMaxRun)
+                d = slic_store_run(d, run, iMaxRun);
+                run = 0;
+            }
+#ifdef SLIC_MATCH
+            if (pWin) { // is a copy of these pixels in the window?
+                int iLen, iDist;
+                slic_window_add(&pWin->window, pSync, (int)((s - pSync) / iBpp), iBpp, alpha, pWin);
+                pSync = s;
+                iLen = slic_find_match(pWin, s, pEnd, iBpp, alpha, pState->match_effort, &iDist);
+                if (iLen && slic_match_cost(pState, s, iLen, iBpp, alpha, px_prev, 4) > 4) {
+                    *d++ = SLIC_OP_MATCH;
+                    *d++ = (uint8_t)(iLen - SLIC_MIN_MATCH);
+                    *d++ = (uint8_t)(iDist - 1);
+                    *d++ = (uint8_t)(((iDist - 1) >> 8) | (((iLen - SLIC_MIN_MATCH) >> 8) << 5));
+                    SLIC_STAT(pState, SLIC_STAT_MATCH, 1, 4, iLen)
+                    s += (iLen - 1) * iBpp; // the copied pixels don't go in the cache
+                    px = px_prev = slic_window_pixel(s, iBpp, alpha);
+                    continue;
                 }
-                while (run >= 256) {
-                    *d++ = SLIC_OP_RUN8_256;
-                    run -= 256;
+            }
+#endif
+            if (bGradient && ((px ^ px_prev) & 0xff000000) == 0 && &s[iBpp] < pEnd) {
+                // a ramp of a step the DIFF or LUMA op can code?
+                uint32_t delta = SLIC_ADD_RGB(px, SLIC_ADD_RGB(~px_prev, 0x010101));
+                signed char vr = (signed char)delta, vg = (signed char)(delta >> 8), vb = (signed char)(delta >> 16);
+                signed char vg_r = vr - vg, vg_b = vb - vg;
+                int n, bDiff = (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2);
+
+                if (bDiff || (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)) {
+                    n = slic_ramp_len_rgb(&s[iBpp], pEnd, px, delta, iBpp, alpha);
+                    if (n >= (bDiff ? 4 : 3)) { // shorter than a DIFF or LUMA op per pixel
+                        *d++ = SLIC_OP_GRADIENT;
+                        *d++ = (uint8_t)(n - 1);
+                        if (bDiff) {
+                            *d++ = SLIC_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                        } else {
+                            *d++ = SLIC_OP_LUMA | (vg + 32);
+                            *d++ = (vg_r + 8) << 4 | (vg_b + 8);
+                        }
+                        SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, bDiff ? 3 : 4, n)
+                        while (--n) { // the ramp's pixels don't go in the cache
+                            px = (px & 0xff000000) | SLIC_ADD_RGB(px, delta);
+                            s += iBpp;
+                        }
+                        px_prev = px;
+                        continue;
+                    }
                 }
-                while (run >= 62) {
-                    *d++ = SLIC_OP_RUN8 | 61;
-                    run -= 62;
+            }
+            index_pos = px * 3;
+            index_pos += ((px >> 8) * 5);
+            index_pos += ((px >> 16) * 7);
+            index_pos += ((px >> 24) * 11);
+            index_pos &= 63;
+
+            if (index[index_pos] == px) {
+                *d++ = SLIC_OP_INDEX | index_pos;
+                SLIC_STAT(pState, SLIC_STAT_INDEX, 1, 1, 1)
+            }
+            else {
+                index[index_pos] = px;
+                if ((px & 0xff000000) == (px_prev & 0xff000000)) {
+                    signed char vr = (uint8_t)px - (uint8_t)px_prev; //px.rgba.r - px_prev.rgba.r;
+                    signed char vg = (uint8_t)(px >> 8) - (uint8_t)(px_prev >> 8); //px.rgba.g - px_prev.rgba.g;
+                    signed char vb = (uint8_t)(px >> 16) - (uint8_t)(px_prev >> 16); //px.rgba.b - px_prev.rgba.b;
+
+                    signed char vg_r = vr - vg;
+                    signed char vg_b = vb - vg;
+
+                    if (
+                        vr > -3 && vr < 2 &&
+                        vg > -3 && vg < 2 &&
+                        vb > -3 && vb < 2
+                    ) {
+                        *d++ = SLIC_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                        SLIC_STAT(pState, SLIC_STAT_DIFF, 1, 1, 1)
+                    }
+                    else if (
+                        vg_r >  -9 && vg_r <  8 &&
+                        vg   > -33 && vg   < 32 &&
+                        vg_b >  -9 && vg_b <  8
+                    ) {
+                        *d++ = SLIC_OP_LUMA     | (vg   + 32);
+                        *d++ = (vg_r + 8) << 4 | (vg_b +  8);
+                        SLIC_STAT(pState, SLIC_STAT_LUMA, 1, 2, 1)
+                    }
+                    else {
+                        if (d != pStored || bad_run == 256 || !(pState->flags & SLIC_FLAG_STORED)) {
+                            *d++ = SLIC_OP_RGB;
+                            bad_run = 1;
+                            SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 4, 1)
+                        } else if (bad_run == 1) {
+                            // a second RGB pixel in a row; turn the last RGB op into a
+                            // stored block, which costs the same for 2 and less after that
+                            d[0] = d[-1];
+                            d[-1] = d[-2];
+                            d[-2] = d[-3];
+                            d[-3] = 1; // count - 1
+                            d[-4] = SLIC_OP_STORED;
+                            d++;
+                            bad_run = 2;
+                            SLIC_STAT(pState, SLIC_STAT_LITERAL, 0, 4, 1) // 2 header bytes instead of 1
+                        } else {
+                            d[-1 - bad_run*3]++; // add this pixel to the block
+                            bad_run++;
+                            SLIC_STAT(pState, SLIC_STAT_LITERAL, 0, 3, 1)
+                        }
+#ifdef UNALIGNED_ALLOWED
+                        *(uint32_t *)d = px;
+                        d += 3;
+#else
+                        *d++ = (uint8_t)px;
+                        *d++ = (uint8_t)(px >> 8);
+                        *d++ = (uint8_t)(px >> 16);
+#endif
+                        pStored = d;
+                    }
                 }
-                if (run > 0) {
-                    *d++ = SLIC_OP_RUN8 | (run - 1);
-                    run = 0;
+                else {
+                    *d++ = SLIC_OP_RGBA;
+                    SLIC_STAT(pState, SLIC_STAT_RGBA, 1, 5, 1)
+#ifdef UNALIGNED_ALLOWED
+                    *(uint32_t *)d = px;
+                    d += 4;
+#else
+                    *d++ = (uint8_t)px;
+                    *d++ = (uint8_t)(px >> 8);
+                    *d++ = (uint8_t)(px >> 16);
+                    *d++ = (uint8_t)(px >> 24);
+#endif
                 }
-                if (s == pEnd && pState->iPixelCount != 0) {
-                    // We're out of input on this run, but still have more pixels before the image is finished. Stop here and let it test this pair of pixels on the next call
-                    pState->extra_pixel = 1;
-                    goto exit_8bit; // save state and leave
+            }
+        }
+        px_prev = px;
+    }
+#ifdef SLIC_MATCH
+    if (pWin)
+        slic_window_add(&pWin->window, pSync, (int)((pEnd - pSync) / iBpp), iBpp, alpha, pWin);
+#endif
+    if (pState->iPixelCount == 0) { // clean up any remaining repeats
+        SLIC_STAT_RUN(pState, run, iMaxRun)
+        d = slic_store_run(d, run, iMaxRun);
+        run = 0;
+        slic_finish_encode(pState, d);
+    }
+    pState->curr_pixel = px;
+    pState->prev_pixel = px_prev;
+    pState->pOutPtr = d;
+    pState->run = run;
+    pState->bad_run = (d == pStored) ? bad_run : 0;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_rgb() */
+#ifdef SLIC_ALPHA_STRIPS
+//
+// Encode a plane of 8-bit values (e.g. the alpha channel of a strip) with the
+// 8-bit ops. All of the values are available, so unlike the grayscale encoder
+// there's no need to save a pixel pair between calls. The values are iStride
+// bytes apart. Returns the new output pointer or NULL if the output is full.
+//
+static uint8_t * slic_encode_plane8(SLICSTATE *pState, uint8_t *d, const uint8_t *s, int iCount, int iStride, uint8_t *pPrev, uint8_t *index8)
+{
+    int run = 0, bad_run = 0, prev_op = -1, index_pos, index_next, d0, d1;
+    uint8_t px, px_next, px_prev = *pPrev;
+    const uint8_t *pEnd = &s[iCount * iStride];
+    const uint8_t *pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+
+    while (s < pEnd) {
+        if (d >= pDstEnd) {
+            if (!pState->pfnWrite)
+                return NULL;
+            d = dump_encoded_data(pState, d);
+            pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+            prev_op = -1; // can't update bad_run count once written
+        }
+        px = *s;
+        s += iStride;
+        if (px == px_prev) {
+            run++;
+            prev_op = SLIC_OP_RUN8;
+            continue;
+        }
+        if (run) {
+            d = slic_store_run8(d, run, 62);
+            run = 0;
+        }
+        index_pos = SLIC_GRAY_HASH(px);
+        if (s < pEnd) { // try to code a pair
+            px_next = *s;
+            index_next = SLIC_GRAY_HASH(px_next);
+            if (index8[index_pos] == px && index8[index_next] == px_next) {
+                *d++ = SLIC_OP_INDEX8 | index_pos | (index_next << 3);
+                s += iStride;
+                px_prev = px_next;
+                prev_op = SLIC_OP_INDEX8;
+                continue;
+            }
+            d0 = px - px_prev;
+            d1 = px_next - px;
+            if (d0 > -5 && d0 < 4 && d1 > -5 && d1 < 4) {
+                index8[index_pos] = px;
+                index8[index_next] = px_next;
+                *d++ = SLIC_OP_DIFF8 | (d0 + 4) | ((d1 + 4) << 3);
+                s += iStride;
+                px_prev = px_next;
+                prev_op = SLIC_OP_DIFF8;
+                continue;
+            }
+        }
+        index8[index_pos] = px;
+        if (prev_op == SLIC_OP_BADRUN8 && bad_run < 64) {
+            bad_run++; // add this bad pixel to an existing run
+            *d++ = px;
+            d[-bad_run -1]++;
+        } else { // start a new run of bad pixels
+            *d++ = SLIC_OP_BADRUN8 | 0;
+            *d++ = px;
+            bad_run = 1;
+            prev_op = SLIC_OP_BADRUN8;
+        }
+        px_prev = px;
+    }
+    *pPrev = px_prev;
+    return slic_store_run8(d, run, 62); // runs don't continue into the next plane
+} /* slic_encode_plane8() */
+//
+// Encode 32-bpp pixels a strip at a time; each strip starts with its alpha
+// plane and is followed by the RGB ops of its pixels (coded as opaque). RGB
+// runs end with the strip so that the decoder always finds the next alpha
+// plane where it expects it.
+//
+static int slic_encode_strips(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int n, rc = SLIC_SUCCESS;
+    slic_size_t iLeft = pState->iPixelCount; // pixels after this call
+    uint8_t *pStrip = pState->pStrip;
+    uint8_t *d;
+
+    while (iPixelCount) {
+        n = SLIC_ALPHA_STRIP_SIZE - pState->strip_len;
+        if (n > iPixelCount)
+            n = iPixelCount;
+        memcpy(&pStrip[pState->strip_len * 4], s, n * 4);
+        s += n * 4;
+        iPixelCount -= n;
+        pState->strip_len += n;
+        if (pState->strip_len < SLIC_ALPHA_STRIP_SIZE && (iPixelCount || iLeft))
+            break; // wait for the rest of the strip
+#ifdef SLIC_STATS
+        slic_size_t iStart = pState->iOffset + (slic_size_t)(pState->pOutPtr - pState->pOutBuffer); // the plane may be written out
+#endif
+        d = slic_encode_plane8(pState, pState->pOutPtr, &pStrip[3], pState->strip_len, 4, &pState->alpha_prev, pState->alpha_index);
+        if (d == NULL)
+            return SLIC_ENCODE_OVERFLOW;
+        SLIC_STAT(pState, SLIC_STAT_ALPHA, 1, (int)(pState->iOffset + (slic_size_t)(d - pState->pOutBuffer) - iStart), pState->strip_len)
+        pState->pOutPtr = d;
+        pState->iPixelCount = iLeft + iPixelCount; // the RGB encoder finishes the image when this is 0
+        rc = slic_encode_rgb(pState, pStrip, pState->strip_len);
+        if (rc == SLIC_ENCODE_OVERFLOW)
+            return rc;
+        if (pState->run) { // end the run with the strip
+            SLIC_STAT_RUN(pState, pState->run, slic_max_run(pState))
+            pState->pOutPtr = slic_store_run(pState->pOutPtr, pState->run, slic_max_run(pState));
+            pState->run = 0;
+        }
+        pState->bad_run = 0; // and the stored block
+        pState->strip_len = 0;
+    }
+    pState->iPixelCount = iLeft;
+    return (iLeft == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_strips() */
+#endif // SLIC_ALPHA_STRIPS
+//
+// Encode 8-bit grayscale/palette pixels, or the bytes of packed 1/2/4-bpp pixels
+//
+static int slic_encode_gray8(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int run, bad_run, prev_op, iMaxRun, bGradient;
+    uint8_t *d, px8, px8_prev, px8_next;
+    const uint8_t *pEnd, *pDstEnd;
+    uint8_t *index8 = (uint8_t *)pState->index;
+
+    run = pState->run;
+    d = pState->pOutPtr;
+    bad_run = pState->bad_run;
+    prev_op = pState->prev_op;
+    bGradient = (pState->flags & SLIC_FLAG_GRADIENT);
+    iMaxRun = bGradient ? 61 : 62;
+    pEnd = &s[iPixelCount];
+    pDstEnd = &pState->pOutBuffer[pState->iOutSize-16]; // leave extra bytes for a run + multi-byte ops
+    px8 = (uint8_t)pState->curr_pixel;
+    px8_prev = (uint8_t)pState->prev_pixel;
+    if (pState->extra_pixel) {
+        pState->extra_pixel = 0;
+        px8_next = s[0];
+        goto restart_8bit; // try again
+    }
+    while (s < pEnd) {
+        if (d >= pDstEnd) {
+            if (pState->pfnWrite) {
+                SLIC_STAT_SPLIT(pState, prev_op == SLIC_OP_BADRUN8 && bad_run < 64)
+                d = dump_encoded_data(pState, d);
+                pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+                bad_run = 0; // can't update bad_run count once written
+                prev_op = -1;
+            } else {
+                return SLIC_ENCODE_OVERFLOW;
+            }
+        }
+        px8 = *s++;
+        px8_next = s[0];
+        if (px8 == px8_prev) {
+            // skip through the rest of the run (e.g. blank areas of packed images)
+            int n = (int)(pEnd - s);
+            if (n > 1023 - run)
+                n = 1023 - run;
+            n = (*slic_get_kernels()->pfnScan)(s, n, (uint32_t)px8 * 0x01010101);
+            s += n;
+            run += n;
+            if (++run >= 1024) { // don't let the pending run get too long to store
+                *d++ = SLIC_OP_RUN8_1024;
+                run -= 1024;
+                SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, 1024)
+            }
+            prev_op = SLIC_OP_RUN8;
+        }
+        else {
+            int index_pos, index_next;
+            if (run > 0) {
+                SLIC_STAT_RUN(pState, run, iMaxRun)
+                d = slic_store_run8(d, run, iMaxRun);
+                run = 0;
+            }
+            if (bGradient && s < pEnd && (uint8_t)(px8_next - px8) == (uint8_t)(px8 - px8_prev)) {
+                uint8_t delta = px8 - px8_prev;
+                int n = slic_ramp_len8(s, pEnd, px8, delta);
+                // 3 bytes instead of a DIFF8 op per pair or a literal per pixel
+                if (n >= (((uint8_t)(delta + 4) < 8) ? 7 : 4)) {
+                    *d++ = SLIC_OP_GRADIENT8;
+                    *d++ = (uint8_t)(n - 1);
+                    *d++ = delta;
+                    s += n - 1; // the ramp's pixels don't go in the cache
+                    px8_prev = px8 = s[-1];
+                    prev_op = SLIC_OP_GRADIENT8;
+                    SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, 3, n)
+                    continue;
                 }
+            }
+            if (s == pEnd && pState->iPixelCount != 0) {
+                // We're out of input on this run, but still have more pixels before the image is finished. Stop here and let it test this pair of pixels on the next call
+                pState->extra_pixel = 1;
+                goto exit_8bit; // save state and leave
+            }
 // Entry point to retry compressing the last pixel as a pair with the current
 restart_8bit:
-                index_pos = SLIC_GRAY_HASH(px8);
-                index_next = SLIC_GRAY_HASH(px8_next);
-                if (index8[index_pos] == px8 && index8[index_next] == px8_next && s < pEnd) {
-                    // store the pair as indices
-                    *d++ = SLIC_OP_INDEX8 | (index_pos | (index_next <<3));
+            index_pos = SLIC_GRAY_HASH(px8);
+            index_next = SLIC_GRAY_HASH(px8_next);
+            if (index8[index_pos] == px8 && index8[index_next] == px8_next && s < pEnd) {
+                // store the pair as indices
+                *d++ = SLIC_OP_INDEX8 | (index_pos | (index_next <<3));
+                s++; // count the next pixel too
+                px8 = px8_next; // skipped ahead 1 pixel
+                prev_op = SLIC_OP_INDEX8;
+                SLIC_STAT(pState, SLIC_STAT_INDEX, 1, 1, 2)
+            } else { // try to do a pair of differences
+                int d0, d1;
+                
+                index8[index_pos] = px8;
+                d0 = px8 - px8_prev;
+                d1 = px8_next - px8;
+                if (d0 > -5 && d0 < 4 && d1 > -5 && d1 < 4 && s < pEnd) {
+                    d0 += 4; d1 += 4;
+                    *d++ = SLIC_OP_DIFF8 | (d0 | (d1 << 3));
+                    index8[index_next] = px8_next; // we worked on a pair of pixels
                     s++; // count the next pixel too
                     px8 = px8_next; // skipped ahead 1 pixel
-                    prev_op = SLIC_OP_INDEX8;
-                } else { // try to do a pair of differences
-                    int d0, d1;
-                    
-                    index8[index_pos] = px8;
-                    d0 = px8 - px8_prev;
-                    d1 = px8_next - px8;
-                    if (d0 > -5 && d0 < 4 && d1 > -5 && d1 < 4) {
-                        d0 += 4; d1 += 4;
-                        *d++ = SLIC_OP_DIFF8 | (d0 | (d1 << 3));
-                        index8[index_next] = px8_next; // we worked on a pair of pixels
-                        s++; // count the next pixel too
-                        px8 = px8_next; // skipped ahead 1 pixel
-                        prev_op = SLIC_OP_DIFF8;
-                    } else { // last resort - 'bad' pixels
-                        if (prev_op == SLIC_OP_BADRUN8 && bad_run < 64) {
-                            bad_run++; // add this bad pixel to an existing run
-                            *d++ = px8;
-                            d[-bad_run -1]++;
-                        } else { // start a new run of bad pixels
-                            *d++ = SLIC_OP_BADRUN8 | 0;
-                            *d++ = px8;
-                            bad_run = 1;
-                            prev_op = SLIC_OP_BADRUN8;
-                        }
+                    prev_op = SLIC_OP_DIFF8;
+                    SLIC_STAT(pState, SLIC_STAT_DIFF, 1, 1, 2)
+                } else { // last resort - 'bad' pixels
+                    if (prev_op == SLIC_OP_BADRUN8 && bad_run < 64) {
+                        bad_run++; // add this bad pixel to an existing run
+                        *d++ = px8;
+                        d[-bad_run -1]++;
+                        SLIC_STAT(pState, SLIC_STAT_LITERAL, 0, 1, 1)
+                    } else { // start a new run of bad pixels
+                        *d++ = SLIC_OP_BADRUN8 | 0;
+                        *d++ = px8;
+                        bad_run = 1;
+                        prev_op = SLIC_OP_BADRUN8;
+                        SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 2, 1)
                     }
                 }
             }
-            px8_prev = px8;
-        } // for each pixel
-        if (pState->iPixelCount == 0) { // wrap up last repeats
-            while (run >= 1024) {
-                *d++ = SLIC_OP_RUN8_1024;
-                run -= 1024;
-            }
-            while (run >= 256) {
-                *d++ = SLIC_OP_RUN8_256;
-                run -= 256;
+        }
+        px8_prev = px8;
+    } // for each pixel
+    if (pState->iPixelCount == 0) { // wrap up last repeats
+        SLIC_STAT_RUN(pState, run, iMaxRun)
+        d = slic_store_run8(d, run, iMaxRun);
+        run = 0;
+        slic_finish_encode(pState, d);
+    }
+    // save state
+exit_8bit:
+    pState->curr_pixel = px8;
+    pState->prev_pixel = px8_prev;
+    pState->pOutPtr = d;
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->prev_op = prev_op;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_gray8() */
+//
+// Encode RGB565 pixels
+//
+static int slic_encode_rgb565(SLICSTATE *pState, uint8_t *s, int iPixelCount)
+{
+    int run, bad_run, prev_op, iMaxRun, bGradient;
+    uint8_t *d;
+    const uint8_t *pDstEnd;
+    uint16_t px16, px16_prev, px16_next;
+    uint16_t *index16, *s16, *pEnd16;
+
+    run = pState->run;
+    d = pState->pOutPtr;
+    bad_run = pState->bad_run;
+    prev_op = pState->prev_op;
+    bGradient = (pState->flags & SLIC_FLAG_GRADIENT);
+    iMaxRun = bGradient ? 61 : 62;
+    pDstEnd = &pState->pOutBuffer[pState->iOutSize-16]; // leave extra bytes for a run + multi-byte ops
+    index16 = (uint16_t *)pState->index;
+    s16 = (uint16_t *)s;
+    pEnd16 = &s16[iPixelCount];
+    px16 = (uint16_t)pState->curr_pixel;
+    px16_prev = (uint16_t)pState->prev_pixel;
+    if (pState->extra_pixel) {
+        pState->extra_pixel = 0;
+        px16_next = s16[0];
+        goto restart_rgb565; // try again
+    }
+    while (s16 < pEnd16) {
+        if (d >= pDstEnd) {
+            if (pState->pfnWrite) {
+                SLIC_STAT_SPLIT(pState, prev_op == SLIC_OP_BADRUN16 && bad_run < 64)
+                d = dump_encoded_data(pState, d);
+                pDstEnd = &pState->pOutBuffer[pState->iOutSize-16];
+                bad_run = 0; // can't update bad_run count once written
+                prev_op = -1;
+            } else {
+                return SLIC_ENCODE_OVERFLOW;
             }
-            while (run >= 62) {
-                *d++ = SLIC_OP_RUN8 | 61;
-                run -= 61;
+        }
+        px16 = *s16++;
+        px16_next = s16[0];
+        if (px16 == px16_prev) {
+            int n = (int)(pEnd16 - s16);
+            if (n > 1023 - run)
+                n = 1023 - run;
+            n = (*slic_get_kernels()->pfnScan)((const uint8_t *)s16, n * 2, (uint32_t)px16 * 0x10001) >> 1;
+            s16 += n;
+            run += n;
+            if (++run == 1024) { // don't let the pending run get too long to store
+                *d++ = SLIC_OP_RUN16_1024;
+                run = 0;
+                SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, 1024)
             }
+            prev_op = SLIC_OP_RUN16;
+        }
+        else {
+            int index_pos, index_next;
             if (run > 0) {
-                *d++ = SLIC_OP_RUN8 | (run - 1);
+                SLIC_STAT_RUN(pState, run, iMaxRun)
+                d = slic_store_run8(d, run, iMaxRun);
                 run = 0;
             }
-            // If using a write callback, flush the last of the data
-            if (pState->pfnWrite) {
-                (*pState->pfnWrite)(&pState->file, pState->pOutBuffer, (int)(d - pState->pOutBuffer));
-            } else  {
-                pState->iOffset = (int)(d - pState->pOutBuffer);
-            }
-        }
-        // save state
-exit_8bit:
-        pState->curr_pixel = px8;
-        pState->prev_pixel = px8_prev;
-        pState->pOutPtr = d;
-        pState->run = run;
-        pState->bad_run = bad_run;
-        pState->prev_op = prev_op;
-        return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
-    } // grayscale (channels == 1)
-    
-    else if (iBpp == 2) { // RGB565
-        index16 = (uint16_t *)pState->index;
-        s16 = (uint16_t *)s;
-        pEnd16 = (uint16_t *)pEnd;
-        px16 = (uint16_t)pState->curr_pixel;
-        px16_prev = (uint16_t)pState->prev_pixel;
-        if (pState->extra_pixel) {
-            pState->extra_pixel = 0;
-            px16_next = s16[0];
-            goto restart_rgb565; // try again
-        }
-        while (s16 < pEnd16) {
-            if (d >= pDstEnd) {
-                if (pState->pfnWrite) {
-                    d = dump_encoded_data(pState, d);
-                    bad_run = 0; // can't update bad_run count once written
-                } else {
-                    return SLIC_ENCODE_OVERFLOW;
+            if (bGradient && s16 < pEnd16) {
+                int dr = (px16 >> 11) - (px16_prev >> 11);
+                int dg = ((px16 >> 5) & 0x3f) - ((px16_prev >> 5) & 0x3f);
+                int db = (px16 & 0x1f) - (px16_prev & 0x1f);
+                uint16_t delta = (uint16_t)(((dr & 0x1f) << 11) | ((dg & 0x3f) << 5) | (db & 0x1f));
+
+                if (px16_next == (uint16_t)SLIC_ADD_565(px16, delta)) {
+                    int n = slic_ramp_len565(s16, pEnd16, px16, delta);
+                    // 4 bytes instead of a DIFF16 op or a literal per pixel
+                    if (n >= ((dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) ? 5 : 3)) {
+                        *d++ = SLIC_OP_GRADIENT16;
+                        *d++ = (uint8_t)(n - 1);
+                        *d++ = (uint8_t)delta;
+                        *d++ = (uint8_t)(delta >> 8);
+                        s16 += n - 1; // the ramp's pixels don't go in the cache
+                        px16_prev = px16 = s16[-1];
+                        prev_op = SLIC_OP_GRADIENT16;
+                        SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, 4, n)
+                        continue;
+                    }
                 }
             }
-            px16 = *s16++;
-            px16_next = s16[0];
-            if (px16 == px16_prev) {
-                run++;
-                prev_op = SLIC_OP_RUN16;
+            if (s16 == pEnd16 && pState->iPixelCount != 0) {
+                // We're out of input on this run, but still have more pixels before the image is finished. Stop here and let it test this pair of pixels on the next call
+                pState->extra_pixel = 1;
+                goto exit_rgb565; // save state and leave
             }
-            else {
-                int index_pos, index_next;
-                while (run >= 1024) {
-                    *d++ = SLIC_OP_RUN16_1024;
-                    run -= 1024;
-                }
-                while (run >= 256) {
-                    *d++ = SLIC_OP_RUN16_256;
-                    run -= 256;
-                }
-                while (run >= 62) {
-                    *d++ = SLIC_OP_RUN16 | 61;
-                    run -= 62;
-                }
-                if (run > 0) {
-                    *d++ = SLIC_OP_RUN16 | (run - 1);
-                    run = 0;
-                }
-                if (s16 == pEnd16 && pState->iPixelCount != 0) {
-                    // We're out of input on this run, but still have more pixels before the image is finished. Stop here and let it test this pair of pixels on the next call
-                    pState->extra_pixel = 1;
-                    goto exit_rgb565; // save state and leave
-                }
 // Entry point to retry compressing the last pixel as a pair with the current
 restart_rgb565:
-                index_pos = SLIC_RGB565_HASH(px16);
-                index_next = SLIC_RGB565_HASH(px16_next);
-                if (index16[index_pos] == px16 && index16[index_next] == px16_next && s16 < pEnd16) {
-                    // store the pair as indices (if we can access the second pixel)
-                    *d++ = SLIC_OP_INDEX16 | (index_pos | (index_next <<3));
-                    s16++; // count the next pixel too
-                    px16 = px16_next; // skipped ahead 1 pixel
-                    prev_op = SLIC_OP_INDEX16;
-                } else { // try to do a difference from prev pixel
-                    int dr, dg, db;
-                    
-                    index16[index_pos] = px16;
-                    dr = (px16 >> 11) - (px16_prev >> 11);
-                    dg = ((px16 >> 5) & 0x3f) - ((px16_prev >> 5) & 0x3f);
-                    db = (px16 & 0x1f) - (px16_prev & 0x1f);
-                    if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
-                        *d++ = SLIC_OP_DIFF16 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
-                        prev_op = SLIC_OP_DIFF16;
-                    } else { // last resort - 'bad' pixels
-                        if (prev_op == SLIC_OP_BADRUN16 && bad_run < 64) {
-                            bad_run++; // add this bad pixel to an existing run
-                            *d++ = (uint8_t)px16;
-                            *d++ = (uint8_t)(px16 >> 8);
-                            d[-1-(bad_run*2)]++;
-                        } else { // start a new run of bad pixels
-                            *d++ = SLIC_OP_BADRUN16 | 0;
-                            *d++ = (uint8_t)px16;
-                            *d++ = (uint8_t)(px16 >> 8);
-                            bad_run = 1;
-                            prev_op = SLIC_OP_BADRUN16;
+            index_pos = SLIC_RGB565_HASH(px16);
+            index_next = SLIC_RGB565_HASH(px16_next);
+            if (index16[index_pos] == px16 && index16[index_next] == px16_next && s16 < pEnd16) {
+                // store the pair as indices (if we can access the second pixel)
+                *d++ = SLIC_OP_INDEX16 | (index_pos | (index_next <<3));
+                s16++; // count the next pixel too
+                px16 = px16_next; // skipped ahead 1 pixel
+                prev_op = SLIC_OP_INDEX16;
+                SLIC_STAT(pState, SLIC_STAT_INDEX, 1, 1, 2)
+            } else { // try to do a difference from prev pixel
+                int dr, dg, db;
+                
+                index16[index_pos] = px16;
+                dr = (px16 >> 11) - (px16_prev >> 11);
+                dg = ((px16 >> 5) & 0x3f) - ((px16_prev >> 5) & 0x3f);
+                db = (px16 & 0x1f) - (px16_prev & 0x1f);
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    *d++ = SLIC_OP_DIFF16 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                    prev_op = SLIC_OP_DIFF16;
+                    SLIC_STAT(pState, SLIC_STAT_DIFF, 1, 1, 1)
+                } else { // last resort - 'bad' pixels
+                    if (prev_op == SLIC_OP_BADRUN16 && bad_run < 64) {
+                        bad_run++; // add this bad pixel to an existing run
+                        *d++ = (uint8_t)px16;
+                        *d++ = (uint8_t)(px16 >> 8);
+                        d[-1-(bad_run*2)]++;
+                        SLIC_STAT(pState, SLIC_STAT_LITERAL, 0, 2, 1)
+                    } else { // start a new run of bad pixels
+                        *d++ = SLIC_OP_BADRUN16 | 0;
+                        *d++ = (uint8_t)px16;
+                        *d++ = (uint8_t)(px16 >> 8);
+                        bad_run = 1;
+                        prev_op = SLIC_OP_BADRUN16;
+                        SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 3, 1)
+                    }
+                }
+            }
+        }
+        px16_prev = px16;
+    } // for each pixel
+    if (pState->iPixelCount == 0) { // wrap up any remaining repeats
+        SLIC_STAT_RUN(pState, run, iMaxRun)
+        d = slic_store_run8(d, run, iMaxRun);
+        run = 0;
+        slic_finish_encode(pState, d);
+    }
+    // save state
+exit_rgb565:
+    pState->curr_pixel = px16;
+    pState->prev_pixel = px16_prev;
+    pState->pOutPtr = d;
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->prev_op = prev_op;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_encode_rgb565() */
+//
+// The coder of an image's pixels (or of the bytes of packed ones); the count
+// has already been taken from the image
+//
+typedef int (SLIC_PIXEL_CODER)(SLICSTATE *pState, uint8_t *s, int iCount);
+
+static SLIC_PIXEL_CODER *slic_pixel_coder(SLICSTATE *pState)
+{
+    if (pState->colorspace == SLIC_GRAYALPHA)
+        return slic_encode_ga8;
+#ifdef SLIC_HIGH_BIT_DEPTH
+    if (pState->colorspace == SLIC_GRAY16)
+        return slic_encode_gray16;
+    if (pState->bpp > 32)
+        return slic_encode_rgb64;
+#endif
+    if (pState->bpp <= 8) // grayscale, 8-bit palette or packed 1/2/4-bpp image
+        return slic_encode_gray8;
+    if (pState->bpp == 16)
+        return slic_encode_rgb565;
+#ifdef SLIC_ALPHA_STRIPS
+    if (pState->flags & SLIC_FLAG_ALPHA_PLANE)
+        return slic_encode_strips;
+#endif
+    return slic_encode_rgb;
+} /* slic_pixel_coder() */
+//
+// Encode the pixels of a slic_encode() call with pfnCode; the header has
+// been written
+//
+static int slic_encode_pixels(SLICSTATE *pState, uint8_t *s, int iPixelCount, SLIC_PIXEL_CODER *pfnCode) {
+    if (pState->bpp < 8) { // packed pixels are encoded as bytes
+        iPixelCount = slic_packed_bytes(pState, iPixelCount);
+        if (iPixelCount < 1)
+            return SLIC_INVALID_PARAM;
+    }
+    iPixelCount = slic_take_pixels(pState, iPixelCount);
+    return (*pfnCode)(pState, s, iPixelCount);
+} /* slic_encode_pixels() */
+//
+// Near-lossless encoding (SLIC_OPTION_TOLERANCE) changes the pixels, a chunk
+// at a time, into ones which the lossless coders store in fewer bytes: the
+// pixel before (to extend a run), a small step from it or a color in the
+// cache. Each choice is measured against the original pixel, not the one
+// before it, so the error can't add up along a row. The choices follow a copy
+// of the cache, and the file is an ordinary one for the decoder.
+//
+// Move channel value v to a step of lo to hi from prev; returns -1 if that's
+// more than the tolerance away from v
+//
+static int slic_near_step(int v, int prev, int lo, int hi, int iTol, int iMax)
+{
+    int d = v - prev;
+
+    if (d < lo)
+        d = lo;
+    else if (d > hi)
+        d = hi;
+    d += prev;
+    if (d < 0 || d > iMax || d - v > iTol || v - d > iTol)
+        return -1;
+    return d;
+} /* slic_near_step() */
+//
+// Largest channel difference of two RGB565 or RGB(A) pixels
+//
+static int slic_near_error565(uint16_t a, uint16_t b)
+{
+    int e, e1;
+
+    e = abs((a >> 11) - (b >> 11));
+    e1 = abs(((a >> 5) & 0x3f) - ((b >> 5) & 0x3f));
+    if (e1 > e)
+        e = e1;
+    e1 = abs((a & 0x1f) - (b & 0x1f));
+    return (e1 > e) ? e1 : e;
+} /* slic_near_error565() */
+
+static int slic_near_error(uint32_t a, uint32_t b)
+{
+    int i, e = 0, e1;
+
+    for (i=0; i<24; i+=8) {
+        e1 = abs((int)((a >> i) & 0xff) - (int)((b >> i) & 0xff));
+        if (e1 > e)
+            e = e1;
+    }
+    return e;
+} /* slic_near_error() */
+
+static void slic_near_gray8(SLICSTATE *pState, const uint8_t *s, uint8_t *d, int iCount)
+{
+    uint8_t index8[8];
+    int i, j, v, px, e, iErr, iTol = pState->tolerance;
+
+    memcpy(index8, pState->index, sizeof(index8));
+    px = (uint8_t)pState->curr_pixel;
+    for (i=0; i<iCount; i++) {
+        v = s[i];
+        if (abs(v - px) > iTol) { // not a run
+            if (index8[SLIC_GRAY_HASH(v)] != v) {
+                j = slic_near_step(v, px, -4, 3, iTol, 255);
+                if (j >= 0) {
+                    v = j;
+                } else { // the closest value in the cache
+                    iErr = iTol + 1;
+                    for (j=0; j<8; j++) {
+                        e = abs(index8[j] - s[i]);
+                        if (e < iErr && SLIC_GRAY_HASH(index8[j]) == j) {
+                            iErr = e;
+                            v = index8[j];
                         }
                     }
                 }
             }
-            px16_prev = px16;
-        } // for each pixel
-        if (pState->iPixelCount == 0) { // wrap up any remaining repeats
-            while (run >= 1024) {
-                *d++ = SLIC_OP_RUN16_1024;
-                run -= 1024;
-            }
-            while (run >= 256) {
-                *d++ = SLIC_OP_RUN16_256;
-                run -= 256;
+            px = v;
+            index8[SLIC_GRAY_HASH(px)] = (uint8_t)px;
+        }
+        d[i] = (uint8_t)px;
+    }
+} /* slic_near_gray8() */
+
+static void slic_near_rgb565(SLICSTATE *pState, const uint8_t *s, uint8_t *d, int iCount)
+{
+    uint16_t index16[8], v, px;
+    int i, j, r, g, b, e, iErr, iTol = pState->tolerance;
+
+    memcpy(index16, pState->index, sizeof(index16));
+    px = (uint16_t)pState->curr_pixel;
+    for (i=0; i<iCount; i++, s+=2, d+=2) {
+        v = (uint16_t)(s[0] | (s[1] << 8));
+        if (slic_near_error565(v, px) > iTol) {
+            if (index16[SLIC_RGB565_HASH(v)] != v) {
+                r = slic_near_step(v >> 11, px >> 11, -2, 1, iTol, 31);
+                g = slic_near_step((v >> 5) & 0x3f, (px >> 5) & 0x3f, -2, 1, iTol, 63);
+                b = slic_near_step(v & 0x1f, px & 0x1f, -2, 1, iTol, 31);
+                if (r >= 0 && g >= 0 && b >= 0) {
+                    v = (uint16_t)((r << 11) | (g << 5) | b);
+                } else {
+                    iErr = iTol + 1;
+                    for (j=0; j<8; j++) {
+                        e = slic_near_error565(index16[j], (uint16_t)(s[0] | (s[1] << 8)));
+                        if (e < iErr && SLIC_RGB565_HASH(index16[j]) == j) {
+                            iErr = e;
+                            v = index16[j];
+                        }
+                    }
+                }
+            }
+            px = v;
+            index16[SLIC_RGB565_HASH(px)] = px;
+        }
+        d[0] = (uint8_t)px;
+        d[1] = (uint8_t)(px >> 8);
+    }
+} /* slic_near_rgb565() */
+//
+// 24/32-bpp pixels try the DIFF op, the cache and then the LUMA op; the
+// alpha is never changed
+//
+static uint32_t slic_near_pixel(uint32_t v, uint32_t px, const uint32_t *index, int iTol)
+{
+    int j, r, g, b, e, iErr;
+    uint32_t u32, best = v;
+
+    if (((v ^ px) & 0xff000000) == 0) {
+        r = slic_near_step(v & 0xff, px & 0xff, -2, 1, iTol, 255);
+        g = slic_near_step((v >> 8) & 0xff, (px >> 8) & 0xff, -2, 1, iTol, 255);
+        b = slic_near_step((v >> 16) & 0xff, (px >> 16) & 0xff, -2, 1, iTol, 255);
+        if (r >= 0 && g >= 0 && b >= 0)
+            return (v & 0xff000000) | ((uint32_t)b << 16) | (g << 8) | r;
+    }
+    iErr = iTol + 1;
+    for (j=0; j<64; j++) {
+        u32 = index[j];
+        e = slic_near_error(u32, v);
+        if (e < iErr && ((u32 ^ v) & 0xff000000) == 0 && SLIC_RGB_HASH(u32) == (uint32_t)j) {
+            iErr = e;
+            best = u32;
+        }
+    }
+    if (iErr <= iTol)
+        return best;
+    if (((v ^ px) & 0xff000000) == 0) { // green -32 to 31, red and blue within -8 to 7 of it
+        g = slic_near_step((v >> 8) & 0xff, (px >> 8) & 0xff, -32, 31, iTol, 255);
+        if (g >= 0) {
+            e = g - (int)((px >> 8) & 0xff);
+            r = slic_near_step(v & 0xff, px & 0xff, e - 8, e + 7, iTol, 255);
+            b = slic_near_step((v >> 16) & 0xff, (px >> 16) & 0xff, e - 8, e + 7, iTol, 255);
+            if (r >= 0 && b >= 0)
+                return (v & 0xff000000) | ((uint32_t)b << 16) | (g << 8) | r;
+        }
+    }
+    return v; // a literal; it might as well be exact
+} /* slic_near_pixel() */
+
+static void slic_near_rgb(SLICSTATE *pState, const uint8_t *s, uint8_t *d, int iCount)
+{
+    uint32_t index[64], v, px, alpha;
+    int i, iBpp = pState->bpp >> 3, iTol = pState->tolerance;
+
+    // same as slic_encode_rgb(): the pixels are compared as opaque when the
+    // alpha is stored elsewhere
+    alpha = (iBpp == 3 || (pState->flags & (SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA))) ? 0xff000000 : 0;
+    memcpy(index, pState->index, sizeof(index));
+    px = pState->curr_pixel;
+    for (i=0; i<iCount; i++, s+=iBpp, d+=iBpp) {
+        v = s[0] | (s[1] << 8) | ((uint32_t)s[2] << 16) | alpha;
+        if (iBpp == 4)
+            v |= (uint32_t)s[3] << 24;
+        if (((v ^ px) & 0xff000000) || slic_near_error(v, px) > iTol) {
+            if (index[SLIC_RGB_HASH(v)] != v)
+                v = slic_near_pixel(v, px, index, iTol);
+            px = v;
+            index[SLIC_RGB_HASH(px)] = px;
+        }
+        d[0] = (uint8_t)px;
+        d[1] = (uint8_t)(px >> 8);
+        d[2] = (uint8_t)(px >> 16);
+        if (iBpp == 4)
+            d[3] = s[3];
+    }
+} /* slic_near_rgb() */
+//
+// Encode pixels near-losslessly, SLIC_CONVERT_CHUNK at a time
+//
+static int slic_encode_near(SLICSTATE *pState, uint8_t *s, int iPixelCount, SLIC_PIXEL_CODER *pfnCode)
+{
+    uint8_t ucTemp[SLIC_CONVERT_CHUNK * 4 + 4]; // the gray8/rgb encoders read a little past the end
+    int n, iBpp = pState->bpp >> 3, rc = SLIC_SUCCESS;
+
+    while (iPixelCount > 0 && rc == SLIC_SUCCESS) {
+        n = (iPixelCount < SLIC_CONVERT_CHUNK) ? iPixelCount : SLIC_CONVERT_CHUNK;
+        if (iBpp == 1)
+            slic_near_gray8(pState, s, ucTemp, n);
+        else if (iBpp == 2)
+            slic_near_rgb565(pState, s, ucTemp, n);
+        else
+            slic_near_rgb(pState, s, ucTemp, n);
+        rc = slic_encode_pixels(pState, ucTemp, n, pfnCode);
+        s += n * iBpp;
+        iPixelCount -= n;
+    }
+    return rc;
+} /* slic_encode_near() */
+//
+// Convert RGB(A) pixels (SLIC_OPTION_SOURCE_BPP) to the image's format and
+// encode them, SLIC_CONVERT_CHUNK at a time. Palette colors are found
+// through a small cache; a color which isn't in the palette is an error.
+// Packed pixels have to be given in whole bytes or to the end of a row.
+//
+static int slic_encode_converted(SLICSTATE *pState, uint8_t *s, int iPixelCount, SLIC_PIXEL_CODER *pfnCode)
+{
+    uint8_t ucTemp[SLIC_CONVERT_CHUNK * 4 + 4]; // the gray8/rgb encoders read a little past the end
+    uint32_t u32, ulCache[64];
+    uint8_t ucCache[64], *d;
+    const uint8_t *p;
+    int i, j, c, n, x = 0, iRowBytes = 0, iSrc = pState->source_bpp >> 3, rc = SLIC_SUCCESS;
+
+    memset(ulCache, 0xff, sizeof(ulCache)); // not a 24-bit color
+    if (pState->bpp < 8) { // x of the first pixel from the bytes done so far
+        iRowBytes = (int)(((slic_size_t)pState->width * pState->bpp + 7) >> 3);
+        x = (int)((((slic_size_t)iRowBytes * pState->height - pState->iPixelCount) % iRowBytes) * 8 / pState->bpp);
+    }
+    while (iPixelCount > 0 && rc == SLIC_SUCCESS) {
+        n = (iPixelCount < SLIC_CONVERT_CHUNK) ? iPixelCount : SLIC_CONVERT_CHUNK;
+        if (pState->bpp < 8 && n > (int)pState->width - x)
+            n = (int)pState->width - x;
+        d = ucTemp;
+        for (i=0, p=s; i<n; i++, p+=iSrc) {
+            if (pState->bpp == 16) {
+                u32 = ((p[0] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[2] >> 3);
+                *d++ = (uint8_t)u32;
+                *d++ = (uint8_t)(u32 >> 8);
+                continue;
+            }
+            if (pState->bpp == 24) {
+                d[0] = p[0]; d[1] = p[1]; d[2] = p[2];
+                d += 3;
+                continue;
+            }
+            if (pState->colorspace == SLIC_PALETTE) {
+                u32 = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+                j = ((p[0] * 3) ^ (p[1] * 5) ^ (p[2] * 7)) & 63;
+                if (ulCache[j] != u32) {
+                    for (c=0; c < (1 << pState->bpp) - 1 && memcmp(&pState->pPalette[c * 3], p, 3) != 0; c++) {};
+                    if (memcmp(&pState->pPalette[c * 3], p, 3) != 0)
+                        return SLIC_INVALID_PARAM;
+                    ulCache[j] = u32;
+                    ucCache[j] = (uint8_t)c;
+                }
+                c = ucCache[j];
+            } else { // gray; packed pixels keep the top bits
+                c = p[0] >> (8 - pState->bpp);
+            }
+            if (pState->bpp == 8) {
+                *d++ = (uint8_t)c;
+            } else { // the first pixel goes in the top bits
+                j = (i * pState->bpp) & 7;
+                if (j == 0)
+                    *d = 0;
+                *d |= (uint8_t)(c << (8 - pState->bpp - j));
+                if (j + pState->bpp == 8)
+                    d++;
+            }
+        }
+        if (pState->bpp < 8) { // encode the bytes, including a partly filled one at the end of a row
+            x += n;
+            if (x == (int)pState->width)
+                x = 0;
+            else if ((n * pState->bpp) & 7)
+                return SLIC_INVALID_PARAM;
+            i = slic_take_pixels(pState, (n * pState->bpp + 7) >> 3);
+            rc = (*pfnCode)(pState, ucTemp, i);
+        } else if (pState->tolerance) {
+            rc = slic_encode_near(pState, ucTemp, n, pfnCode);
+        } else {
+            rc = slic_encode_pixels(pState, ucTemp, n, pfnCode);
+        }
+        s += n * iSrc;
+        iPixelCount -= n;
+    }
+    return rc;
+} /* slic_encode_converted() */
+//
+// Write the CRC32C trailer after the last of the compressed data
+//
+static int slic_write_checksum(SLICSTATE *pState)
+{
+    uint8_t ucCRC[4];
+    int i;
+
+    for (i=0; i<4; i++)
+        ucCRC[i] = (uint8_t)(pState->crc >> (i*8));
+    if (pState->pfnWrite) { // the last of the data has already been written
+        SLIC_WRITE(pState, ucCRC, 4);
+    } else {
+        if (pState->iOffset + 4 > pState->iOutSize)
+            return SLIC_ENCODE_OVERFLOW;
+        memcpy(&pState->pOutBuffer[pState->iOffset], ucCRC, 4);
+        pState->pOutPtr += 4;
+    }
+    pState->iOffset += 4;
+    return SLIC_DONE;
+} /* slic_write_checksum() */
+//
+// Encode 1 or more pixels with pfnCode, the coder of the image's format.
+// slic_encode() and SLICEncoder::encode() both come through here, so the
+// options work the same way in both.
+//
+static int slic_encode_image(SLICSTATE *pState, uint8_t *s, int iPixelCount, SLIC_PIXEL_CODER *pfnCode) {
+    int rc;
+
+	if (pState == NULL || s == NULL || iPixelCount < 1)
+        return SLIC_INVALID_PARAM;
+    if (pState->iPixelCount == 0) // already finished
+        return SLIC_DONE;
+    SLIC_IO_ENTER(pState)
+    if (pState->header_pending) {
+        if (pState->flags & SLIC_FLAG_CONSTANT_ALPHA)
+            pState->alpha = s[3]; // the first pixel sets the alpha of the image
+        rc = slic_write_header(pState);
+        if (rc != SLIC_SUCCESS)
+            return rc;
+    }
+    if (pState->source_bpp)
+        rc = slic_encode_converted(pState, s, iPixelCount, pfnCode);
+    else if (pState->tolerance)
+        rc = slic_encode_near(pState, s, iPixelCount, pfnCode);
+    else
+        rc = slic_encode_pixels(pState, s, iPixelCount, pfnCode);
+    if (rc == SLIC_DONE && (pState->flags & SLIC_FLAG_CHECKSUM))
+        rc = slic_write_checksum(pState);
+    SLIC_IO_LEAVE(pState)
+    return rc;
+} /* slic_encode_image() */
+//
+// Encode 1 or more pixels into the output stream
+//
+int slic_encode(SLICSTATE *pState, uint8_t *s, int iPixelCount) {
+    if (pState == NULL)
+        return SLIC_INVALID_PARAM;
+    return slic_encode_image(pState, s, iPixelCount, slic_pixel_coder(pState));
+} /* slic_encode() */
+//
+// Write callback of slic_estimate(); the data only needs to be counted
+//
+static int slic_count_only(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen)
+{
+    (void)pFile; (void)pBuf;
+    return iLen;
+} /* slic_count_only() */
+
+static uint32_t slic_isqrt(uint64_t u64)
+{
+    uint64_t r = 0, b = 1ULL << 62;
+
+    while (b > u64)
+        b >>= 2;
+    while (b) {
+        if (u64 >= r + b) {
+            u64 -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+    return (uint32_t)r;
+} /* slic_isqrt() */
+//
+// Predict the compressed size of an image by encoding evenly spaced bands
+// of SLIC_ESTIMATE_ROWS rows with the real encoder, which counts its output
+// instead of writing it. SLIC has no vertical context, so the bands code as
+// they would in the whole image, apart from runs and cache contents carried
+// over from the band before. The size of the rows in between is extrapolated
+// from the bands and *pError is twice the standard error of that (~95%
+// confidence); images of up to 2 x SLIC_ESTIMATE_BANDS bands are encoded in
+// full. The count is of the output to a write callback; encoding to memory
+// can save up to a byte per FILE_BUF_SIZE, which is added to *pError.
+// Default options are assumed and a palette isn't counted.
+//
+int slic_estimate(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iBpp, int iPitch, slic_size_t *pSize, slic_size_t *pError)
+{
+    SLICSTATE state;
+    uint32_t i, y, iBands, iSample;
+    slic_size_t iHeader, iPos, iLen, iSum = 0;
+    uint64_t u64Sq = 0, u64Var;
+    int rc;
+
+    if (pPixels == NULL || pSize == NULL || pError == NULL || iPitch < 1)
+        return SLIC_INVALID_PARAM;
+    // (the parentheses keep C++ from also finding the global one when
+    // slic_codec.h includes this file in a namespace)
+    rc = (slic_init_encode)(NULL, &state, iWidth, iHeight, iBpp, NULL, NULL, NULL, state.ucFileBuf, FILE_BUF_SIZE);
+    if (rc != SLIC_SUCCESS)
+        return rc;
+    state.pfnWrite = slic_count_only; // callback mode, with nothing written
+    rc = slic_write_header(&state);
+    iBands = (iHeight + SLIC_ESTIMATE_ROWS - 1) / SLIC_ESTIMATE_ROWS;
+    if (iBands <= 2 * SLIC_ESTIMATE_BANDS && rc == SLIC_SUCCESS) { // small enough to encode it all
+        for (y=0; y<iHeight && rc == SLIC_SUCCESS; y++)
+            rc = slic_encode_pixels(&state, &pPixels[(size_t)y * iPitch], (int)iWidth, slic_pixel_coder(&state));
+        if (rc != SLIC_DONE)
+            return (rc == SLIC_SUCCESS) ? SLIC_ENCODE_OVERFLOW : rc;
+        *pSize = state.iOffset;
+        *pError = state.iOffset / FILE_BUF_SIZE;
+        return SLIC_SUCCESS;
+    }
+    iHeader = iPos = state.iOffset + (state.pOutPtr - state.pOutBuffer);
+    for (i=0; i<SLIC_ESTIMATE_BANDS && rc == SLIC_SUCCESS; i++) {
+        // a band from each 1/SLIC_ESTIMATE_BANDS of the image; where in it is
+        // scrambled, so that the bands don't line up with repeating content
+        y = (uint32_t)(((uint64_t)i * iBands + ((i * 0x9e3779b1U) >> 16) * (uint64_t)iBands / 65536) / SLIC_ESTIMATE_BANDS) * SLIC_ESTIMATE_ROWS;
+        if (y > iHeight - SLIC_ESTIMATE_ROWS) // the last band can be short
+            y = iHeight - SLIC_ESTIMATE_ROWS;
+        for (iSample=0; iSample<SLIC_ESTIMATE_ROWS && rc == SLIC_SUCCESS; iSample++)
+            rc = slic_encode_pixels(&state, &pPixels[(size_t)(y + iSample) * iPitch], (int)iWidth, slic_pixel_coder(&state));
+        iLen = state.iOffset + (state.pOutPtr - state.pOutBuffer) - iPos;
+        iPos += iLen;
+        iSum += iLen;
+        u64Sq += (uint64_t)iLen * iLen;
+    }
+    if (rc != SLIC_SUCCESS)
+        return rc;
+    // sample variance of the band sizes, then the error of their total over
+    // all of the bands, less the part which was sampled
+    u64Var = (u64Sq - (uint64_t)iSum * iSum / SLIC_ESTIMATE_BANDS) / (SLIC_ESTIMATE_BANDS - 1);
+    u64Var = u64Var * iBands / SLIC_ESTIMATE_BANDS * (iBands - SLIC_ESTIMATE_BANDS);
+    *pSize = iHeader + (slic_size_t)(((uint64_t)iSum * iHeight + (SLIC_ESTIMATE_BANDS * SLIC_ESTIMATE_ROWS / 2)) / (SLIC_ESTIMATE_BANDS * SLIC_ESTIMATE_ROWS));
+    *pError = 2 * (slic_size_t)slic_isqrt(u64Var) + 1 + *pSize / FILE_BUF_SIZE;
+    return SLIC_SUCCESS;
+} /* slic_estimate() */
+#ifndef __AVR__
+//
+// Find the smallest format which holds a 24 or 32-bpp RGB(A) image without
+// loss: packed or 8-bit palette (up to 256 colors, given in order of first
+// appearance in the 768-byte pPalette), 8-bit gray, RGB565 (see
+// slic_analyze_scalar()), 24 or 32-bpp. Only opaque images can drop their
+// alpha. Pass the results to slic_init_encode() (with pPalette if
+// *piColorspace is SLIC_PALETTE) and set SLIC_OPTION_SOURCE_BPP to iBpp to
+// encode the same pixels.
+//
+int slic_choose_format(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iBpp, int iPitch, int *piBpp, int *piColorspace, uint8_t *pPalette)
+{
+    uint8_t ucPixels[SLIC_CONVERT_CHUNK * 4];
+    uint32_t ulColors[512]; // hash set of the colors seen + 1 (0 = empty)
+    uint32_t u32, u32Prev = 0xffffffff, u32Flags = 0;
+    const uint8_t *s;
+    uint32_t x, y;
+    int i, j, n, iColors = 0;
+
+    if (pPixels == NULL || piBpp == NULL || piColorspace == NULL || pPalette == NULL || iWidth < 1 || iHeight < 1)
+        return SLIC_INVALID_PARAM;
+    if ((iBpp != 24 && iBpp != 32) || (slic_size_t)iPitch < (slic_size_t)iWidth * (iBpp >> 3))
+        return SLIC_INVALID_PARAM;
+    memset(ulColors, 0, sizeof(ulColors));
+    memset(pPalette, 0, 768);
+    for (y=0; y<iHeight; y++) {
+        for (x=0; x<iWidth; x+=n) {
+            n = (iWidth - x < SLIC_CONVERT_CHUNK) ? (int)(iWidth - x) : SLIC_CONVERT_CHUNK;
+            s = &pPixels[(size_t)y * iPitch + (size_t)x * (iBpp >> 3)];
+            if (iBpp == 24) { // make them RGBA for the kernel
+                for (i=0; i<n; i++) {
+                    memcpy(&ucPixels[i*4], &s[i*3], 3);
+                    ucPixels[i*4+3] = 0xff;
+                }
+                s = ucPixels;
+            }
+            u32Flags |= (*slic_get_kernels()->pfnAnalyze)(s, n);
+            for (i=0; i<n && iColors <= 256; i++) {
+                u32 = s[i*4] | (s[i*4+1] << 8) | ((uint32_t)s[i*4+2] << 16);
+                if (u32 == u32Prev)
+                    continue;
+                u32Prev = u32;
+                for (j = (int)((u32 * 0x9e3779b1U) >> 23); ulColors[j] && ulColors[j] != u32 + 1; j = (j + 1) & 511) {};
+                if (ulColors[j] == 0) { // a new color
+                    ulColors[j] = u32 + 1;
+                    if (iColors < 256)
+                        memcpy(&pPalette[iColors * 3], &s[i*4], 3);
+                    iColors++;
+                }
             }
-            while (run >= 62) {
-                *d++ = SLIC_OP_RUN16 | 61;
-                run -= 62;
+            if (iColors > 256 && u32Flags == (SLIC_NOT_OPAQUE | SLIC_NOT_GRAY | SLIC_NOT_RGB565))
+                break; // nothing left to find out; it has to stay 32-bpp
+        }
+        if (x < iWidth)
+            break;
+    }
+    *piColorspace = SLIC_SRGB;
+    if (u32Flags & SLIC_NOT_OPAQUE) {
+        *piBpp = 32;
+    } else if (!(u32Flags & SLIC_NOT_GRAY) && iColors > 16) {
+        *piBpp = 8;
+        *piColorspace = SLIC_GRAYSCALE;
+    } else if (iColors <= 256) {
+        *piBpp = (iColors <= 2) ? 1 : (iColors <= 4) ? 2 : (iColors <= 16) ? 4 : 8;
+        *piColorspace = SLIC_PALETTE;
+    } else if (!(u32Flags & SLIC_NOT_RGB565)) {
+        *piBpp = 16;
+        *piColorspace = SLIC_RGB565;
+    } else {
+        *piBpp = 24;
+    }
+    if (*piColorspace != SLIC_PALETTE)
+        memset(pPalette, 0, 768);
+    return SLIC_SUCCESS;
+} /* slic_choose_format() */
+//
+// Count of the ordered pair of neighboring indices in the table below, or
+// the slot to add it to (with bAdd); when the probes find no room, the
+// slot with the smallest count is taken over by the new pair
+//
+static uint32_t * slic_pair_slot(uint16_t *pKeys, uint32_t *pCounts, int iKey, int bAdd)
+{
+    int i, j, iMin = -1;
+
+    j = (int)(((uint32_t)iKey * 0x9e3779b1U) >> 21) & (SLIC_PAIR_SLOTS - 1);
+    for (i=0; i<8; i++, j = (j + 1) & (SLIC_PAIR_SLOTS - 1)) {
+        if (pKeys[j] == iKey)
+            return &pCounts[j];
+        if (pKeys[j] == 0) { // the pair isn't in the table
+            if (!bAdd)
+                return NULL;
+            pKeys[j] = (uint16_t)iKey;
+            return &pCounts[j];
+        }
+        if (iMin < 0 || pCounts[j] < pCounts[iMin])
+            iMin = j;
+    }
+    if (!bAdd)
+        return NULL;
+    pKeys[iMin] = (uint16_t)iKey; // it keeps the count, so a frequent new pair can stay
+    return &pCounts[iMin];
+} /* slic_pair_slot() */
+
+static uint32_t slic_pair_count(uint16_t *pKeys, uint32_t *pCounts, int a, int b)
+{
+    uint32_t *pCount = slic_pair_slot(pKeys, pCounts, (a << 8) | b, 0);
+    return pCount ? *pCount : 0;
+} /* slic_pair_count() */
+//
+// Size of an 8-bpp palette image after its indices are mapped to new ones
+// (and its palette moved to match), encoded with a counting write callback
+//
+static slic_size_t slic_mapped_size(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iPitch, const uint8_t *pPalette, const uint8_t *pMap)
+{
+    SLICSTATE state;
+    uint8_t ucTemp[SLIC_CONVERT_CHUNK + 4], ucPalette[768]; // the gray8 encoder reads a byte past the end
+    uint32_t x, y;
+    int i, n, rc;
+
+    for (i=0; i<256; i++)
+        memcpy(&ucPalette[pMap[i] * 3], &pPalette[i * 3], 3);
+    rc = (slic_init_encode)(NULL, &state, iWidth, iHeight, 8, ucPalette, NULL, NULL, state.ucFileBuf, FILE_BUF_SIZE);
+    if (rc != SLIC_SUCCESS)
+        return 0;
+    state.pfnWrite = slic_count_only;
+    rc = slic_write_header(&state);
+    for (y=0; y<iHeight && rc == SLIC_SUCCESS; y++) {
+        for (x=0; x<iWidth && rc == SLIC_SUCCESS; x+=n) {
+            n = (iWidth - x < SLIC_CONVERT_CHUNK) ? (int)(iWidth - x) : SLIC_CONVERT_CHUNK;
+            for (i=0; i<n; i++)
+                ucTemp[i] = pMap[pPixels[(size_t)y * iPitch + x + i]];
+            ucTemp[n] = 0;
+            rc = slic_encode_pixels(&state, ucTemp, n, slic_encode_gray8);
+        }
+    }
+    return (rc == SLIC_DONE) ? state.iOffset : 0;
+} /* slic_mapped_size() */
+//
+// Reorder the palette of an 8-bpp palette image (and rewrite its indices to
+// match) so that it encodes smaller. SLIC_OP_DIFF8 only codes a pair of
+// pixels when their indices are within -4..+3 of the one before, so colors
+// which are often next to each other should be next to each other in the
+// palette. The ordered pairs of neighboring indices are counted, then the
+// palette is built a color at a time: each step adds the color which forms
+// the most pairs within DIFF8 range of the last 4 colors added (or the most
+// used color, if none does). That keeps colors which are often together
+// close, and in different SLIC_GRAY_HASH slots for SLIC_OP_INDEX8. Unused
+// entries go last. The time is one pass over the pixels to count the pairs,
+// at most 256 x 256 steps to order them and 2 encodes to check the result;
+// the pixels and palette are only changed if the new order is smaller.
+//
+int slic_sort_palette(uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iPitch, uint8_t *pPalette)
+{
+    uint16_t usKeys[SLIC_PAIR_SLOTS]; // (first << 8) | second, 0 = empty (never a pair)
+    uint32_t ulCounts[SLIC_PAIR_SLOTS], ulUsed[256], u32Score, u32Best;
+    uint8_t ucMap[256], ucOrder[256], ucIdentity[256], ucPalette[768], *s;
+    uint32_t x, y, *pCount;
+    slic_size_t iNew;
+    int i, j, k, c, iColors, iBest, iPrev = -1;
+
+    if (pPixels == NULL || pPalette == NULL || iWidth < 1 || iHeight < 1 || (slic_size_t)iPitch < iWidth)
+        return SLIC_INVALID_PARAM;
+    memset(usKeys, 0, sizeof(usKeys));
+    memset(ulCounts, 0, sizeof(ulCounts));
+    memset(ulUsed, 0, sizeof(ulUsed));
+    for (y=0; y<iHeight; y++) { // the encoder sees the rows as one long line
+        s = &pPixels[(size_t)y * iPitch];
+        for (x=0; x<iWidth; x++) {
+            c = s[x];
+            ulUsed[c]++;
+            if (c != iPrev && iPrev >= 0) { // runs don't care about the order
+                pCount = slic_pair_slot(usKeys, ulCounts, (iPrev << 8) | c, 1);
+                (*pCount)++;
             }
-            if (run > 0) {
-                *d++ = SLIC_OP_RUN16 | (run - 1);
-                run = 0;
+            iPrev = c;
+        }
+    }
+    // build the new order a color at a time
+    for (i=0; i<256; i++)
+        ucIdentity[i] = (uint8_t)i;
+    memset(ucMap, 0, sizeof(ucMap)); // marks the colors placed, until it becomes the map
+    for (iColors=0; iColors<256; iColors++) {
+        iBest = -1;
+        u32Best = 0;
+        for (c=0; c<256; c++) {
+            if (ulUsed[c] == 0 || ucMap[c])
+                continue; // unused or already placed
+            // c would be the next index; DIFF8 can step up to 3 to it and
+            // down to 4 from it
+            u32Score = 0;
+            for (k=1; k<=4 && k<=iColors; k++) {
+                j = ucOrder[iColors - k];
+                if (k < 4)
+                    u32Score += slic_pair_count(usKeys, ulCounts, j, c);
+                u32Score += slic_pair_count(usKeys, ulCounts, c, j);
             }
-            // If using a write callback, flush the last of the data
-            if (pState->pfnWrite) {
-                (*pState->pfnWrite)(&pState->file, pState->pOutBuffer, (int)(d - pState->pOutBuffer));
-            } else  {
-                pState->iOffset = (int)(d - pState->pOutBuffer);
+            if (iBest < 0 || u32Score > u32Best || (u32Score == u32Best && ulUsed[c] > ulUsed[iBest])) {
+                iBest = c;
+                u32Best = u32Score;
             }
         }
-        // save state
-exit_rgb565:
-        pState->curr_pixel = px16;
-        pState->prev_pixel = px16_prev;
-        pState->pOutPtr = d;
-        pState->run = run;
-        pState->bad_run = bad_run;
-        pState->prev_op = prev_op;
-        return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
-    } // RGB565 (channels == 2)
-
-    else {
-        for (; s < pEnd; s += iBpp) { // RGB & RGBA
-            if (d >= pDstEnd) {
-                if (pState->pfnWrite) {
-                    d = dump_encoded_data(pState, d);
-                    bad_run = 0; // can't update bad_run count once written
-                } else {
-                    return SLIC_ENCODE_OVERFLOW;
-                }
-            }
-#ifdef UNALIGNED_ALLOWED
-            px = *(uint32_t *)s;
-#else
-            px = (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24);
-#endif
-            if (iBpp == 3) px |= 0xff000000;
-            if (px == px_prev) {
-                run++;
+        if (iBest < 0)
+            break; // all of the used colors are placed
+        ucOrder[iColors] = (uint8_t)iBest;
+        ucMap[iBest] = 1;
+    }
+    for (c=0; c<256; c++) // then the unused entries, in their old order
+        if (ulUsed[c] == 0)
+            ucOrder[iColors++] = (uint8_t)c;
+    for (i=0; i<256; i++)
+        ucMap[ucOrder[i]] = (uint8_t)i;
+    iNew = slic_mapped_size(pPixels, iWidth, iHeight, iPitch, pPalette, ucMap);
+    if (iNew == 0 || iNew >= slic_mapped_size(pPixels, iWidth, iHeight, iPitch, pPalette, ucIdentity))
+        return SLIC_SUCCESS; // the old order is as good; leave it alone
+    for (y=0; y<iHeight; y++) {
+        s = &pPixels[(size_t)y * iPitch];
+        for (x=0; x<iWidth; x++)
+            s[x] = ucMap[s[x]];
+    }
+    for (i=0; i<256; i++)
+        memcpy(&ucPalette[i * 3], &pPalette[ucOrder[i] * 3], 3);
+    memcpy(pPalette, ucPalette, 768);
+    return SLIC_SUCCESS;
+} /* slic_sort_palette() */
+//
+// Start training a dictionary for images of a pixel format, which is picked
+// as slic_init_encode() does; pPalette is the palette which the (palette)
+// images share, or NULL for them to store their own
+//
+int slic_init_trainer(SLICTRAINER *pTrainer, uint32_t u32ID, int iBpp, uint8_t *pPalette)
+{
+    SLICDICT *pDict;
+    int iCount, iColorspace;
+
+    if (pTrainer == NULL || iBpp > 32)
+        return SLIC_INVALID_PARAM;
+    if (iBpp >= 24)
+        iColorspace = SLIC_SRGB;
+    else if (iBpp == 16)
+        iColorspace = SLIC_RGB565;
+    else
+        iColorspace = (pPalette) ? SLIC_PALETTE : SLIC_GRAYSCALE;
+    if (!slic_valid_format(iBpp, iColorspace))
+        return SLIC_INVALID_PARAM;
+    memset(pTrainer, 0, sizeof(SLICTRAINER));
+    pDict = &pTrainer->dict;
+    pDict->id = u32ID;
+    pDict->bpp = (uint8_t)iBpp;
+    pDict->colorspace = (uint8_t)iColorspace;
+    pDict->prev_pixel = 0xff000000; // what it is without a dictionary
+    if (iColorspace == SLIC_PALETTE) { // the entries the images can use, less trailing black ones
+        iCount = (iBpp < 8) ? (1 << iBpp) : 256;
+        while (iCount > 1 && (pPalette[iCount*3-3] | pPalette[iCount*3-2] | pPalette[iCount*3-1]) == 0)
+            iCount--;
+        memcpy(pDict->palette, pPalette, iCount * 3);
+        pDict->palette_count = (uint16_t)iCount;
+    }
+    return SLIC_SUCCESS;
+} /* slic_init_trainer() */
+//
+// Count a color of a cache entry (or of the first pixel); the least counted
+// candidate makes way for a new one, which keeps its count so that a color
+// which first turns up late can still get ahead
+//
+static void slic_dict_vote(SLICTRAINER *pTrainer, int iEntry, uint32_t u32Color)
+{
+    uint32_t *pColors = pTrainer->colors[iEntry], *pCounts = pTrainer->counts[iEntry];
+    int i, iMin = 0;
+
+    for (i=0; i<SLIC_DICT_CANDIDATES; i++) {
+        if (pCounts[i] && pColors[i] == u32Color) {
+            pCounts[i]++;
+            return;
+        }
+        if (pCounts[i] < pCounts[iMin])
+            iMin = i;
+    }
+    pColors[iMin] = u32Color;
+    pCounts[iMin]++;
+} /* slic_dict_vote() */
+//
+// Add an image to the training. A dictionary can only save the first use of
+// each cache entry in an image, since the encoder replaces it after that, so
+// the first color which lands in each entry is counted, along with the first
+// pixel. Pixels are walked in the units the encoder codes: bytes of packed
+// pixels, 8/16-bit values or RGB(A) pixels.
+//
+int slic_train_dictionary(SLICTRAINER *pTrainer, uint8_t *pPixels, uint32_t iWidth, uint32_t iHeight, int iPitch)
+{
+    uint64_t u64Seen = 0, u64All;
+    uint32_t x, y, iUnits, px, px_prev;
+    const uint8_t *s;
+    int iBpp, iEntry;
+
+    if (pTrainer == NULL || pPixels == NULL || iWidth < 1 || iHeight < 1)
+        return SLIC_INVALID_PARAM;
+    iBpp = pTrainer->dict.bpp;
+    iUnits = (iBpp < 8) ? (uint32_t)(((slic_size_t)iWidth * iBpp + 7) >> 3) : iWidth;
+    if ((slic_size_t)iPitch < (slic_size_t)iUnits * ((iBpp + 7) >> 3))
+        return SLIC_INVALID_PARAM;
+    u64All = (iBpp <= 16) ? 0xff : ~0ULL; // 8 or 64 cache entries
+    px_prev = (iBpp <= 16) ? 0 : 0xff000000; // the encoder's starting pixel, cut to size
+    for (y=0; y<iHeight && u64Seen != u64All; y++) {
+        s = &pPixels[(size_t)y * iPitch];
+        for (x=0; x<iUnits && u64Seen != u64All; x++) {
+            if (iBpp <= 8) {
+                px = s[x];
+            } else if (iBpp == 16) {
+                px = s[x*2] | (s[x*2+1] << 8);
+            } else if (iBpp == 24) {
+                px = s[x*3] | (s[x*3+1] << 8) | ((uint32_t)s[x*3+2] << 16) | 0xff000000;
+            } else {
+                px = s[x*4] | (s[x*4+1] << 8) | ((uint32_t)s[x*4+2] << 16) | ((uint32_t)s[x*4+3] << 24);
             }
-            else {
-                int index_pos;
-                while (run >= 1024) {
-                    *d++ = SLIC_OP_RUN1024;
-                    run -= 1024;
-                }
-                while (run >= 256) {
-                    *d++ = SLIC_OP_RUN256;
-                    run -= 256;
-                }
-                while (run >= 60) {
-                    *d++ = SLIC_OP_RUN | 59;
-                    run -= 60;
-                }
-                if (run > 0) {
-                    *d++ = SLIC_OP_RUN | (run - 1);
-                    run = 0;
-                }
-                index_pos = px * 3;
-                index_pos += ((px >> 8) * 5);
-                index_pos += ((px >> 16) * 7);
-                index_pos += ((px >> 24) * 11);
-                index_pos &= 63;
-
-                if (index[index_pos] == px) {
-                    *d++ = SLIC_OP_INDEX | index_pos;
-                }
-                else {
-                    index[index_pos] = px;
-                    if ((px & 0xff000000) == (px_prev & 0xff000000)) {
-                        signed char vr = (uint8_t)px - (uint8_t)px_prev; //px.rgba.r - px_prev.rgba.r;
-                        signed char vg = (uint8_t)(px >> 8) - (uint8_t)(px_prev >> 8); //px.rgba.g - px_prev.rgba.g;
-                        signed char vb = (uint8_t)(px >> 16) - (uint8_t)(px_prev >> 16); //px.rgba.b - px_prev.rgba.b;
-
-                        signed char vg_r = vr - vg;
-                        signed char vg_b = vb - vg;
-
-                        if (
-                            vr > -3 && vr < 2 &&
-                            vg > -3 && vg < 2 &&
-                            vb > -3 && vb < 2
-                        ) {
-                            *d++ = SLIC_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
-                        }
-                        else if (
-                            vg_r >  -9 && vg_r <  8 &&
-                            vg   > -33 && vg   < 32 &&
-                            vg_b >  -9 && vg_b <  8
-                        ) {
-                            *d++ = SLIC_OP_LUMA     | (vg   + 32);
-                            *d++ = (vg_r + 8) << 4 | (vg_b +  8);
-                        }
-                        else {
-                            *d++ = SLIC_OP_RGB;
-#ifdef UNALIGNED_ALLOWED
-                            *(uint32_t *)d = px;
-                            d += 3;
-#else
-                            *d++ = (uint8_t)px;
-                            *d++ = (uint8_t)(px >> 8);
-                            *d++ = (uint8_t)(px >> 16);
-#endif
-                        }
-                    }
-                    else {
-                        *d++ = SLIC_OP_RGBA;
-#ifdef UNALIGNED_ALLOWED
-                        *(uint32_t *)d = px;
-                        d += 4;
-#else
-                        *d++ = (uint8_t)px;
-                        *d++ = (uint8_t)(px >> 8);
-                        *d++ = (uint8_t)(px >> 16);
-                        *d++ = (uint8_t)(px >> 24);
-#endif
-                    }
-                }
+            if (x == 0 && y == 0)
+                slic_dict_vote(pTrainer, 64, px);
+            if (px == px_prev)
+                continue; // runs don't use the cache
+            if (iBpp <= 8)
+                iEntry = SLIC_GRAY_HASH(px);
+            else if (iBpp == 16)
+                iEntry = SLIC_RGB565_HASH(px);
+            else
+                iEntry = SLIC_RGB_HASH(px);
+            if (!(u64Seen & (1ULL << iEntry))) {
+                u64Seen |= (1ULL << iEntry);
+                slic_dict_vote(pTrainer, iEntry, px);
             }
             px_prev = px;
         }
-        if (pState->iPixelCount == 0) { // clean up any remaining repeats
-            while (run >= 62) { // store pending run
-                *d++ = SLIC_OP_RUN | 61;
-                run -= 62;
-            }
-            if (run > 0) { // save pending run
-                *d++ = SLIC_OP_RUN | (run - 1);
-            }
-            // If using a write callback, flush the last of the data
-            if (pState->pfnWrite) {
-                (*pState->pfnWrite)(&pState->file, pState->pOutBuffer, (int)(d - pState->pOutBuffer));
-            } else  {
-                pState->iOffset = (int)(d - pState->pOutBuffer);
-            }
+    }
+    return SLIC_SUCCESS;
+} /* slic_train_dictionary() */
+//
+// Make the dictionary from the colors counted most often so far
+//
+int slic_get_dictionary(SLICTRAINER *pTrainer, SLICDICT *pDict)
+{
+    uint32_t *pColors, *pCounts;
+    int i, j, iBest, iEntries;
+
+    if (pTrainer == NULL || pDict == NULL)
+        return SLIC_INVALID_PARAM;
+    memcpy(pDict, &pTrainer->dict, sizeof(SLICDICT));
+    iEntries = (pDict->bpp <= 16) ? 8 : 64;
+    for (i=0; i<=iEntries; i++) {
+        pColors = pTrainer->colors[(i == iEntries) ? 64 : i];
+        pCounts = pTrainer->counts[(i == iEntries) ? 64 : i];
+        iBest = 0;
+        for (j=1; j<SLIC_DICT_CANDIDATES; j++)
+            if (pCounts[j] > pCounts[iBest])
+                iBest = j;
+        if (pCounts[iBest] == 0)
+            continue; // never used; leave it as it is without a dictionary
+        if (i == iEntries)
+            pDict->prev_pixel = pColors[iBest];
+        else if (pDict->bpp <= 8)
+            ((uint8_t *)pDict->index)[i] = (uint8_t)pColors[iBest];
+        else if (pDict->bpp == 16)
+            ((uint16_t *)pDict->index)[i] = (uint16_t)pColors[iBest];
+        else
+            pDict->index[i] = pColors[iBest];
+    }
+    return SLIC_SUCCESS;
+} /* slic_get_dictionary() */
+#endif // !__AVR__
+
+//
+// Read more data from the data source
+// The unread bytes from s to the end of the buffer are moved to the start of
+// it first, so that an op which was cut off by the last read stays whole.
+// Short reads are repeated until the buffer is full or the data runs out.
+// if none exists --> error
+// returns 0 for success, 1 for error
+//
+static int get_more_data(SLICSTATE *pState, const uint8_t *s)
+{
+int i, iLen;
+    if (pState->pfnRead) { // read more data
+        iLen = (int)(pState->pInEnd - s);
+        if (iLen < 0)
+            iLen = 0;
+        if (pState->pCrcPtr) { // the bytes before s are done with
+            pState->crc = slic_crc32c(pState->crc, pState->pCrcPtr, (int)(pState->pInEnd - pState->pCrcPtr) - iLen);
+            pState->pCrcPtr = pState->ucFileBuf;
         }
-    } // RGB/RGBA
-    // save state
-    pState->curr_pixel = px;
-    pState->prev_pixel = px_prev;
-    pState->pOutPtr = d;
-    pState->run = run;
-    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
-} /* slic_encode() */
+        if (iLen)
+            memmove(pState->ucFileBuf, s, iLen);
+        SLIC_IO_REFILL(pState)
+        do {
+            i = SLIC_READ(pState, &pState->ucFileBuf[iLen], FILE_BUF_SIZE - iLen);
+            if (i > 0)
+                iLen += i;
+        } while (i > 0 && iLen < FILE_BUF_SIZE);
+        if (iLen == 0) // end of file
+            return 1;
+        pState->pInEnd = &pState->ucFileBuf[iLen];
+        return 0;
+    }
+    return 1;
+} /* get_more_data() */
+//
+// Copy the next iLen bytes of compressed data to pDst (or skip them if pDst
+// is NULL), reading more as needed
+// returns 0 for success, 1 for error
+//
+static int slic_read_bytes(SLICSTATE *pState, uint8_t *pDst, int iLen)
+{
+int n;
+    while (iLen > 0) {
+        if (pState->pInPtr >= pState->pInEnd) {
+            if (get_more_data(pState, pState->pInPtr))
+                return 1;
+            pState->pInPtr = pState->ucFileBuf;
+        }
+        n = (int)(pState->pInEnd - pState->pInPtr);
+        if (n > iLen)
+            n = iLen;
+        if (pDst) {
+            memcpy(pDst, pState->pInPtr, n);
+            pDst += n;
+        }
+        pState->pInPtr += n;
+        iLen -= n;
+    }
+    return 0;
+} /* slic_read_bytes() */
+//
+// Skip iLen bytes of compressed data; with a read callback they're read
+// through (the callback can't seek, and the checksum covers them)
+// returns 0 for success, 1 for error
+//
+static int slic_skip_bytes(SLICSTATE *pState, slic_size_t iLen)
+{
+slic_size_t n = pState->pInEnd - pState->pInPtr;
+    if (iLen <= n) {
+        pState->pInPtr += iLen;
+        return 0;
+    }
+    if (!pState->pfnRead)
+        return 1;
+    while (iLen) {
+        n = (iLen > 0x4000) ? 0x4000 : iLen;
+        if (slic_read_bytes(pState, NULL, (int)n))
+            return 1;
+        iLen -= n;
+    }
+    return 0;
+} /* slic_skip_bytes() */
+//
+// Read the chunk list of the extended header; the chunks are remembered so
+// that slic_get_chunk() can copy them later from memory, but otherwise
+// skipped, except for the dictionary's ID
+//
+static int slic_read_chunks(SLICSTATE *pState)
+{
+    uint8_t ucChunk[5];
+    uint32_t iLen;
+    slic_chunk *pChunk;
+
+    while (1) {
+        if (slic_read_bytes(pState, ucChunk, 1))
+            return SLIC_BAD_FILE;
+        if (ucChunk[0] == SLIC_CHUNK_END)
+            return SLIC_SUCCESS;
+        if ((ucChunk[0] & SLIC_CHUNK_CRITICAL) && ucChunk[0] != SLIC_CHUNK_DICTIONARY)
+            return SLIC_BAD_FILE; // needs a newer decoder
+        if (slic_read_bytes(pState, &ucChunk[1], 4))
+            return SLIC_BAD_FILE;
+        iLen = ucChunk[1] | ((uint32_t)ucChunk[2] << 8) | ((uint32_t)ucChunk[3] << 16) | ((uint32_t)ucChunk[4] << 24);
+        if (pState->chunk_count < SLIC_MAX_CHUNKS) {
+            pChunk = &pState->chunks[pState->chunk_count++];
+            pChunk->type = ucChunk[0];
+            pChunk->iLen = iLen;
+            pChunk->pData = NULL;
+            pChunk->iOffset = (pState->pfnRead) ? 0 : pState->pInPtr - pState->file.pData;
+        }
+        if (ucChunk[0] == SLIC_CHUNK_DICTIONARY) { // ID and flags, then anything newer
+            if (iLen < 5 || pState->dict_flags || slic_read_bytes(pState, ucChunk, 5))
+                return SLIC_BAD_FILE;
+            if ((ucChunk[4] & ~SLIC_DICT_PALETTE) || ((ucChunk[4] & SLIC_DICT_PALETTE) && pState->colorspace != SLIC_PALETTE))
+                return SLIC_BAD_FILE;
+            pState->dict_id = ucChunk[0] | ((uint32_t)ucChunk[1] << 8) | ((uint32_t)ucChunk[2] << 16) | ((uint32_t)ucChunk[3] << 24);
+            pState->dict_flags = ucChunk[4] | SLIC_DICT_NEEDED;
+            iLen -= 5;
+        }
+        if (slic_skip_bytes(pState, iLen))
+            return SLIC_BAD_FILE;
+    }
+} /* slic_read_chunks() */
+//
+// Get the size and data of the first chunk of a type in the header.
+// *pLen is set to the chunk's length; if pDst isn't NULL, up to the
+// original value of *pLen bytes are copied to it. Only images decoded from
+// memory keep their chunks; a read callback only goes forward, so the data
+// has already gone by and SLIC_INVALID_PARAM is returned.
+//
+int slic_get_chunk(SLICSTATE *pState, int iType, uint8_t *pDst, uint32_t *pLen)
+{
+    slic_chunk *pChunk = NULL;
+    uint32_t iLen;
+    int i;
+
+    if (pState == NULL || pLen == NULL || !pState->decoder || pState->pfnRead)
+        return SLIC_INVALID_PARAM;
+    for (i=0; i<pState->chunk_count; i++) {
+        if (pState->chunks[i].type == iType) {
+            pChunk = &pState->chunks[i];
+            break;
+        }
+    }
+    if (pChunk == NULL)
+        return SLIC_INVALID_PARAM;
+    iLen = (*pLen < pChunk->iLen) ? *pLen : pChunk->iLen;
+    *pLen = pChunk->iLen;
+    if (pDst && iLen)
+        memcpy(pDst, &pState->file.pData[pChunk->iOffset], iLen);
+    return SLIC_SUCCESS;
+} /* slic_get_chunk() */
 
 int slic_init_decode(const char *filename, SLICSTATE *pState, uint8_t *pData, int iDataSize, uint8_t *pPalette, SLIC_OPEN_CALLBACK *pfnOpen, SLIC_READ_CALLBACK *pfnRead) {
     slic_header hdr;
-    int rc, i;
-    uint8_t *s;
+    int rc;
+    uint8_t ucCount, ucFlags[2];
 
-    if (pState == NULL) {
+    if (pState == NULL || (pfnRead == NULL && (pData == NULL || iDataSize < 0))) {
         return SLIC_INVALID_PARAM;
     }
     memset(pState, 0, sizeof(SLICSTATE));
+    pState->decoder = 1;
+    SLIC_IO_ENTER(pState) // the header is read here
     if (pfnOpen) {
         rc = (*pfnOpen)(filename, &pState->file);
         if (rc != SLIC_SUCCESS)
@@ -520,130 +3471,621 @@ int slic_init_decode(const char *filename, SLICSTATE *pState, uint8_t *pData, in
     pState->file.iPos = 0;
     pState->file.iSize = iDataSize;
 
-    if (pfnRead) {
-        i = (*pfnRead)(&pState->file, pState->ucFileBuf, FILE_BUF_SIZE);
-        memcpy(&hdr, pState->ucFileBuf, SLIC_HEADER_SIZE);
-        pState->pInPtr = &pState->ucFileBuf[SLIC_HEADER_SIZE];
-        pState->pInEnd = &pState->ucFileBuf[i];
+    if (pfnRead) { // the first read is done by slic_read_bytes()
+        pState->pInPtr = pState->pInEnd = pState->ucFileBuf;
     } else { // memory to memory
-        memcpy(&hdr, pData, SLIC_HEADER_SIZE);
-        pState->pInPtr = pData + SLIC_HEADER_SIZE;
+        pState->pInPtr = pData;
         pState->pInEnd = &pData[iDataSize];
     }
+    pState->pCrcPtr = pState->pInPtr; // until we know if there's a checksum
+    // The header and palette are read in pieces which may not all be in the
+    // first buffer of file data
+    if (slic_read_bytes(pState, (uint8_t *)&hdr, SLIC_HEADER_SIZE))
+        return SLIC_BAD_FILE;
     if (hdr.magic == SLIC_MAGIC) {
         pState->width = hdr.width;
         pState->height = hdr.height;
         pState->curr_pixel = pState->prev_pixel = 0xff000000;
         pState->bpp = hdr.bpp;
-        pState->colorspace = hdr.colorspace;
-        if (pState->bpp != 8 && pState->bpp != 16 && pState->bpp != 24 && pState->bpp != 32)
-            return SLIC_BAD_FILE; // invalid bits per pixel
-        if (pState->colorspace >= SLIC_COLORSPACE_COUNT)
+        pState->colorspace = hdr.colorspace & SLIC_COLORSPACE_MASK;
+#ifdef SLIC_HIGH_BIT_DEPTH
+        pState->curr_pixel64 = pState->prev_pixel64 = 0xffff000000000000ULL;
+#endif
+        if (!slic_valid_format(pState->bpp, pState->colorspace))
+            return SLIC_BAD_FILE; // invalid bits per pixel or colorspace
+        pState->alpha = 0xff;
+        if (hdr.colorspace & SLIC_EXTENDED_HEADER) {
+            if (slic_read_bytes(pState, ucFlags, 1))
+                return SLIC_BAD_FILE;
+            if ((ucFlags[0] & SLIC_FLAG_MORE) && slic_read_bytes(pState, &ucFlags[1], 1))
+                return SLIC_BAD_FILE;
+            pState->flags = ucFlags[0] | ((ucFlags[0] & SLIC_FLAG_MORE) ? (uint16_t)(ucFlags[1] << 8) : 0);
+            if (pState->flags & ~SLIC_FLAGS_KNOWN)
+                return SLIC_BAD_FILE; // written by a newer version
+            if (pState->flags & (SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA)) {
+                if (pState->bpp != 32 || (pState->flags & SLIC_FLAG_ALPHA_PLANE && pState->flags & SLIC_FLAG_CONSTANT_ALPHA))
+                    return SLIC_BAD_FILE;
+#ifndef SLIC_ALPHA_STRIPS
+                if (pState->flags & SLIC_FLAG_ALPHA_PLANE)
+                    return SLIC_BAD_FILE; // support not compiled in
+#endif
+            }
+            if (pState->flags & SLIC_FLAG_PALETTE_COUNT && pState->colorspace != SLIC_PALETTE)
+                return SLIC_BAD_FILE;
+            if (pState->flags & SLIC_FLAG_STORED && pState->bpp != 24 && pState->bpp != 32)
+                return SLIC_BAD_FILE;
+            if (pState->flags & SLIC_FLAG_GRADIENT && !slic_gradient_format(pState->bpp, pState->colorspace))
+                return SLIC_BAD_FILE;
+            if (pState->flags & SLIC_FLAG_MATCH && pState->bpp != 24 && pState->bpp != 32)
+                return SLIC_BAD_FILE;
+            if (pState->flags & SLIC_FLAG_CONSTANT_ALPHA && slic_read_bytes(pState, &pState->alpha, 1))
+                return SLIC_BAD_FILE;
+            if (pState->flags & SLIC_FLAG_PALETTE_COUNT) {
+                if (slic_read_bytes(pState, &ucCount, 1))
+                    return SLIC_BAD_FILE;
+                pState->palette_count = ucCount + 1;
+            }
+            if (pState->flags & SLIC_FLAG_LARGE) {
+                uint8_t ucSize[8];
+#ifdef __AVR__
+                return SLIC_BAD_FILE; // the pixel count doesn't fit in a slic_size_t
+#endif
+                if (slic_read_bytes(pState, ucSize, 8))
+                    return SLIC_BAD_FILE;
+                pState->width = ucSize[0] | ((uint32_t)ucSize[1] << 8) | ((uint32_t)ucSize[2] << 16) | ((uint32_t)ucSize[3] << 24);
+                pState->height = ucSize[4] | ((uint32_t)ucSize[5] << 8) | ((uint32_t)ucSize[6] << 16) | ((uint32_t)ucSize[7] << 24);
+            }
+            if (pState->flags & SLIC_FLAG_CHUNKS) {
+                rc = slic_read_chunks(pState);
+                if (rc != SLIC_SUCCESS)
+                    return rc;
+            }
+        }
+        if (pState->width == 0 || pState->height == 0 || (uint64_t)pState->width * pState->height > (uint64_t)SLIC_MAX_PIXELS)
             return SLIC_BAD_FILE;
+#ifdef SLIC_ALPHA_STRIPS
+        pState->alpha_prev = 0xff;
+        pState->iStripPixels = (slic_size_t)pState->width * pState->height;
+#endif
         if (pState->colorspace == SLIC_PALETTE) {
-            // DEBUG - fix for file based
-            if (pPalette) { // copy the palette if the user wants it
-                memcpy(pPalette, pState->pInPtr, 768);
+            if (pState->palette_count == 0)
+                pState->palette_count = 256; // original fixed size palette
+            if (pPalette) // the unused entries are black
+                memset(&pPalette[pState->palette_count * 3], 0, 768 - pState->palette_count * 3);
+            // copy the palette if the user wants it, otherwise skip it;
+            // slic_set_dictionary() copies the dictionary's instead
+            if (!(pState->dict_flags & SLIC_DICT_PALETTE) && slic_read_bytes(pState, pPalette, pState->palette_count * 3))
+                return SLIC_BAD_FILE;
+            pState->pPalette = pPalette;
+        }
+        if (pState->bpp < 8) // packed pixels are coded as bytes
+            pState->iPixelCount = (((slic_size_t)pState->width * pState->bpp + 7) >> 3) * pState->height;
+        else
+            pState->iPixelCount = (slic_size_t)pState->width * pState->height;
+        if (pState->flags & SLIC_FLAG_CHECKSUM) {
+            pState->crc = slic_crc32c(pState->crc, pState->pCrcPtr, (int)(pState->pInPtr - pState->pCrcPtr));
+            pState->pCrcPtr = pState->pInPtr;
+        } else {
+            pState->pCrcPtr = NULL;
+        }
+    } else {
+        return SLIC_BAD_FILE;
+    }
+    return SLIC_SUCCESS;
+} /* slic_init_decode() */
+
+
+//
+// Make sure the next byte of compressed data is available
+//
+#define SLIC_NEED_DATA \
+    if (s >= pSrcEnd) { \
+        if (get_more_data(pState, s)) \
+            return SLIC_DECODE_ERROR; \
+        s = pState->ucFileBuf; \
+        pSrcEnd = pState->pInEnd; \
+    }
+//
+// Store a 24 or 32-bpp pixel; with SLIC_PACK24, 24-bpp pixels are decoded
+// as 32-bit pixels and packed by slic_decode_rgb24()
+//
+#ifdef SLIC_PACK24
+#define SLIC_STORE_RGB(d, px) \
+    *(uint32_t *)d = px;
+#else
+#define SLIC_STORE_RGB(d, px) \
+    d[0] = (uint8_t)px; \
+    d[1] = (uint8_t)(px >> 8); \
+    d[2] = (uint8_t)(px >> 16); \
+    if (iBpp == 4) \
+        d[3] = (uint8_t)(px >> 24);
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+//
+// Decode a plane of iCount 8-bit values written by slic_encode_plane8()
+//
+static int slic_decode_plane8(SLICSTATE *pState, uint8_t **ps, uint8_t *d, int iCount, uint8_t *pPrev, uint8_t *index8)
+{
+    uint8_t op, px = *pPrev, *s = *ps;
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    const uint8_t *pEnd = &d[iCount];
+    int n;
+
+    SLIC_STAT(pState, SLIC_STAT_ALPHA, 1, 0, 0) // the ops add their bytes and values
+    while (d < pEnd) {
+        SLIC_NEED_DATA
+        op = *s++;
+        switch (op & SLIC_OP_MASK) {
+            case SLIC_OP_RUN8:
+                if (op == SLIC_OP_RUN8_1024)
+                    n = 1024;
+                else if (op == SLIC_OP_RUN8_256)
+                    n = 256;
+                else
+                    n = op + 1;
+                if (n > (int)(pEnd - d))
+                    return SLIC_DECODE_ERROR; // runs end with the plane
+                SLIC_STAT(pState, SLIC_STAT_ALPHA, 0, 1, n)
+                memset(d, px, n);
+                d += n;
+                break;
+            case SLIC_OP_BADRUN8:
+                n = (op & 0x3f) + 1;
+                if (n > (int)(pEnd - d))
+                    return SLIC_DECODE_ERROR;
+                SLIC_STAT(pState, SLIC_STAT_ALPHA, 0, 1 + n, n)
+                while (n--) {
+                    SLIC_NEED_DATA
+                    px = *s++;
+                    index8[SLIC_GRAY_HASH(px)] = px;
+                    *d++ = px;
+                }
+                break;
+            case SLIC_OP_DIFF8:
+                if (pEnd - d < 2)
+                    return SLIC_DECODE_ERROR; // pairs end with the plane
+                SLIC_STAT(pState, SLIC_STAT_ALPHA, 0, 1, 2)
+                px += (op & 7) - 4;
+                index8[SLIC_GRAY_HASH(px)] = px;
+                *d++ = px;
+                px += ((op >> 3) & 7) - 4;
+                index8[SLIC_GRAY_HASH(px)] = px;
+                *d++ = px;
+                break;
+            default: // SLIC_OP_INDEX8
+                if (pEnd - d < 2)
+                    return SLIC_DECODE_ERROR;
+                SLIC_STAT(pState, SLIC_STAT_ALPHA, 0, 1, 2)
+                *d++ = index8[op & 7];
+                px = index8[(op >> 3) & 7];
+                *d++ = px;
+                break;
+        }
+    }
+    *ps = s;
+    *pPrev = px;
+    return SLIC_SUCCESS;
+} /* slic_decode_plane8() */
+#endif // SLIC_ALPHA_STRIPS
+//
+// Decode 8-bit gray + 8-bit alpha pixels
+//
+static int slic_decode_ga8(SLICSTATE *pState, uint8_t *s, uint8_t *d, const uint8_t *pEnd)
+{
+    uint8_t op, g, a;
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    uint16_t px, *index16 = (uint16_t *)pState->index;
+    int32_t run = pState->run, bad_run = pState->bad_run;
+    int i;
+
+    px = (uint16_t)pState->curr_pixel;
+    while (d < pEnd) {
+        if (run) {
+            run--;
+            goto store_pixel;
+        }
+        SLIC_NEED_DATA
+        if (bad_run) {
+            g = *s++;
+            SLIC_NEED_DATA
+            px = g | (*s++ << 8);
+            bad_run--;
+        } else {
+            op = *s++;
+            g = (uint8_t)px;
+            a = (uint8_t)(px >> 8);
+            if (op < SLIC_OP_INDEX_GA) {
+                if (op == SLIC_OP_RUN_GA_1024) {
+                    run = 1024;
+                } else if (op == SLIC_OP_RUN_GA_256) {
+                    run = 256;
+                } else {
+                    run = op + 1;
+                }
+                continue;
+            } else if (op < SLIC_OP_DIFF_GA) {
+                px = index16[op & 0x3f];
+                goto store_pixel; // already in the cache
+            } else if (op < SLIC_OP_ALPHA_GA) {
+                g += (op & 7) - 4;
+                a += ((op >> 3) & 7) - 4;
+            } else if (op < SLIC_OP_LUMA_GA) {
+                g += (op & 0xf) - 8;
+                SLIC_NEED_DATA
+                if (op & 0x10) // gray also follows the alpha delta
+                    g += *s - a;
+                a = *s++;
+            } else if (op < SLIC_OP_BADRUN_GA) {
+                i = (op & 0xf) << 8;
+                SLIC_NEED_DATA
+                i |= *s++;
+                g += (i >> 6) - 32;
+                a += (i & 0x3f) - 32;
+            } else if (op == SLIC_OP_GRAY_GA) {
+                SLIC_NEED_DATA
+                g = *s++;
+            } else {
+                bad_run = (op & 0xf) + 1;
+                continue;
+            }
+            px = g | (a << 8);
+        }
+        index16[SLIC_GA_HASH(px)] = px;
+store_pixel:
+        d[0] = (uint8_t)px;
+        d[1] = (uint8_t)(px >> 8);
+        d += 2;
+    } // for each output pixel
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->curr_pixel = px;
+    pState->pInPtr = s;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_decode_ga8() */
+#ifdef SLIC_HIGH_BIT_DEPTH
+//
+// Decode 16-bit grayscale pixels
+//
+static int slic_decode_gray16(SLICSTATE *pState, uint8_t *s, uint8_t *pOut, const uint8_t *pEnd)
+{
+    uint8_t op;
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    uint16_t px, *d16, *pEnd16;
+    uint16_t *index16 = (uint16_t *)pState->index;
+    int32_t run = pState->run, bad_run = pState->bad_run;
+    int diff;
+
+    d16 = (uint16_t *)pOut;
+    pEnd16 = (uint16_t *)pEnd;
+    px = (uint16_t)pState->curr_pixel;
+    while (d16 < pEnd16) {
+        if (run) {
+            *d16++ = px;
+            run--;
+            continue;
+        }
+        SLIC_NEED_DATA
+        if (bad_run) {
+            px = *s++;
+            SLIC_NEED_DATA
+            px |= (*s++ << 8);
+            index16[SLIC_GRAY16_HASH(px)] = px;
+            *d16++ = px;
+            bad_run--;
+            continue;
+        }
+        op = *s++;
+        if (op < SLIC_OP_BADRUN_G16) {
+            if (op == SLIC_OP_RUN_G16_1024) {
+                run = 1024;
+            } else if (op == SLIC_OP_RUN_G16_256) {
+                run = 256;
+            } else {
+                run = op + 1;
+            }
+            continue;
+        } else if (op < SLIC_OP_DIFF_G16) {
+            bad_run = (op & 0x3f) + 1;
+            continue;
+        } else if (op < SLIC_OP_INDEX_G16) {
+            px += (op & 0x3f) - 32;
+        } else if (op < SLIC_OP_LUMA_G16) {
+            px = index16[op & 0x1f];
+            *d16++ = px; // already in the cache
+            continue;
+        } else { // LUMA_G16
+            diff = (op & 0x1f) << 8;
+            SLIC_NEED_DATA
+            diff |= *s++;
+            px += diff - 4096;
+        }
+        index16[SLIC_GRAY16_HASH(px)] = px;
+        *d16++ = px;
+    } // for each output pixel
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->curr_pixel = px;
+    pState->pInPtr = s;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_decode_gray16() */
+//
+// Add signed deltas to the RGB channels of a 16-bit per channel pixel
+//
+static uint64_t slic_add_rgb64(uint64_t px, int dr, int dg, int db)
+{
+    uint64_t r, g, b;
+
+    r = (uint16_t)(px + dr);
+    g = (uint16_t)((px >> 16) + dg);
+    b = (uint16_t)((px >> 32) + db);
+    return (px & 0xffff000000000000ULL) | r | (g << 16) | (b << 32);
+} /* slic_add_rgb64() */
+//
+// Decode 48-bpp (RGB) or 64-bpp (RGBA) pixels with 16-bits per channel
+//
+static int slic_decode_rgb64(SLICSTATE *pState, uint8_t *s, uint8_t *d, const uint8_t *pEnd)
+{
+    uint8_t op;
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    uint16_t *d16;
+    uint64_t px, *index64 = (uint64_t *)pState->index;
+    int32_t run = pState->run;
+    int i, iBpp = pState->bpp >> 3;
+    uint32_t u;
+
+    px = pState->curr_pixel64;
+    while (d < pEnd) {
+        if (run) {
+            run--;
+            goto store_pixel;
+        }
+        SLIC_NEED_DATA
+        op = *s++;
+        if (op >= SLIC_OP_RUN && op < SLIC_OP_RGB48) {
+            if (op == SLIC_OP_RUN1024) {
+                run = 1024;
+            } else if (op == SLIC_OP_RUN256) {
+                run = 256;
+            } else {
+                run = (op & 0x3f) + 1;
+            }
+            continue;
+        } else if (op < SLIC_OP_LUMA64) { // INDEX64
+            px = index64[op];
+            goto store_pixel; // already in the cache
+        } else if (op < SLIC_OP_DIFF) { // LUMA64
+            u = (op & 0x1f) << 16;
+            SLIC_NEED_DATA
+            u |= (*s++ << 8);
+            SLIC_NEED_DATA
+            u |= *s++;
+            i = (int)(u >> 12) - 256; // green delta
+            px = slic_add_rgb64(px, i + (int)((u >> 6) & 0x3f) - 32, i, i + (int)(u & 0x3f) - 32);
+        } else if (op < SLIC_OP_LUMA) { // DIFF
+            px = slic_add_rgb64(px, ((op >> 4) & 3) - 2, ((op >> 2) & 3) - 2, (op & 3) - 2);
+        } else if (op < SLIC_OP_RUN) { // LUMA
+            int vg = (op & 0x3f) - 32;
+            SLIC_NEED_DATA
+            op = *s++;
+            px = slic_add_rgb64(px, vg - 8 + (op >> 4), vg, vg - 8 + (op & 0xf));
+        } else { // RGB48 or RGBA64 literal
+            if (op == SLIC_OP_RGB48) {
+                px &= 0xffff000000000000ULL;
+                op = 48;
+            } else {
+                px = 0;
+                op = 64;
+            }
+            for (i = 0; i < op; i += 8) {
+                SLIC_NEED_DATA
+                px |= ((uint64_t)*s++ << i);
             }
-            pState->pInPtr += 768; // fixed size palette
         }
-        pState->iPixelCount = (uint32_t)pState->width * (uint32_t)pState->height;
-    } else {
-        return SLIC_BAD_FILE;
-    }
-    return SLIC_SUCCESS;
-} /* slic_init_decode() */
-
+        index64[SLIC_RGB64_HASH(px)] = px;
+store_pixel:
+        d16 = (uint16_t *)d;
+        d16[0] = (uint16_t)px;
+        d16[1] = (uint16_t)(px >> 16);
+        d16[2] = (uint16_t)(px >> 32);
+        if (iBpp == 8)
+            d16[3] = (uint16_t)(px >> 48);
+        d += iBpp;
+    } // for each output pixel
+    pState->run = run;
+    pState->curr_pixel64 = px;
+    pState->pInPtr = s;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_decode_rgb64() */
+#endif // SLIC_HIGH_BIT_DEPTH
 //
-// Read more data from the data source
-// if none exists --> error
-// returns 0 for success, 1 for error
+// The decoders of the 8-bpp, RGB565 and 24/32-bpp ops switch on the top 2 bits
+// of each op, which compiles to a jump table instead of a chain of tests, and
+// look up the color deltas of DIFF and LUMA ops. The tables are in FLASH on AVR.
+//
+#ifdef __AVR__
+#define SLIC_READ_DELTA16(t, i) pgm_read_word(&t[i])
+#define SLIC_READ_DELTA32(t, i) pgm_read_dword(&t[i])
+#define SLIC_TABLE PROGMEM
+#else
+#define SLIC_READ_DELTA16(t, i) t[i]
+#define SLIC_READ_DELTA32(t, i) t[i]
+#define SLIC_TABLE
+#endif
+//
+// The r/g/b deltas of each DIFF16 op as an RGB565 value; they're added to the
+// pixel a field at a time by SLIC_ADD_565()
+//
+static const uint16_t usDiff565[64] SLIC_TABLE = {
+    0xf7de, 0xf7df, 0xf7c0, 0xf7c1, 0xf7fe, 0xf7ff, 0xf7e0, 0xf7e1,
+    0xf01e, 0xf01f, 0xf000, 0xf001, 0xf03e, 0xf03f, 0xf020, 0xf021,
+    0xffde, 0xffdf, 0xffc0, 0xffc1, 0xfffe, 0xffff, 0xffe0, 0xffe1,
+    0xf81e, 0xf81f, 0xf800, 0xf801, 0xf83e, 0xf83f, 0xf820, 0xf821,
+    0x07de, 0x07df, 0x07c0, 0x07c1, 0x07fe, 0x07ff, 0x07e0, 0x07e1,
+    0x001e, 0x001f, 0x0000, 0x0001, 0x003e, 0x003f, 0x0020, 0x0021,
+    0x0fde, 0x0fdf, 0x0fc0, 0x0fc1, 0x0ffe, 0x0fff, 0x0fe0, 0x0fe1,
+    0x081e, 0x081f, 0x0800, 0x0801, 0x083e, 0x083f, 0x0820, 0x0821
+};
 //
-static int get_more_data(SLICSTATE *pState)
+// The r/g/b deltas of each DIFF op and the green delta of each LUMA op (which
+// is added to red and blue as well, less 8) as bytes 0-2, for SLIC_ADD_RGB()
+//
+static const uint32_t ulDiffRGB[64] SLIC_TABLE = {
+    0x00fefefe, 0x00fffefe, 0x0000fefe, 0x0001fefe, 0x00fefffe, 0x00fffffe,
+    0x0000fffe, 0x0001fffe, 0x00fe00fe, 0x00ff00fe, 0x000000fe, 0x000100fe,
+    0x00fe01fe, 0x00ff01fe, 0x000001fe, 0x000101fe, 0x00fefeff, 0x00fffeff,
+    0x0000feff, 0x0001feff, 0x00feffff, 0x00ffffff, 0x0000ffff, 0x0001ffff,
+    0x00fe00ff, 0x00ff00ff, 0x000000ff, 0x000100ff, 0x00fe01ff, 0x00ff01ff,
+    0x000001ff, 0x000101ff, 0x00fefe00, 0x00fffe00, 0x0000fe00, 0x0001fe00,
+    0x00feff00, 0x00ffff00, 0x0000ff00, 0x0001ff00, 0x00fe0000, 0x00ff0000,
+    0x00000000, 0x00010000, 0x00fe0100, 0x00ff0100, 0x00000100, 0x00010100,
+    0x00fefe01, 0x00fffe01, 0x0000fe01, 0x0001fe01, 0x00feff01, 0x00ffff01,
+    0x0000ff01, 0x0001ff01, 0x00fe0001, 0x00ff0001, 0x00000001, 0x00010001,
+    0x00fe0101, 0x00ff0101, 0x00000101, 0x00010101
+};
+static const uint32_t ulLumaRGB[64] SLIC_TABLE = {
+    0x00d8e0d8, 0x00d9e1d9, 0x00dae2da, 0x00dbe3db, 0x00dce4dc, 0x00dde5dd,
+    0x00dee6de, 0x00dfe7df, 0x00e0e8e0, 0x00e1e9e1, 0x00e2eae2, 0x00e3ebe3,
+    0x00e4ece4, 0x00e5ede5, 0x00e6eee6, 0x00e7efe7, 0x00e8f0e8, 0x00e9f1e9,
+    0x00eaf2ea, 0x00ebf3eb, 0x00ecf4ec, 0x00edf5ed, 0x00eef6ee, 0x00eff7ef,
+    0x00f0f8f0, 0x00f1f9f1, 0x00f2faf2, 0x00f3fbf3, 0x00f4fcf4, 0x00f5fdf5,
+    0x00f6fef6, 0x00f7fff7, 0x00f800f8, 0x00f901f9, 0x00fa02fa, 0x00fb03fb,
+    0x00fc04fc, 0x00fd05fd, 0x00fe06fe, 0x00ff07ff, 0x00000800, 0x00010901,
+    0x00020a02, 0x00030b03, 0x00040c04, 0x00050d05, 0x00060e06, 0x00070f07,
+    0x00081008, 0x00091109, 0x000a120a, 0x000b130b, 0x000c140c, 0x000d150d,
+    0x000e160e, 0x000f170f, 0x00101810, 0x00111911, 0x00121a12, 0x00131b13,
+    0x00141c14, 0x00151d15, 0x00161e16, 0x00171f17
+};
+//
+// Write iCount pixels of the gradient which continues from px by delta and
+// return the last one. Each pixel is computed from px rather than from the one
+// before it, so that the compiler can vectorize the loops.
+//
+static uint8_t slic_ramp8(uint8_t *d, uint8_t px, uint8_t delta, int iCount)
 {
-int i;
-    if (pState->pfnRead) { // read more data
-        i = (*pState->pfnRead)(&pState->file, pState->ucFileBuf, FILE_BUF_SIZE);
-        pState->pInEnd = &pState->ucFileBuf[i];
-        return 0;
-    }
-    return 1;
-} /* get_more_data() */
+    int i;
 
+    for (i=0; i<iCount; i++)
+        d[i] = (uint8_t)(px + (i + 1) * delta);
+    return (uint8_t)(px + iCount * delta);
+} /* slic_ramp8() */
+
+static uint16_t slic_ramp565(uint16_t *d, uint16_t px, uint16_t delta, int iCount)
+{
+    int i, r = px >> 11, g = (px >> 5) & 0x3f, b = px & 0x1f;
+    int dr = delta >> 11, dg = (delta >> 5) & 0x3f, db = delta & 0x1f;
+
+    for (i=1; i<=iCount; i++)
+        d[i-1] = (uint16_t)((((r + i * dr) & 0x1f) << 11) | (((g + i * dg) & 0x3f) << 5) | ((b + i * db) & 0x1f));
+    return d[iCount-1];
+} /* slic_ramp565() */
 //
-// Decode N pixels into the user-supplied output buffer
+// The red and blue channels are stepped as the 16-bit lanes of one value and
+// green as another; hi is the output alpha of the pixels
 //
-int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize) {
-	uint8_t op, px8, *s, *d;
-    const uint8_t *pEnd, *pSrcEnd;
-    int32_t iBpp;
-    uint32_t px, *index;
-	int32_t run, bad_run;
-    uint16_t *d16, *pEnd16, px16, *index16;
+static uint32_t slic_ramp_rgb(uint8_t *d, uint32_t px, uint32_t delta, int iCount, int iBpp, uint32_t hi)
+{
+    int i;
+    uint32_t u32, rb = px & 0x00ff00ff, g = px & 0xff00;
+    uint32_t drb = delta & 0x00ff00ff, dg = delta & 0xff00;
 
-    if (pState == NULL || pOut == NULL) {
-        return SLIC_INVALID_PARAM;
-	}
-    iBpp = pState->bpp >> 3;
-    index = pState->index;
-    d = pOut;
-    run = pState->run;
-    bad_run = pState->bad_run;
-    if (iOutSize > pState->iPixelCount)
-        iOutSize = pState->iPixelCount; // don't decode too much
-    pState->iPixelCount -= iOutSize;
-    pEnd = &d[iOutSize * (pState->bpp >> 3)];
-    s = pState->pInPtr;
-    pSrcEnd = pState->pInEnd;
-    if (s >= pSrcEnd) {
-        // Either we're at the end of the file or we need to read more data
-        if (get_more_data(pState) && run == 0)
-            return SLIC_DECODE_ERROR; // we're trying to go past the end, error
-        s = pState->ucFileBuf;
-        pSrcEnd = pState->pInEnd;
+    if (iBpp == 4) {
+        for (i=1; i<=iCount; i++) {
+            u32 = hi | ((rb + i * drb) & 0x00ff00ff) | ((g + i * dg) & 0xff00);
+            memcpy(&d[(i-1)*4], &u32, 4);
+        }
+    } else {
+        for (i=1; i<=iCount; i++) {
+            d[(i-1)*3] = (uint8_t)(px + i * delta);
+            d[(i-1)*3+1] = (uint8_t)((px >> 8) + i * (delta >> 8));
+            d[(i-1)*3+2] = (uint8_t)((px >> 16) + i * (delta >> 16));
+        }
     }
+    return (px & 0xff000000) | ((rb + iCount * drb) & 0x00ff00ff) | ((g + iCount * dg) & 0xff00);
+} /* slic_ramp_rgb() */
+//
+// Decode 8-bit grayscale/palette pixels, or the bytes of packed 1/2/4-bpp pixels
+//
+static int slic_decode_gray8(SLICSTATE *pState, uint8_t *s, uint8_t *d, const uint8_t *pEnd)
+{
+    uint8_t op, px8, grad = (uint8_t)pState->grad_delta; // run counts the pixels of a gradient when grad != 0
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    uint8_t *index8 = (uint8_t *)pState->index;
+    int32_t run = pState->run, bad_run = pState->bad_run;
+    int bGradient = (pState->flags & SLIC_FLAG_GRADIENT);
 
-    if (iBpp == 1) { // 8-bit grayscale/palette
-        uint8_t *index8 = (uint8_t *)pState->index;
-        px8 = (uint8_t)pState->curr_pixel;
-        if (pState->extra_pixel) {
-            pState->extra_pixel = 0;
-            *d++ = px8;
+    px8 = (uint8_t)pState->curr_pixel;
+    if (pState->extra_pixel && d < pEnd) {
+        pState->extra_pixel = 0;
+        *d++ = px8;
+    }
+    while (d < pEnd) {
+        if (run) {
+            int n = (int)(pEnd - d);
+            if (n > run)
+                n = run;
+            if (grad)
+                px8 = slic_ramp8(d, px8, grad, n);
+            else
+                memset(d, px8, n);
+            d += n;
+            run -= n;
+            if (run == 0)
+                grad = 0;
+            continue;
         }
-        while (d < pEnd) {
-            if (run) {
-                *d++ = px8; // need to deal with pixels 1 at a time
-                run--;
-                continue;
-            }
-            if (s >= pSrcEnd) {
-                // Either we're at the end of the file or we need to read more data
-                if (get_more_data(pState))
-                    return SLIC_DECODE_ERROR; // we're trying to go past the end, error
-                s = pState->ucFileBuf;
-                pSrcEnd = pState->pInEnd;
-            }
-            if (bad_run) {
+        if (s >= pSrcEnd) {
+            // Either we're at the end of the file or we need to read more data
+            if (get_more_data(pState, s))
+                return SLIC_DECODE_ERROR; // we're trying to go past the end, error
+            s = pState->ucFileBuf;
+            pSrcEnd = pState->pInEnd;
+        }
+        if (bad_run) { // as many of the literal pixels as the input and output have
+            int n = (int)(pEnd - d);
+            if (n > bad_run)
+                n = bad_run;
+            if (n > pSrcEnd - s)
+                n = (int)(pSrcEnd - s);
+            bad_run -= n;
+            while (n--) {
                 px8 = *s++;
                 *d++ = px8;
                 index8[SLIC_GRAY_HASH(px8)] = px8;
-                bad_run--;
-                continue;
             }
-            op = *s++; // get next compression op
-            if ((op & SLIC_OP_MASK) == SLIC_OP_RUN8) {
-                if (op == SLIC_OP_RUN8_1024) {
+            continue;
+        }
+        op = *s++; // get next compression op
+        switch (op & SLIC_OP_MASK) {
+            case SLIC_OP_RUN8:
+                if (op == SLIC_OP_GRADIENT8 && bGradient) {
+                    if (pSrcEnd - s < 2) { // the count and step are split between two reads
+                        if (get_more_data(pState, s))
+                            return SLIC_DECODE_ERROR;
+                        s = pState->ucFileBuf;
+                        pSrcEnd = pState->pInEnd;
+                        if (pSrcEnd - s < 2)
+                            return SLIC_DECODE_ERROR;
+                    }
+                    run = s[0] + 1;
+                    grad = s[1];
+                    s += 2;
+                    SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, 3, run)
+                    break;
+                }
+                if (op == SLIC_OP_RUN8_1024)
                     run = 1024;
-                } else if (op == SLIC_OP_RUN8_256) {
+                else if (op == SLIC_OP_RUN8_256)
                     run = 256;
-                } else {
+                else
                     run = op + 1;
-                }
-                continue;
-            } else if ((op & SLIC_OP_MASK) == SLIC_OP_BADRUN8) {
+                SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, run)
+                break;
+            case SLIC_OP_BADRUN8:
                 bad_run = (op & 0x3f) + 1;
-                continue;
-            } else if ((op & SLIC_OP_MASK) == SLIC_OP_INDEX8) {
+                SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 1 + bad_run, bad_run)
+                break;
+            case SLIC_OP_INDEX8:
+                SLIC_STAT(pState, SLIC_STAT_INDEX, 1, 1, 2)
                 *d++ = index8[op & 7];
                 px8 = index8[(op >> 3) & 7];
                 if (d < pEnd) { // fits in the requested output size?
@@ -651,7 +4093,9 @@ int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize) {
                 } else {
                     pState->extra_pixel = 1; // get it next time through
                 }
-            } else { // must be DIFF8
+                break;
+            default: // DIFF8
+                SLIC_STAT(pState, SLIC_STAT_DIFF, 1, 1, 2)
                 px8 += (op & 7)-4;
                 index8[SLIC_GRAY_HASH(px8)] = px8;
                 *d++ = px8;
@@ -662,68 +4106,120 @@ int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize) {
                 } else {
                     pState->extra_pixel = 1; // get it next time through
                 }
-            }
+                break;
         }
-        pState->run = run;
-        pState->bad_run = bad_run;
-        pState->curr_pixel = px8;
-        pState->pInPtr = s;
-        return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
-    } // 8-bit grayscale/palette decode
+    }
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->grad_delta = grad;
+    pState->curr_pixel = px8;
+    pState->pInPtr = s;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_decode_gray8() */
+//
+// Decode RGB565 pixels
+//
+static int slic_decode_rgb565(SLICSTATE *pState, uint8_t *s, uint8_t *d, const uint8_t *pEnd)
+{
+    uint8_t op;
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    uint16_t *d16, *pEnd16, px16, *index16;
+    uint16_t grad = (uint16_t)pState->grad_delta; // run counts the pixels of a gradient when grad != 0
+    int32_t run = pState->run, bad_run = pState->bad_run;
+    int bGradient = (pState->flags & SLIC_FLAG_GRADIENT);
 
-    if (iBpp == 2) { // RGB565
-        d16 = (uint16_t *)d;
-        index16 = (uint16_t *)pState->index;
-        pEnd16 = (uint16_t *)pEnd;
-        px16 = (uint16_t)pState->curr_pixel;
-        if (pState->extra_pixel) {
-            pState->extra_pixel = 0;
-            *d16++ = px16;
+    d16 = (uint16_t *)d;
+    index16 = (uint16_t *)pState->index;
+    pEnd16 = (uint16_t *)pEnd;
+    px16 = (uint16_t)pState->curr_pixel;
+    if (pState->extra_pixel && d16 < pEnd16) {
+        pState->extra_pixel = 0;
+        *d16++ = px16;
+    }
+    while (d16 < pEnd16) {
+        if (run) {
+            int n = (int)(pEnd16 - d16);
+            if (n > run)
+                n = run;
+            if (grad)
+                px16 = slic_ramp565(d16, px16, grad, n);
+            else
+                (*slic_get_kernels()->pfnFill)((uint8_t *)d16, n * 2, (uint32_t)px16 * 0x10001);
+            d16 += n;
+            run -= n;
+            if (run == 0)
+                grad = 0;
+            continue;
+        }
+        if (s >= pSrcEnd) {
+            // Either we're at the end of the file or we need to read more data
+            if (get_more_data(pState, s))
+                return SLIC_DECODE_ERROR; // we're trying to go past the end, error
+            s = pState->ucFileBuf;
+            pSrcEnd = pState->pInEnd;
         }
-        while (d16 < pEnd16) {
-            if (run) {
+        if (bad_run && pSrcEnd - s >= 2) { // as many literal pixels as the input and output have
+            int n = (int)(pEnd16 - d16);
+            if (n > bad_run)
+                n = bad_run;
+            if (n > (pSrcEnd - s) >> 1)
+                n = (int)((pSrcEnd - s) >> 1);
+            bad_run -= n;
+            while (n--) {
+                px16 = s[0] | (s[1] << 8);
+                s += 2;
                 *d16++ = px16;
-                run--;
-                continue;
+                index16[SLIC_RGB565_HASH(px16)] = px16;
             }
+            continue;
+        }
+        if (bad_run) { // the pixel is split between two reads
+            px16 = *s++;
             if (s >= pSrcEnd) {
                 // Either we're at the end of the file or we need to read more data
-                if (get_more_data(pState))
+                if (get_more_data(pState, s))
                     return SLIC_DECODE_ERROR; // we're trying to go past the end, error
                 s = pState->ucFileBuf;
                 pSrcEnd = pState->pInEnd;
             }
-            if (bad_run) {
-                px16 = *s++;
-                if (s >= pSrcEnd) {
-                    // Either we're at the end of the file or we need to read more data
-                    if (get_more_data(pState))
-                        return SLIC_DECODE_ERROR; // we're trying to go past the end, error
-                    s = pState->ucFileBuf;
-                    pSrcEnd = pState->pInEnd;
+            px16 |= (*s++ << 8);
+            *d16++ = px16;
+            index16[SLIC_RGB565_HASH(px16)] = px16;
+            bad_run--;
+            continue;
+        }
+        op = *s++;
+        switch (op & SLIC_OP_MASK) {
+            case SLIC_OP_RUN16:
+                if (op == SLIC_OP_GRADIENT16 && bGradient) {
+                    if (pSrcEnd - s < 3) { // the count and step are split between two reads
+                        if (get_more_data(pState, s))
+                            return SLIC_DECODE_ERROR;
+                        s = pState->ucFileBuf;
+                        pSrcEnd = pState->pInEnd;
+                        if (pSrcEnd - s < 3)
+                            return SLIC_DECODE_ERROR;
+                    }
+                    run = s[0] + 1;
+                    grad = s[1] | (s[2] << 8);
+                    s += 3;
+                    SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, 4, run)
+                    break;
                 }
-                px16 |= (*s++ << 8);
-                *d16++ = px16;
-                index16[SLIC_RGB565_HASH(px16)] = px16;
-                bad_run--;
-                continue;
-            }
-            op = *s++;
-            if ((op & SLIC_OP_MASK) == SLIC_OP_RUN16) {
-                if (op == SLIC_OP_RUN16_1024) {
+                if (op == SLIC_OP_RUN16_1024)
                     run = 1024;
-                    continue;
-                } else if (op == SLIC_OP_RUN16_256) {
+                else if (op == SLIC_OP_RUN16_256)
                     run = 256;
-                    continue;
-                } else {
+                else
                     run = op + 1;
-                    continue;
-                }
-            } else if ((op & SLIC_OP_MASK) == SLIC_OP_BADRUN16) {
+                SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, run)
+                break;
+            case SLIC_OP_BADRUN16:
                 bad_run = (op & 0x3f) + 1;
-                continue;
-            } else if ((op & SLIC_OP_MASK) == SLIC_OP_INDEX16) {
+                SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 1 + bad_run * 2, bad_run)
+                break;
+            case SLIC_OP_INDEX16:
+                SLIC_STAT(pState, SLIC_STAT_INDEX, 1, 1, 2)
                 *d16++ = index16[op & 7];
                 px16 = index16[(op >> 3) & 7];
                 if (d16 < pEnd16) { // fits in the requested output size?
@@ -731,135 +4227,513 @@ int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize) {
                 } else {
                     pState->extra_pixel = 1; // get it next time through
                 }
-            } else { // must be DIFF16
-                uint8_t r, g, b;
-                r = (uint8_t)(px16 >> 11);
-                g = (uint8_t)((px16 >> 5) & 0x3f);
-                b = (uint8_t)(px16 & 0x1f);
-                r += ((op >> 4) & 3) - 2;
-                g += ((op >> 2) & 3) - 2;
-                b += ((op >> 0) & 3) - 2;
-                px16 = (r << 11) | ((g & 0x3f) << 5) | (b & 0x1f);
+                break;
+            default: // DIFF16
+                SLIC_STAT(pState, SLIC_STAT_DIFF, 1, 1, 1)
+                px16 = (uint16_t)SLIC_ADD_565(px16, SLIC_READ_DELTA16(usDiff565, op & 0x3f));
                 index16[SLIC_RGB565_HASH(px16)] = px16;
                 *d16++ = px16;
-            }
-        } // for each output pixel
-        pState->run = run;
-        pState->bad_run = bad_run;
-        pState->curr_pixel = px16;
-        pState->pInPtr = s;
-        return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
-    } // RGB565 decode
+                break;
+        }
+    } // for each output pixel
+    pState->run = run;
+    pState->bad_run = bad_run;
+    pState->grad_delta = grad;
+    pState->curr_pixel = px16;
+    pState->pInPtr = s;
+    return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_decode_rgb565() */
+//
+// Decode 24/32-bpp pixels; iBpp is the size of the output pixels (3 or 4)
+//
+static int slic_decode_rgb(SLICSTATE *pState, uint8_t *s, uint8_t *d, const uint8_t *pEnd, int iBpp)
+{
+    uint8_t op;
+    const uint8_t *pSrcEnd = pState->pInEnd;
+    uint32_t px, pxo, *index = pState->index;
+    uint32_t grad = pState->grad_delta; // run counts the pixels of a gradient when grad != 0
+    uint32_t alpha_mask = 0xffffffff, alpha = 0; // output alpha when it isn't coded by the RGB ops
+#ifdef SLIC_ALPHA_STRIPS
+    uint8_t *pAlpha;
+#endif
+    int32_t run = pState->run, bad_run = pState->bad_run; // bad_run = 1 when run counts the pixels of a stored block
+    int bStored, bGradient;
+#ifdef SLIC_MATCH
+    SLICWINDOW *pWin = (pState->flags & SLIC_FLAG_MATCH) ? pState->pWindow : NULL;
+    uint8_t *pSync = d; // first output pixel not yet in the window
+    uint32_t ulOr; // the coded alpha of the output pixels, as the encoder put them in the window
+    uint32_t dist = pState->match_dist; // run counts the pixels of a match when dist != 0
+#endif
 
     px = pState->curr_pixel;
+    bStored = (pState->flags & SLIC_FLAG_STORED); // SLIC_OP_STORED instead of a run of 60
+    bGradient = (pState->flags & SLIC_FLAG_GRADIENT); // SLIC_OP_GRADIENT instead of a run of 59
+    if (pState->flags & (SLIC_FLAG_ALPHA_PLANE | SLIC_FLAG_CONSTANT_ALPHA)) {
+        alpha_mask = 0x00ffffff; // the RGB ops code these pixels as opaque
+        alpha = (uint32_t)pState->alpha << 24;
+    }
+#ifdef SLIC_ALPHA_STRIPS
+    pAlpha = (pState->flags & SLIC_FLAG_ALPHA_PLANE) ? pState->pStrip : NULL;
+#endif
+#ifdef SLIC_MATCH
+    ulOr = (iBpp == 3) ? 0xff000000 : ~alpha_mask;
+#endif
     while (d < pEnd) {
         int iHash;
+#ifdef SLIC_ALPHA_STRIPS
+        if (pAlpha) {
+            // each strip starts with its alpha plane; the RGB runs end with the strip
+            if (pState->strip_pos == pState->strip_len) {
+                int n = (pState->iStripPixels > SLIC_ALPHA_STRIP_SIZE) ? SLIC_ALPHA_STRIP_SIZE : pState->iStripPixels;
+                if (slic_decode_plane8(pState, &s, pAlpha, n, &pState->alpha_prev, pState->alpha_index) != SLIC_SUCCESS)
+                    return SLIC_DECODE_ERROR;
+                pSrcEnd = pState->pInEnd;
+                pState->iStripPixels -= n;
+                pState->strip_len = (uint16_t)n;
+                pState->strip_pos = 0;
+            }
+        }
+#endif
         if (run) {
+            if (bad_run) { // the rest of a stored block; run is its pixel count
+                int n;
+                if (pSrcEnd - s < 3) {
+                    if (get_more_data(pState, s))
+                        return SLIC_DECODE_ERROR;
+                    s = pState->ucFileBuf;
+                    pSrcEnd = pState->pInEnd;
+                    if (pSrcEnd - s < 3)
+                        return SLIC_DECODE_ERROR;
+                }
+                // as many pixels as the input, output (and alpha strip) have
+                n = (int)((pSrcEnd - s) / 3);
+                if (n > run)
+                    n = run;
+                if (n > (pEnd - d) / iBpp)
+                    n = (int)((pEnd - d) / iBpp);
+#ifdef SLIC_ALPHA_STRIPS
+                if (pAlpha && n > pState->strip_len - pState->strip_pos)
+                    n = pState->strip_len - pState->strip_pos;
+#endif
+                run -= n;
+                if (run == 0)
+                    bad_run = 0;
+                while (n--) {
 #ifdef UNALIGNED_ALLOWED
-            *(uint32_t *)d = px;
-#else
-            d[0] = (uint8_t)px;
-            d[1] = (uint8_t)(px >> 8);
-            d[2] = (uint8_t)(px >> 16);
-            d[3] = (uint8_t)(px >> 24);
+                    if (pSrcEnd - s >= 4) // the 4-byte read can't go past the end
+                        px = (px & 0xff000000) | (*(uint32_t *)s & 0xffffff);
+                    else
+#endif
+                    px = (px & 0xff000000) | s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16);
+                    s += 3;
+                    index[SLIC_RGB_HASH(px)] = px;
+#ifdef SLIC_ALPHA_STRIPS
+                    if (pAlpha)
+                        alpha = (uint32_t)pAlpha[pState->strip_pos++] << 24;
+#endif
+                    pxo = (px & alpha_mask) | alpha;
+                    SLIC_STORE_RGB(d, pxo)
+                    d += iBpp;
+                }
+                continue;
+            }
+#ifdef SLIC_MATCH
+            if (dist) { // the rest of a match; an overlapping copy repeats its pixels
+                int n = (int)((pEnd - d) / iBpp);
+                if (n > run)
+                    n = run;
+#ifdef SLIC_ALPHA_STRIPS
+                if (pAlpha && n > pState->strip_len - pState->strip_pos)
+                    n = pState->strip_len - pState->strip_pos;
+#endif
+                slic_window_add(pWin, pSync, (int)((d - pSync) / iBpp), iBpp, ulOr, NULL);
+                run -= n;
+                while (n--) {
+                    px = pWin->pixels[(pWin->pos - dist) & SLIC_WINDOW_MASK];
+                    pWin->pixels[pWin->pos++ & SLIC_WINDOW_MASK] = px;
+#ifdef SLIC_ALPHA_STRIPS
+                    if (pAlpha)
+                        alpha = (uint32_t)pAlpha[pState->strip_pos++] << 24;
+#endif
+                    pxo = (px & alpha_mask) | alpha;
+                    SLIC_STORE_RGB(d, pxo)
+                    d += iBpp;
+                }
+                pSync = d;
+                if (run == 0)
+                    dist = 0;
+                continue;
+            }
+#endif
+            if (grad) { // the rest of a gradient
+                int n = (int)((pEnd - d) / iBpp);
+                if (n > run)
+                    n = run;
+#ifdef SLIC_ALPHA_STRIPS
+                if (pAlpha) { // a pixel at a time, for its alpha
+                    n = 1;
+                    px = (px & 0xff000000) | SLIC_ADD_RGB(px, grad);
+                    alpha = (uint32_t)pAlpha[pState->strip_pos++] << 24;
+                    pxo = (px & alpha_mask) | alpha;
+                    SLIC_STORE_RGB(d, pxo)
+                } else
+#endif
+                px = slic_ramp_rgb(d, px, grad, n, iBpp, ((px & alpha_mask) | alpha) & 0xff000000);
+                d += n * iBpp;
+                run -= n;
+                if (run == 0)
+                    grad = 0;
+                continue;
+            }
+#ifdef SLIC_ALPHA_STRIPS
+            if (pAlpha)
+                alpha = (uint32_t)pAlpha[pState->strip_pos++] << 24;
+            else
 #endif
+            if (iBpp == 4) { // the whole run (or as much as fits) at once
+                int n = (int)((pEnd - d) >> 2);
+                if (n > run)
+                    n = run;
+                (*slic_get_kernels()->pfnFill)(d, n * 4, (px & alpha_mask) | alpha);
+                d += n * 4;
+                run -= n;
+                continue;
+            }
+            pxo = (px & alpha_mask) | alpha;
+            SLIC_STORE_RGB(d, pxo)
             run--;
             d += iBpp;
             continue;
         }
-        if (s >= pSrcEnd) {
-            // Either we're at the end of the file or we need to read more data
-            if (get_more_data(pState))
-                return SLIC_DECODE_ERROR; // we're trying to go past the end, error
-            s = pState->ucFileBuf;
-            pSrcEnd = pState->pInEnd;
+        if (pSrcEnd - s < 5) {
+            if (pState->pfnRead || s >= pSrcEnd) {
+                // Either we're at the end of the file or we need to read more data;
+                // the partial op at the end of the buffer is kept so that its
+                // color bytes (up to 4) don't straddle two reads
+                if (get_more_data(pState, s))
+                    return SLIC_DECODE_ERROR; // we're trying to go past the end, error
+                s = pState->ucFileBuf;
+                pSrcEnd = pState->pInEnd;
+            }
+            // near the end of the data; make sure that all of the op is there
+            op = *s;
+            if (pSrcEnd - s < ((op == SLIC_OP_RGBA) ? 5 : (op == SLIC_OP_RGB) ? 4 : ((op & SLIC_OP_MASK) == SLIC_OP_LUMA || (op == SLIC_OP_STORED && bStored)) ? 2 : 1))
+                return SLIC_DECODE_ERROR;
+            if (op == SLIC_OP_GRADIENT && bGradient && (pSrcEnd - s < 3 || (pSrcEnd - s < 4 && (s[2] & SLIC_OP_MASK) == SLIC_OP_LUMA)))
+                return SLIC_DECODE_ERROR;
+#ifdef SLIC_MATCH
+            if (op == SLIC_OP_MATCH && pWin && pSrcEnd - s < 4)
+                return SLIC_DECODE_ERROR;
+#endif
         }
-			op = *s++;
-            if (op >= SLIC_OP_RUN && op < SLIC_OP_RGB) {
-                if (op == SLIC_OP_RUN1024) {
-                    run = 1024;
-                    continue;
-                } else if (op == SLIC_OP_RUN256) {
-                    run = 256;
+        op = *s++;
+        switch (op & SLIC_OP_MASK) {
+            case SLIC_OP_INDEX:
+                px = index[op];
+                SLIC_STAT(pState, SLIC_STAT_INDEX, 1, 1, 1)
+                break;
+            case SLIC_OP_DIFF:
+                px = (px & 0xff000000) | SLIC_ADD_RGB(px, SLIC_READ_DELTA32(ulDiffRGB, op & 0x3f));
+                SLIC_STAT(pState, SLIC_STAT_DIFF, 1, 1, 1)
+                break;
+            case SLIC_OP_LUMA: { // the second byte has the red and blue deltas from green
+                uint32_t delta = SLIC_ADD_RGB(SLIC_READ_DELTA32(ulLumaRGB, op & 0x3f), (uint32_t)(s[0] >> 4) | ((uint32_t)(s[0] & 0x0f) << 16));
+                s++;
+                px = (px & 0xff000000) | SLIC_ADD_RGB(px, delta);
+                SLIC_STAT(pState, SLIC_STAT_LUMA, 1, 2, 1)
+                break;
+            }
+            default: // the runs, and the rarer ops at the end of SLIC_OP_RUN's range
+#ifdef SLIC_MATCH
+                if (op == SLIC_OP_MATCH && pWin) { // + length and distance
+                    run = s[0] + ((s[2] >> 5) << 8) + SLIC_MIN_MATCH;
+                    dist = s[1] + ((uint32_t)(s[2] & 0x1f) << 8) + 1;
+                    s += 3;
+                    if (dist > pWin->pos + (uint32_t)((d - pSync) / iBpp) || dist > SLIC_WINDOW_SIZE)
+                        return SLIC_DECODE_ERROR; // before the first pixel
+                    SLIC_STAT(pState, SLIC_STAT_MATCH, 1, 4, run)
                     continue;
-                } else {
+                }
+#endif
+                if (op < SLIC_OP_GRADIENT || (op == SLIC_OP_GRADIENT && !bGradient) || (op == SLIC_OP_STORED && !bStored)) {
                     run = (op & 0x3f) + 1;
+                    SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, run)
                     continue;
                 }
-            }
-            else if ((op & SLIC_OP_MASK) == SLIC_OP_INDEX) {
-                px = index[op];
-            }
-			else if (op == SLIC_OP_RGB) {
-                px &= 0xff000000;
+                if (op == SLIC_OP_RGB) {
+                    px &= 0xff000000;
 #ifdef UNALIGNED_ALLOWED
-                px |= (*(uint32_t *)s) & 0xffffff;
-#else
-                px |= s[0];
-                px |= ((uint32_t)s[1] << 8);
-                px |= ((uint32_t)s[2] << 16);
+                    if (pSrcEnd - s >= 4) { // the 4-byte read can't go past the end
+                        px |= (*(uint32_t *)s) & 0xffffff;
+                    } else
 #endif
-                s += 3;
-			}
-			else if (op == SLIC_OP_RGBA) {
+                    {
+                        px |= s[0];
+                        px |= ((uint32_t)s[1] << 8);
+                        px |= ((uint32_t)s[2] << 16);
+                    }
+                    s += 3;
+                    SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 4, 1)
+                } else if (op == SLIC_OP_RGBA) {
 #ifdef UNALIGNED_ALLOWED
-                px = *(uint32_t *)s;
-                s += 4;
+                    px = *(uint32_t *)s;
+                    s += 4;
 #else
-                px = *s++;
-                px |= ((uint32_t)*s++ << 8);
-                px |= ((uint32_t)*s++ << 16);
-                px |= ((uint32_t)*s++ << 24);
-#endif
-			}
-			else if ((op & SLIC_OP_MASK) == SLIC_OP_DIFF) {
-                uint8_t r, g, b;
-                r = px;
-                g = (px >> 8);
-                b = (px >> 16);
-                r += ((op >> 4) & 0x03) - 2;
-                g += ((op >> 2) & 0x03) - 2;
-                b += ( op       & 0x03) - 2;
-                px &= 0xff000000;
-                px |= (r & 0xff);
-                px |= ((uint32_t)(g & 0xff) << 8);
-                px |= ((uint32_t)(b & 0xff) << 16);
-			}
-			else if ((op & SLIC_OP_MASK) == SLIC_OP_LUMA) {
-				int b2 = *s++;
-				int vg = (op & 0x3f) - 32;
-                uint8_t r, g, b;
-                r = px;
-                g = (px >> 8);
-                b = (px >> 16);
-                r += vg - 8 + ((b2 >> 4) & 0x0f);
-                g += vg;
-                b += vg - 8 +  (b2       & 0x0f);
-                px &= 0xff000000;
-                px |= (r & 0xff);
-                px |= ((uint32_t)(g & 0xff) << 8);
-                px |= ((uint32_t)(b & 0xff) << 16);
-			}
+                    px = *s++;
+                    px |= ((uint32_t)*s++ << 8);
+                    px |= ((uint32_t)*s++ << 16);
+                    px |= ((uint32_t)*s++ << 24);
+#endif
+                    SLIC_STAT(pState, SLIC_STAT_RGBA, 1, 5, 1)
+                } else if (op == SLIC_OP_GRADIENT) { // + (count-1) + the DIFF or LUMA op of the step
+                    run = *s++ + 1;
+                    op = *s++;
+                    if ((op & SLIC_OP_MASK) == SLIC_OP_DIFF) {
+                        grad = SLIC_READ_DELTA32(ulDiffRGB, op & 0x3f);
+                        SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, 3, run)
+                    } else if ((op & SLIC_OP_MASK) == SLIC_OP_LUMA) {
+                        grad = SLIC_ADD_RGB(SLIC_READ_DELTA32(ulLumaRGB, op & 0x3f), (uint32_t)(s[0] >> 4) | ((uint32_t)(s[0] & 0x0f) << 16));
+                        s++;
+                        SLIC_STAT(pState, SLIC_STAT_GRADIENT, 1, 4, run)
+                    } else {
+                        return SLIC_DECODE_ERROR;
+                    }
+                    continue;
+                } else {
+                    if (op == SLIC_OP_RUN256) {
+                        run = 256;
+                    } else if (op == SLIC_OP_RUN1024) {
+                        run = 1024;
+                    } else { // SLIC_OP_STORED
+                        run = *s++ + 1;
+                        bad_run = 1;
+                        SLIC_STAT(pState, SLIC_STAT_LITERAL, 1, 2 + run * 3, run)
+                        continue;
+                    }
+                    SLIC_STAT(pState, SLIC_STAT_RUN, 1, 1, run)
+                    continue;
+                }
+                break;
+        }
         iHash = px * 3;
         iHash += ((px >> 8) * 5);
         iHash += ((px >> 16) * 7);
         iHash += ((px >> 24) * 11);
         index[iHash & 63] = px;
 
-#ifdef UNALIGNED_ALLOWED
-        *(uint32_t *)d = px;
-#else
-        d[0] = (uint8_t)px;
-        d[1] = (uint8_t)(px >> 8);
-        d[2] = (uint8_t)(px >> 16);
-        d[3] = (uint8_t)(px >> 24);
+#ifdef SLIC_ALPHA_STRIPS
+        if (pAlpha)
+            alpha = (uint32_t)pAlpha[pState->strip_pos++] << 24;
 #endif
+        pxo = (px & alpha_mask) | alpha;
+        SLIC_STORE_RGB(d, pxo)
         d += iBpp;
 	} // while decoding each pixel (3/4 bpp)
 
     pState->run = run;
     pState->bad_run = bad_run;
+    pState->grad_delta = grad;
+#ifdef SLIC_MATCH
+    if (pWin)
+        slic_window_add(pWin, pSync, (int)((d - pSync) / iBpp), iBpp, ulOr, NULL);
+    pState->match_dist = (uint16_t)dist;
+#endif
     pState->curr_pixel = px;
     pState->pInPtr = s;
     return (pState->iPixelCount == 0) ? SLIC_DONE : SLIC_SUCCESS;
+} /* slic_decode_rgb() */
+
+static int slic_decode_pixels(SLICSTATE *pState, uint8_t *pOut, int iOutSize);
+//
+// Decode palette indices and output them as RGB565 or 24-bpp pixels through
+// the LUT made by slic_set_palette_output(). The indices are decoded into the
+// end of the output buffer and expanded from the start of it; the expanded
+// pixels never catch up with the indices which haven't been read yet.
+//
+static int slic_decode_lut(SLICSTATE *pState, uint8_t *pOut, int iOutSize)
+{
+    int rc, i, iShift, iBytes, iPixels, iSize = pState->output_bpp >> 3;
+    uint32_t x;
+    slic_size_t iPitch = ((slic_size_t)pState->width * pState->bpp + 7) >> 3;
+    int bPadded = (((slic_size_t)pState->width * pState->bpp) & 7) != 0;
+    uint8_t *s, *d, *pLUT = pState->pPalette;
+    uint8_t ucMask, idx;
+
+    if (pState->bpp < 8) {
+        iBytes = slic_packed_bytes(pState, iOutSize);
+        if (iBytes < 1)
+            return SLIC_INVALID_PARAM;
+    } else {
+        iBytes = iOutSize;
+    }
+    iPixels = iOutSize;
+    if (iBytes > pState->iPixelCount) { // don't decode too much
+        iBytes = (int)pState->iPixelCount;
+        if (pState->bpp == 8)
+            iPixels = iBytes;
+        else if (bPadded) // whole rows
+            iPixels = (int)((iBytes / iPitch) * pState->width);
+        else
+            iPixels = (iBytes * 8) / pState->bpp;
+    }
+    s = &pOut[iPixels * iSize - iBytes];
+    rc = slic_decode_pixels(pState, s, iPixels); // decode the indices
+    if (rc != SLIC_SUCCESS && rc != SLIC_DONE)
+        return rc;
+    d = pOut;
+    ucMask = (uint8_t)((1 << pState->bpp) - 1);
+    iShift = 8;
+    x = 0;
+    for (i=0; i<iPixels; i++) {
+        if (pState->bpp == 8) {
+            idx = *s++;
+        } else {
+            iShift -= pState->bpp;
+            idx = (*s >> iShift) & ucMask;
+            if (bPadded && ++x == pState->width) { // rows start on a byte boundary
+                x = 0;
+                iShift = 0;
+            }
+            if (iShift == 0) {
+                iShift = 8;
+                s++;
+            }
+        }
+        if (iSize == 2) {
+            d[0] = pLUT[idx * 2];
+            d[1] = pLUT[idx * 2 + 1];
+        } else {
+            d[0] = pLUT[idx * 3];
+            d[1] = pLUT[idx * 3 + 1];
+            d[2] = pLUT[idx * 3 + 2];
+        }
+        d += iSize;
+    }
+    return rc;
+} /* slic_decode_lut() */
+
+//
+// Take up to iCount pixels from the image for a call to one of the pixel
+// decoders and return the input pointer they start from
+//
+static uint8_t * slic_decode_start(SLICSTATE *pState, int *piCount)
+{
+    uint8_t *s = pState->pInPtr;
+
+    *piCount = slic_take_pixels(pState, *piCount);
+    if (s >= pState->pInEnd && !get_more_data(pState, s)) {
+        // The end of the data is only an error if an op needs more of it;
+        // a pending run or pixel pair can still finish the image
+        s = pState->ucFileBuf;
+    }
+    return s;
+} /* slic_decode_start() */
+//
+// Decode N pixels (or packed bytes / palette indices) into the output buffer
+//
+static int slic_decode_pixels(SLICSTATE *pState, uint8_t *pOut, int iOutSize) {
+    uint8_t *s;
+    const uint8_t *pEnd;
+    int iBpp;
+
+    iBpp = pState->bpp >> 3;
+    if (pState->bpp < 8) { // packed pixels are decoded as bytes
+        iOutSize = slic_packed_bytes(pState, iOutSize);
+        if (iOutSize < 1)
+            return SLIC_INVALID_PARAM;
+        iBpp = 1;
+    }
+    s = slic_decode_start(pState, &iOutSize);
+    pEnd = &pOut[iOutSize * iBpp];
+    if (pState->colorspace == SLIC_GRAYALPHA)
+        return slic_decode_ga8(pState, s, pOut, pEnd);
+#ifdef SLIC_HIGH_BIT_DEPTH
+    if (pState->colorspace == SLIC_GRAY16)
+        return slic_decode_gray16(pState, s, pOut, pEnd);
+    if (iBpp > 4)
+        return slic_decode_rgb64(pState, s, pOut, pEnd);
+#endif
+    if (iBpp == 1) // 8-bit grayscale/palette or packed 1/2/4-bpp
+        return slic_decode_gray8(pState, s, pOut, pEnd);
+    if (iBpp == 2)
+        return slic_decode_rgb565(pState, s, pOut, pEnd);
+    return slic_decode_rgb(pState, s, pOut, pEnd, iBpp);
+} /* slic_decode_pixels() */
+#ifdef SLIC_PACK24
+//
+// Decode 24-bpp pixels a batch at a time as 32-bit pixels and pack them into
+// the output, which then doesn't need any room past the last pixel
+//
+static int slic_decode_rgb24(SLICSTATE *pState, uint8_t *pOut, int iOutSize)
+{
+    uint32_t ulBatch[SLIC_PACK24_BATCH];
+    uint8_t *s;
+    int n, rc;
+
+    if (iOutSize > pState->iPixelCount)
+        iOutSize = (int)pState->iPixelCount; // don't decode too much
+    do {
+        n = (iOutSize > SLIC_PACK24_BATCH) ? SLIC_PACK24_BATCH : iOutSize;
+        s = slic_decode_start(pState, &n);
+        rc = slic_decode_rgb(pState, s, (uint8_t *)ulBatch, (uint8_t *)&ulBatch[n], 4);
+        if (rc != SLIC_SUCCESS && rc != SLIC_DONE)
+            return rc;
+        slic_pack24(pOut, ulBatch, n);
+        pOut += n * 3;
+        iOutSize -= n;
+    } while (iOutSize > 0);
+    return rc;
+} /* slic_decode_rgb24() */
+#endif // SLIC_PACK24
+//
+// Add the data used by this slic_decode() call to the CRC; once the image is
+// done, read the trailer and compare
+//
+static int slic_check_checksum(SLICSTATE *pState, int rc)
+{
+    uint8_t ucCRC[4];
+    uint32_t crc;
+
+    pState->crc = slic_crc32c(pState->crc, pState->pCrcPtr, (int)(pState->pInPtr - pState->pCrcPtr));
+    pState->pCrcPtr = pState->pInPtr;
+    if (rc != SLIC_DONE)
+        return rc;
+    pState->pCrcPtr = NULL; // the trailer isn't part of it
+    if (slic_read_bytes(pState, ucCRC, 4))
+        return SLIC_CHECKSUM_ERROR; // truncated
+    crc = ucCRC[0] | ((uint32_t)ucCRC[1] << 8) | ((uint32_t)ucCRC[2] << 16) | ((uint32_t)ucCRC[3] << 24);
+    return (crc == pState->crc) ? SLIC_DONE : SLIC_CHECKSUM_ERROR;
+} /* slic_check_checksum() */
+//
+// Decode 1 or more pixels from the compressed data
+//
+int slic_decode(SLICSTATE *pState, uint8_t *pOut, int iOutSize) {
+    int rc;
+
+    if (pState == NULL || pOut == NULL || iOutSize < 0) {
+        return SLIC_INVALID_PARAM;
+	}
+    if (pState->dict_flags & SLIC_DICT_NEEDED)
+        return SLIC_NEED_DICTIONARY;
+#ifdef SLIC_MATCH
+    if ((pState->flags & SLIC_FLAG_MATCH) && pState->pWindow == NULL)
+        return SLIC_NEED_WINDOW;
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+    if ((pState->flags & SLIC_FLAG_ALPHA_PLANE) && pState->pStrip == NULL)
+        return SLIC_NEED_STRIP;
+#endif
+    SLIC_IO_ENTER(pState)
+    if (pState->output_bpp)
+        rc = slic_decode_lut(pState, pOut, iOutSize);
+#ifdef SLIC_PACK24
+    else if (pState->bpp == 24)
+        rc = slic_decode_rgb24(pState, pOut, iOutSize);
+#endif
+    else
+        rc = slic_decode_pixels(pState, pOut, iOutSize);
+    if (pState->pCrcPtr && (rc == SLIC_SUCCESS || rc == SLIC_DONE))
+        rc = slic_check_checksum(pState, rc);
+    SLIC_IO_LEAVE(pState)
+    return rc;
 } /* slic_decode() */
@@ -0,0 +1,318 @@
+//
+// SLIC - C++ encoder with a growing output buffer
+//
+// Copyright 2022 BitBank Software, Inc. All Rights Reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// slic_init_encode() needs an output buffer big enough for the whole file,
+// which isn't known until the image is encoded. SLICBufferEncoder writes into
+// a SLICBuffer instead. It grows as needed and doesn't have to be sized:
+//
+//   SLICBuffer buf;
+//   SLICBufferEncoder enc;
+//   for (each image) {
+//       enc.init(buf, iWidth, iHeight, 24);
+//       enc.encode(std::span(pPixels, iSize));
+//       send(buf); // buf.size() bytes in buf.chunk(0..chunk_count()-1)
+//   }
+//
+// The buffer is a chain of chunks. Each new chunk is twice the size of the
+// one before it (up to SLIC_BUFFER_MAX_CHUNK), so nothing is copied as it
+// grows. The encoder writes straight into the chunks. init() empties the
+// buffer but keeps its chunks, so encoding more images of a similar size
+// doesn't allocate any memory. A SLICBuffer can be moved but not copied.
+//
+// This uses the C API, so link slic.cpp (or slic.inl); it needs C++20.
+//
+#ifndef __SLIC_BUFFER__
+#define __SLIC_BUFFER__
+
+#if __cplusplus < 202002L
+#error "slic_buffer.h needs C++20"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+#include "slic.h"
+
+#ifndef SLIC_BUFFER_FIRST_CHUNK
+#define SLIC_BUFFER_FIRST_CHUNK 4096
+#endif
+#ifndef SLIC_BUFFER_MAX_CHUNK
+#define SLIC_BUFFER_MAX_CHUNK (1024*1024)
+#endif
+#define SLIC_BUFFER_MIN_ROOM 64 // the encoder needs at least this much space to write to
+
+class SLICBuffer
+{
+  public:
+    SLICBuffer() : _iSize(0), _iChunk(0) {}
+    SLICBuffer(SLICBuffer &&other) noexcept : _chunks(std::move(other._chunks)), _iSize(other._iSize), _iChunk(other._iChunk)
+    {
+        other._iSize = 0;
+        other._iChunk = 0;
+    }
+    SLICBuffer &operator=(SLICBuffer &&other) noexcept
+    {
+        _chunks = std::move(other._chunks);
+        _iSize = other._iSize;
+        _iChunk = other._iChunk;
+        other._iSize = 0;
+        other._iChunk = 0;
+        return *this;
+    }
+    SLICBuffer(const SLICBuffer &) = delete;
+    SLICBuffer &operator=(const SLICBuffer &) = delete;
+
+    size_t size() const { return _iSize; }
+    bool empty() const { return _iSize == 0; }
+    int chunk_count() const { return (_iSize == 0) ? 0 : (int)_iChunk + 1; }
+    std::span<const uint8_t> chunk(int i) const { return std::span<const uint8_t>(_chunks[i].pData.get(), _chunks[i].iUsed); }
+    size_t capacity() const
+    {
+        size_t iTotal = 0;
+        for (const Chunk &c : _chunks)
+            iTotal += c.iCapacity;
+        return iTotal;
+    }
+    //
+    // Copy the data to dst; it stops at the end of dst if it's too small
+    //
+    void copy_to(std::span<uint8_t> dst) const
+    {
+        size_t iOffset = 0;
+        for (int i=0; i<chunk_count() && iOffset < dst.size(); i++) {
+            size_t n = _chunks[i].iUsed;
+            if (n > dst.size() - iOffset)
+                n = dst.size() - iOffset;
+            memcpy(&dst[iOffset], _chunks[i].pData.get(), n);
+            iOffset += n;
+        }
+    }
+    std::vector<uint8_t> to_vector() const
+    {
+        std::vector<uint8_t> v(_iSize);
+        copy_to(v);
+        return v;
+    }
+    //
+    // Empty the buffer; the chunks are kept to be filled again
+    //
+    void clear()
+    {
+        for (Chunk &c : _chunks)
+            c.iUsed = 0;
+        _iSize = 0;
+        _iChunk = 0;
+    }
+    //
+    // Free the chunks (e.g. after an unusually large image)
+    //
+    void release()
+    {
+        _chunks.clear();
+        _iSize = 0;
+        _iChunk = 0;
+    }
+
+  private:
+    friend class SLICBufferEncoder;
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> pData;
+        size_t iCapacity, iUsed;
+    };
+    //
+    // Space left in the current chunk; when it has less than iMin, move on to
+    // the next one (allocating it if needed). Returns NULL if out of memory.
+    //
+    uint8_t *room(size_t iMin, size_t *piLen)
+    {
+        if (_chunks.empty() || _chunks[_iChunk].iCapacity - _chunks[_iChunk].iUsed < iMin) {
+            if (!_chunks.empty())
+                _iChunk++;
+            if (_iChunk == _chunks.size()) {
+                size_t iNew = _chunks.empty() ? SLIC_BUFFER_FIRST_CHUNK : _chunks.back().iCapacity * 2;
+                if (iNew > SLIC_BUFFER_MAX_CHUNK)
+                    iNew = SLIC_BUFFER_MAX_CHUNK;
+                uint8_t *p = new (std::nothrow) uint8_t[iNew];
+                if (p == NULL)
+                    return NULL;
+                _chunks.push_back(Chunk{std::unique_ptr<uint8_t[]>(p), iNew, 0});
+            }
+        }
+        Chunk &c = _chunks[_iChunk];
+        *piLen = c.iCapacity - c.iUsed;
+        return &c.pData[c.iUsed];
+    }
+    std::vector<Chunk> _chunks;
+    size_t _iSize; // bytes of data in all chunks
+    size_t _iChunk; // chunk being filled
+};
+//
+// Encoder which writes into a SLICBuffer
+//
+class SLICBufferEncoder
+{
+  public:
+    SLICBufferEncoder() : _pBuf(NULL), _bOutOfMemory(false) {}
+    SLICBufferEncoder(const SLICBufferEncoder &) = delete; // the state points to this object
+    SLICBufferEncoder &operator=(const SLICBufferEncoder &) = delete;
+    //
+    // Start encoding an image into buf, which is emptied first
+    //
+    int init(SLICBuffer &buf, uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette = NULL)
+    {
+        int rc;
+        size_t iLen;
+        uint8_t *p;
+
+        _pBuf = &buf;
+        _bOutOfMemory = false;
+        buf.clear();
+        rc = slic_init_encode((const char *)this, &_slic, iWidth, iHeight, iBpp, pPalette, open_cb, write_cb, NULL, 0);
+        if (rc != SLIC_SUCCESS)
+            return rc;
+        p = buf.room(SLIC_BUFFER_MIN_ROOM, &iLen);
+        if (p == NULL)
+            return SLIC_ENCODE_OVERFLOW;
+        // write straight into the chunk instead of the state's buffer
+        _slic.pOutBuffer = _slic.pOutPtr = p;
+        _slic.iOutSize = (iLen > 0x7fffffff) ? 0x7fffffff : (int32_t)iLen;
+        return SLIC_SUCCESS;
+    }
+    int set_option(int iOption, int iValue) { return slic_set_option(&_slic, iOption, iValue); }
+    int add_chunk(int iType, const uint8_t *pData, uint32_t iLen) { return slic_add_chunk(&_slic, iType, pData, iLen); }
+    int set_dictionary(const SLICDICT *pDict) { return slic_set_dictionary(&_slic, pDict); }
+#ifdef SLIC_MATCH
+    int set_window(SLICENCODEWINDOW *pWindow) { return slic_set_encode_window(&_slic, pWindow); }
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+    int set_strip(uint8_t *pStrip) { return slic_set_strip(&_slic, pStrip); }
+#endif
+    //
+    // Encode the pixels in a span of bytes; 1/2/4-bpp images are given as
+    // whole rows of packed bytes, or any whole bytes if the rows aren't padded.
+    // Returns SLIC_DONE after the last pixel of the image.
+    //
+    int encode(std::span<const uint8_t> pixels)
+    {
+        const uint64_t iRowBits = (uint64_t)_slic.width * _slic.bpp;
+        const size_t iMaxBytes = 1 << 30; // slic_encode() takes an int count
+        uint8_t *s = (uint8_t *)pixels.data();
+        size_t iBytes = pixels.size();
+        int rc = SLIC_INVALID_PARAM;
+
+        if (_pBuf == NULL)
+            return SLIC_INVALID_PARAM;
+        while (iBytes) {
+            size_t n = (iBytes > iMaxBytes) ? iMaxBytes : iBytes;
+            int iCount;
+            if (_slic.bpp >= 8) {
+                n -= n % (_slic.bpp >> 3);
+                iCount = (int)(n / (_slic.bpp >> 3));
+            } else if (iRowBits & 7) { // padded rows
+                const size_t iPitch = (size_t)(iRowBits + 7) >> 3;
+                n -= n % iPitch;
+                iCount = (int)((n / iPitch) * _slic.width);
+            } else {
+                iCount = (int)(n * 8 / _slic.bpp);
+            }
+            if (n == 0)
+                return SLIC_INVALID_PARAM; // a partial pixel or row
+            rc = slic_encode(&_slic, s, iCount);
+            if (_bOutOfMemory)
+                return SLIC_ENCODE_OVERFLOW;
+            if (rc != SLIC_SUCCESS)
+                break;
+            s += n;
+            iBytes -= n;
+        }
+        return rc;
+    }
+    slic_size_t get_output_size() { return _slic.iOffset; }
+
+  private:
+    static int open_cb(const char *filename, SLICFILE *pFile)
+    {
+        pFile->fHandle = (void *)filename;
+        return SLIC_SUCCESS;
+    }
+    //
+    // The encoder's buffer was written to the current chunk; point it at the
+    // space left after it, or at the next chunk. Data from anywhere else (the
+    // checksum) is copied in.
+    //
+    static int write_cb(SLICFILE *pFile, uint8_t *pData, int32_t iLen)
+    {
+        SLICBufferEncoder *pEnc = (SLICBufferEncoder *)pFile->fHandle;
+        SLICBuffer *pBuf = pEnc->_pBuf;
+        SLICSTATE *pState = &pEnc->_slic;
+        size_t n, iRoom;
+        int32_t iLeft = iLen;
+        uint8_t *p;
+
+        if (pEnc->_bOutOfMemory) // encode() fails; let the encoder finish in its own buffer
+            return iLen;
+        if (pData == pState->pOutBuffer) {
+            pBuf->_chunks[pBuf->_iChunk].iUsed += iLen;
+            pBuf->_iSize += iLen;
+            iLeft = 0;
+        }
+        while (iLeft) {
+            p = pBuf->room(1, &iRoom);
+            if (p == NULL)
+                break;
+            n = ((size_t)iLeft > iRoom) ? iRoom : (size_t)iLeft;
+            memcpy(p, pData, n);
+            pBuf->_chunks[pBuf->_iChunk].iUsed += n;
+            pBuf->_iSize += n;
+            pData += n;
+            iLeft -= (int32_t)n;
+        }
+        p = (iLeft == 0) ? pBuf->room(SLIC_BUFFER_MIN_ROOM, &iRoom) : NULL;
+        if (p == NULL) {
+            pEnc->_bOutOfMemory = true;
+            pState->pOutBuffer = pState->ucFileBuf;
+            pState->iOutSize = FILE_BUF_SIZE;
+            return iLen - iLeft;
+        }
+        pState->pOutBuffer = p;
+        pState->iOutSize = (iRoom > 0x7fffffff) ? 0x7fffffff : (int32_t)iRoom;
+        return iLen;
+    }
+    SLICSTATE _slic;
+    SLICBuffer *_pBuf;
+    bool _bOutOfMemory;
+};
+//
+// Encode a whole image into a new buffer; *pRC gets SLIC_DONE or the error
+//
+inline SLICBuffer slic_encode_to_buffer(std::span<const uint8_t> pixels, uint32_t iWidth, uint32_t iHeight, int iBpp, uint8_t *pPalette = NULL, int *pRC = NULL)
+{
+    SLICBuffer buf;
+    SLICBufferEncoder enc;
+    int rc;
+
+    rc = enc.init(buf, iWidth, iHeight, iBpp, pPalette);
+    if (rc == SLIC_SUCCESS)
+        rc = enc.encode(pixels);
+    if (pRC)
+        *pRC = rc;
+    return buf;
+} /* slic_encode_to_buffer() */
+
+#endif // __SLIC_BUFFER__
@@ -0,0 +1,341 @@
+//
+// SLIC - header-only C++ codec specialized for one pixel format and I/O policy
+//
+// Copyright 2022 BitBank Software, Inc. All Rights Reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// The SLIC class and slic_encode()/slic_decode() pick the pixel coder for the
+// image on every call. When a program knows its pixel format at compile time,
+// SLICEncoder<Format, IO> and SLICDecoder<Format, IO> call that format's coder
+// directly, so it can be inlined and the coders of the other formats aren't
+// compiled into the program at all:
+//
+//   SLICEncoder<SLICRGB565, SLICMemoryIO> enc;
+//   enc.init(320, 240, SLICMemoryIO(pOut, iOutSize));
+//   enc.encode(pPixels, 320*240);
+//
+//   SLICDecoder<SLICRGB565, SLICFileIO> dec;
+//   dec.init(SLICFileIO(f)); // fails if the file isn't RGB565
+//   dec.decode(pPixels, 320*240);
+//
+// The I/O policy is one of:
+//   SLICMemoryIO - a buffer in memory; no callbacks at all
+//   SLICFileIO   - a stdio FILE which the caller opens and closes
+//   SLICUserIO   - any callable taking (uint8_t *pBuf, int32_t iLen) and
+//                  returning the number of bytes read or written
+// The file and user policies are called once per FILE_BUF_SIZE bytes.
+//
+// This header includes the C code (slic.inl) with internal linkage, so the
+// program doesn't link slic.cpp for it; it needs C++17.
+//
+#ifndef __SLIC_CODEC__
+#define __SLIC_CODEC__
+
+#if __cplusplus < 201703L
+#error "slic_codec.h needs C++17"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#ifndef ARDUINO
+#include <stdio.h>
+#endif
+#include "slic.h"
+//
+// The system headers of slic.inl have to be included at global scope
+// before it is included in a namespace below
+//
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdlib.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+namespace slic_impl {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "slic.inl"
+#pragma GCC diagnostic pop
+} // namespace slic_impl
+} // namespace
+//
+// Pixel formats
+//
+template <int Bpp, int Colorspace>
+struct SLICFormat {
+    static constexpr int bpp = Bpp;
+    static constexpr int colorspace = Colorspace;
+};
+typedef SLICFormat<1, SLIC_GRAYSCALE> SLICGray1;
+typedef SLICFormat<2, SLIC_GRAYSCALE> SLICGray2;
+typedef SLICFormat<4, SLIC_GRAYSCALE> SLICGray4;
+typedef SLICFormat<8, SLIC_GRAYSCALE> SLICGray8;
+typedef SLICFormat<8, SLIC_PALETTE> SLICPalette8;
+typedef SLICFormat<16, SLIC_RGB565> SLICRGB565;
+typedef SLICFormat<16, SLIC_GRAYALPHA> SLICGrayAlpha;
+typedef SLICFormat<24, SLIC_SRGB> SLICRGB24;
+typedef SLICFormat<32, SLIC_SRGB> SLICRGBA32;
+#ifdef SLIC_HIGH_BIT_DEPTH
+typedef SLICFormat<16, SLIC_GRAY16> SLICGray16;
+typedef SLICFormat<48, SLIC_SRGB> SLICRGB48;
+typedef SLICFormat<64, SLIC_SRGB> SLICRGBA64;
+#endif
+//
+// I/O policies; read() returns the next bytes of the file in order (it never
+// seeks), as SLIC_READ_CALLBACK does
+//
+struct SLICMemoryIO {
+    static constexpr bool bMemory = true;
+    SLICMemoryIO() : pData(NULL), iSize(0) {}
+    SLICMemoryIO(uint8_t *pBuf, int iLen) : pData(pBuf), iSize(iLen) {}
+    uint8_t *pData;
+    int iSize;
+};
+
+#ifndef ARDUINO
+struct SLICFileIO {
+    static constexpr bool bMemory = false;
+    SLICFileIO() : f(NULL) {}
+    explicit SLICFileIO(FILE *file) : f(file) {}
+    int read(uint8_t *pBuf, int32_t iLen) { return (int)fread(pBuf, 1, iLen, f); }
+    int write(const uint8_t *pBuf, int32_t iLen) { return (int)fwrite(pBuf, 1, iLen, f); }
+    FILE *f;
+};
+#endif
+
+template <class F>
+struct SLICUserIO {
+    static constexpr bool bMemory = false;
+    SLICUserIO() : fn() {}
+    explicit SLICUserIO(const F &f) : fn(f) {}
+    int read(uint8_t *pBuf, int32_t iLen) { return fn(pBuf, iLen); }
+    int write(const uint8_t *pBuf, int32_t iLen) { return fn((uint8_t *)pBuf, iLen); }
+    F fn;
+};
+//
+// The C code reaches the policy object through SLICFILE.fHandle. The open
+// callback is what sets it, since slic_init_decode() clears the state first,
+// so the object is passed in place of the file name.
+//
+template <class IO>
+struct SLICIOCallbacks {
+    static int open(const char *filename, SLICFILE *pFile)
+    {
+        pFile->fHandle = (void *)filename;
+        return SLIC_SUCCESS;
+    }
+    static int read(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen)
+    {
+        return ((IO *)pFile->fHandle)->read(pBuf, iLen);
+    }
+    static int write(SLICFILE *pFile, uint8_t *pBuf, int32_t iLen)
+    {
+        return ((IO *)pFile->fHandle)->write(pBuf, iLen);
+    }
+};
+//
+// Encoder for images of one pixel format
+//
+template <class Format, class IO>
+class SLICEncoder
+{
+  public:
+    SLICEncoder() {}
+    SLICEncoder(const SLICEncoder &) = delete; // the state points to _io
+    SLICEncoder &operator=(const SLICEncoder &) = delete;
+
+    int init(uint32_t iWidth, uint32_t iHeight, const IO &io, uint8_t *pPalette = NULL)
+    {
+        int rc;
+
+        if ((Format::colorspace == SLIC_PALETTE) != (pPalette != NULL))
+            return SLIC_INVALID_PARAM;
+        _io = io;
+        if constexpr (IO::bMemory)
+            rc = slic_impl::slic_init_encode(NULL, &_slic, iWidth, iHeight, Format::bpp, pPalette, NULL, NULL, _io.pData, _io.iSize);
+        else
+            rc = slic_impl::slic_init_encode((const char *)&_io, &_slic, iWidth, iHeight, Format::bpp, pPalette, SLICIOCallbacks<IO>::open, SLICIOCallbacks<IO>::write, NULL, 0);
+        if (rc == SLIC_SUCCESS && _slic.colorspace != Format::colorspace)
+            rc = slic_impl::slic_set_option(&_slic, SLIC_OPTION_COLORSPACE, Format::colorspace);
+        return rc;
+    }
+    int set_option(int iOption, int iValue) { return slic_impl::slic_set_option(&_slic, iOption, iValue); }
+    int add_chunk(int iType, const uint8_t *pData, uint32_t iLen) { return slic_impl::slic_add_chunk(&_slic, iType, pData, iLen); }
+    int set_dictionary(const SLICDICT *pDict) { return slic_impl::slic_set_dictionary(&_slic, pDict); }
+#ifdef SLIC_MATCH
+    int set_window(SLICENCODEWINDOW *pWindow) { return slic_impl::slic_set_encode_window(&_slic, pWindow); }
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+    int set_strip(uint8_t *pStrip) { return slic_impl::slic_set_strip(&_slic, pStrip); }
+#endif
+    //
+    // Same as slic_encode(), with the options handled by the same code; only
+    // the coder of the pixels is chosen at compile time
+    //
+    int encode(uint8_t *pPixels, int iPixelCount)
+    {
+        return slic_impl::slic_encode_image(&_slic, pPixels, iPixelCount, pixel_coder());
+    }
+    slic_size_t get_output_size() { return _slic.iOffset; }
+
+  private:
+    slic_impl::SLIC_PIXEL_CODER *pixel_coder()
+    {
+        if constexpr (Format::bpp <= 8) { // including the bytes of packed pixels
+            return slic_impl::slic_encode_gray8;
+        } else if constexpr (Format::colorspace == SLIC_RGB565) {
+            return slic_impl::slic_encode_rgb565;
+        } else if constexpr (Format::colorspace == SLIC_GRAYALPHA) {
+            return slic_impl::slic_encode_ga8;
+#ifdef SLIC_HIGH_BIT_DEPTH
+        } else if constexpr (Format::colorspace == SLIC_GRAY16) {
+            return slic_impl::slic_encode_gray16;
+        } else if constexpr (Format::bpp > 32) {
+            return slic_impl::slic_encode_rgb64;
+#endif
+        } else {
+#ifdef SLIC_ALPHA_STRIPS
+            if constexpr (Format::bpp == 32) {
+                if (_slic.flags & SLIC_FLAG_ALPHA_PLANE)
+                    return slic_impl::slic_encode_strips;
+            }
+#endif
+            return slic_impl::slic_encode_rgb;
+        }
+    }
+    SLICSTATE _slic;
+    IO _io;
+};
+//
+// Decoder for images of one pixel format
+//
+template <class Format, class IO>
+class SLICDecoder
+{
+  public:
+    SLICDecoder() {}
+    SLICDecoder(const SLICDecoder &) = delete; // the state points to _io
+    SLICDecoder &operator=(const SLICDecoder &) = delete;
+    //
+    // Read the header; images of other pixel formats are rejected
+    // with SLIC_INVALID_PARAM (24/32-bpp can be sRGB or linear)
+    //
+    int init(const IO &io, uint8_t *pPalette = NULL)
+    {
+        int rc;
+
+        _io = io;
+        if constexpr (IO::bMemory)
+            rc = slic_impl::slic_init_decode(NULL, &_slic, _io.pData, _io.iSize, pPalette, NULL, NULL);
+        else
+            rc = slic_impl::slic_init_decode((const char *)&_io, &_slic, NULL, 0, pPalette, SLICIOCallbacks<IO>::open, SLICIOCallbacks<IO>::read);
+        if (rc != SLIC_SUCCESS)
+            return rc;
+        if (_slic.bpp != Format::bpp)
+            return SLIC_INVALID_PARAM;
+        if (_slic.colorspace != Format::colorspace && !(Format::bpp >= 24 && _slic.colorspace == SLIC_LINEAR))
+            return SLIC_INVALID_PARAM;
+        return SLIC_SUCCESS;
+    }
+    int set_option(int iOption, int iValue) { return slic_impl::slic_set_option(&_slic, iOption, iValue); }
+    int get_chunk(int iType, uint8_t *pDst, uint32_t *pLen)
+    {
+        // the file and user policies only read forward; the chunks have gone by
+        static_assert(IO::bMemory, "get_chunk() needs SLICMemoryIO");
+        return slic_impl::slic_get_chunk(&_slic, iType, pDst, pLen);
+    }
+    int set_dictionary(const SLICDICT *pDict) { return slic_impl::slic_set_dictionary(&_slic, pDict); }
+#ifdef SLIC_MATCH
+    int set_window(SLICWINDOW *pWindow) { return slic_impl::slic_set_window(&_slic, pWindow); }
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+    int set_strip(uint8_t *pStrip) { return slic_impl::slic_set_strip(&_slic, pStrip); }
+#endif
+    uint32_t get_dictionary_id() { return _slic.dict_id; }
+    //
+    // Same as slic_decode()
+    //
+    int decode(uint8_t *pOut, int iOutSize)
+    {
+        int rc;
+
+        if (pOut == NULL || iOutSize < 0)
+            return SLIC_INVALID_PARAM;
+        if (_slic.dict_flags & SLIC_DICT_NEEDED)
+            return SLIC_NEED_DICTIONARY;
+#ifdef SLIC_MATCH
+        if ((_slic.flags & SLIC_FLAG_MATCH) && _slic.pWindow == NULL)
+            return SLIC_NEED_WINDOW;
+#endif
+#ifdef SLIC_ALPHA_STRIPS
+        if ((_slic.flags & SLIC_FLAG_ALPHA_PLANE) && _slic.pStrip == NULL)
+            return SLIC_NEED_STRIP;
+#endif
+        rc = decode_pixels(pOut, iOutSize);
+        if (_slic.pCrcPtr && (rc == SLIC_SUCCESS || rc == SLIC_DONE))
+            rc = slic_impl::slic_check_checksum(&_slic, rc);
+        return rc;
+    }
+    int get_width() { return (int)_slic.width; }
+    int get_height() { return (int)_slic.height; }
+
+  private:
+    int decode_pixels(uint8_t *pOut, int iOutSize)
+    {
+        uint8_t *s;
+
+        if constexpr (Format::colorspace == SLIC_PALETTE) {
+            if (_slic.output_bpp)
+                return slic_impl::slic_decode_lut(&_slic, pOut, iOutSize);
+        }
+        if constexpr (Format::bpp < 8) { // packed pixels are decoded as bytes
+            iOutSize = slic_impl::slic_packed_bytes(&_slic, iOutSize);
+            if (iOutSize < 1)
+                return SLIC_INVALID_PARAM;
+        }
+#ifdef SLIC_PACK24
+        if constexpr (Format::bpp == 24)
+            return slic_impl::slic_decode_rgb24(&_slic, pOut, iOutSize);
+#endif
+        s = slic_impl::slic_decode_start(&_slic, &iOutSize);
+        if constexpr (Format::bpp <= 8) {
+            return slic_impl::slic_decode_gray8(&_slic, s, pOut, &pOut[iOutSize]);
+        } else if constexpr (Format::colorspace == SLIC_RGB565) {
+            return slic_impl::slic_decode_rgb565(&_slic, s, pOut, &pOut[iOutSize * 2]);
+        } else if constexpr (Format::colorspace == SLIC_GRAYALPHA) {
+            return slic_impl::slic_decode_ga8(&_slic, s, pOut, &pOut[iOutSize * 2]);
+#ifdef SLIC_HIGH_BIT_DEPTH
+        } else if constexpr (Format::colorspace == SLIC_GRAY16) {
+            return slic_impl::slic_decode_gray16(&_slic, s, pOut, &pOut[iOutSize * 2]);
+        } else if constexpr (Format::bpp > 32) {
+            return slic_impl::slic_decode_rgb64(&_slic, s, pOut, &pOut[iOutSize * (Format::bpp >> 3)]);
+#endif
+        } else {
+            return slic_impl::slic_decode_rgb(&_slic, s, pOut, &pOut[iOutSize * (Format::bpp >> 3)], Format::bpp >> 3);
+        }
+    }
+    SLICSTATE _slic;
+    IO _io;
+};
+
+#endif // __SLIC_CODEC__
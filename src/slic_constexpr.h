@@ -0,0 +1,147 @@
+//
+// SLIC - compile-time (constexpr) encoder for embedded assets
+//
+// Copyright 2022 BitBank Software, Inc. All Rights Reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// Encodes RGB565 images while the program is compiled, so that firmware can
+// carry its images as SLIC data without a conversion step:
+//
+//   static constexpr uint16_t usIcon[32*32] = { ... };
+//   static constexpr auto ucIcon = slic_constexpr_rgb565<usIcon, 32, 32>();
+//   static_assert(ucIcon.size() < sizeof(usIcon) / 2);
+//
+// ucIcon is a std::array<uint8_t, N> of exactly the bytes slic_encode()
+// writes for the same pixels and is decoded with slic_init_decode() as usual.
+// Compilers limit the work done in a constant expression; large images may
+// need -fconstexpr-ops-limit / -fconstexpr-loop-limit (gcc) or
+// -fconstexpr-steps (clang).
+//
+#ifndef __SLIC_CONSTEXPR__
+#define __SLIC_CONSTEXPR__
+
+#if __cplusplus < 202002L
+#error "slic_constexpr.h needs C++20"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <iterator>
+#include "slic.h"
+
+//
+// Encode iWidth x iHeight RGB565 pixels with the same ops as slic_encode()
+// does in one call. When pOut is nullptr the bytes are only counted, so the
+// size can be known before the output exists. Returns the size of the data.
+//
+constexpr size_t slic_constexpr_rgb565(const uint16_t *pPixels, uint32_t iWidth, uint32_t iHeight, uint8_t *pOut)
+{
+    const size_t iCount = (size_t)iWidth * iHeight;
+    uint16_t index16[8] = {}; // must match the decoder's starting cache
+    uint16_t px16, px16_prev = 0, px16_next;
+    size_t i = 0, iLen = 0;
+    int run = 0, bad_run = 0, prev_op = -1;
+    auto put = [&](int b) {
+        if (pOut)
+            pOut[iLen] = (uint8_t)b;
+        iLen++;
+    };
+    auto store_run = [&]() { // same as slic_store_run8()
+        while (run >= 256) {
+            put(SLIC_OP_RUN16_256);
+            run -= 256;
+        }
+        while (run >= 62) {
+            put(SLIC_OP_RUN16 | 61);
+            run -= 62;
+        }
+        if (run > 0)
+            put(SLIC_OP_RUN16 | (run - 1));
+        run = 0;
+    };
+
+    // 10-byte header, little-endian
+    for (int j=0; j<32; j+=8)
+        put((SLIC_MAGIC >> j) & 0xff);
+    put(iWidth & 0xff);
+    put((iWidth >> 8) & 0xff);
+    put(iHeight & 0xff);
+    put((iHeight >> 8) & 0xff);
+    put(16);
+    put(SLIC_RGB565);
+
+    while (i < iCount) {
+        px16 = pPixels[i++];
+        px16_next = (i < iCount) ? pPixels[i] : 0;
+        if (px16 == px16_prev) {
+            if (++run == 1024) { // don't let the pending run get too long to store
+                put(SLIC_OP_RUN16_1024);
+                run = 0;
+            }
+            prev_op = SLIC_OP_RUN16;
+        } else {
+            int index_pos, index_next;
+            if (run > 0)
+                store_run();
+            index_pos = SLIC_RGB565_HASH(px16);
+            index_next = SLIC_RGB565_HASH(px16_next);
+            if (index16[index_pos] == px16 && index16[index_next] == px16_next && i < iCount) {
+                // store the pair as indices
+                put(SLIC_OP_INDEX16 | (index_pos | (index_next << 3)));
+                px16 = pPixels[i++]; // skipped ahead 1 pixel
+                prev_op = SLIC_OP_INDEX16;
+            } else { // try to do a difference from prev pixel
+                int dr, dg, db;
+
+                index16[index_pos] = px16;
+                dr = (px16 >> 11) - (px16_prev >> 11);
+                dg = ((px16 >> 5) & 0x3f) - ((px16_prev >> 5) & 0x3f);
+                db = (px16 & 0x1f) - (px16_prev & 0x1f);
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    put(SLIC_OP_DIFF16 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                    prev_op = SLIC_OP_DIFF16;
+                } else if (prev_op == SLIC_OP_BADRUN16 && bad_run < 64) {
+                    bad_run++; // add this bad pixel to an existing run
+                    put(px16 & 0xff);
+                    put(px16 >> 8);
+                    if (pOut)
+                        pOut[iLen - 1 - (bad_run * 2)]++;
+                } else { // start a new run of bad pixels
+                    put(SLIC_OP_BADRUN16 | 0);
+                    put(px16 & 0xff);
+                    put(px16 >> 8);
+                    bad_run = 1;
+                    prev_op = SLIC_OP_BADRUN16;
+                }
+            }
+        }
+        px16_prev = px16;
+    }
+    store_run();
+    return iLen;
+} /* slic_constexpr_rgb565() */
+//
+// Encode a constexpr array of Width x Height RGB565 pixels (a C array or
+// std::array with static storage) into a std::array of its SLIC data
+//
+template <const auto &Pixels, uint32_t Width, uint32_t Height>
+consteval auto slic_constexpr_rgb565()
+{
+    static_assert(std::size(Pixels) == (size_t)Width * Height, "the pixel array doesn't match the image size");
+    static_assert(Width > 0 && Height > 0 && Width <= 0xffff && Height <= 0xffff, "invalid image size");
+    std::array<uint8_t, slic_constexpr_rgb565(std::data(Pixels), Width, Height, nullptr)> ucOut{};
+    slic_constexpr_rgb565(std::data(Pixels), Width, Height, ucOut.data());
+    return ucOut;
+} /* slic_constexpr_rgb565() */
+
+#endif // __SLIC_CONSTEXPR__